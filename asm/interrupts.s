@@ -106,6 +106,7 @@ isr_common:
 	mov es, ax
 	mov fs, ax
 	mov gs, ax
+	cld				; The interrupted code may be in the middle of a backward string copy
 
 	call isr_handler
 
@@ -130,6 +131,7 @@ irq_common_stub:
     mov es, ax
     mov fs, ax
     mov gs, ax
+    cld
 
     call irq_handler
 
@@ -1,3 +1,5 @@
+#define LOG_SUBSYS LOG_SYS_CONSOLE
+
 #include "console/console.h"
 #include "stdio.h"
 #include "dev/kbd.h"
@@ -8,7 +10,9 @@
 #include "ds/hashtable.h"
 #include "stdbool.h"
 #include "fs/vfs.h"
+#include "fs/poll.h"
 #include "debug.h"
+#include "log.h"
 
 typedef void (*console_func_t)(int argc, char *argv[]);
 
@@ -23,6 +27,7 @@ void process_command(const char *command);
 void console_help(int argc, char *argv[]);
 void console_echo(int argc, char *argv[]);
 void console_mount(int argc, char *argv[]);
+void console_log(int argc, char *argv[]);
 
 uint8_t map_us[128] = {
 		0, 0, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
@@ -58,6 +63,7 @@ void console_run()
 	hashtable_insert(command_map, "help", 0, console_help);
 	hashtable_insert(command_map, "echo", 0, console_echo);
 	hashtable_insert(command_map, "mount", 0, console_mount);
+	hashtable_insert(command_map, "log", 0, console_log);
 
 	uint16_t current = 0;
 	kbbuffer = (uint8_t *)kmalloc(sizeof(uint8_t) * 256); // 256 byte keyboard buffer
@@ -73,9 +79,15 @@ void console_run()
 	pipe_t *kbd_pipe = (pipe_t *)kbdnode->device;
 	debug("Keyboard pipe is at 0x%x\n", kbd_pipe);
 
+	pollset_t *events = pollset_create();
+	pollset_add(events, kbdnode, POLLIN, NULL);
+	poll_event_t event;
+
 	while (1) {
-		while (vfs_read(kbdnode, 0, sizeof(kbd_event_t), (uint8_t *)buff) != 0) {
-			__asm__ __volatile__("hlt");
+		if (vfs_read(kbdnode, 0, sizeof(kbd_event_t), (uint8_t *)buff) != 0) {
+			// Drained, sleep until the keyboard pushes more
+			pollset_wait(events, &event, 1, -1);
+			continue;
 		}
 
 		uint8_t c = map_keycode_to_char(buff->keycode);
@@ -215,7 +227,8 @@ void console_help(int argc, char *argv[])
 OS Help.\n\
 Available commands:\n\n\
 echo\t\tEcho back the contents of the first argument.\n\
-mount\t\tDisplay the mounted filesystems\
+mount\t\tDisplay the mounted filesystems\n\
+log\t\tSet the log level (0-7) of a subsystem.\n\
 help\t\tDisplay this info screen.\n");
 
 }
@@ -240,3 +253,24 @@ void console_mount(int argc, char *argv[])
 		hashtable_walk(mounts, &mount_walker);
 	}
 }
+
+void console_log(int argc, char *argv[])
+{
+	if (argc != 3) {
+		kprintf("Usage: log <subsystem> <level>\n");
+		return;
+	}
+
+	int subsys = log_find_subsys(argv[1]);
+	if (subsys < 0) {
+		kprintf("Unknown subsystem %s\n", argv[1]);
+		return;
+	}
+
+	if (argv[2][0] < '0' || argv[2][0] > '0' + LOG_DEBUG || argv[2][1]) {
+		kprintf("Level must be 0-%d\n", LOG_DEBUG);
+		return;
+	}
+
+	log_set_level(subsys, argv[2][0] - '0');
+}
@@ -0,0 +1,80 @@
+#include "cpu.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+
+cpu_info_t cpu_info;
+
+/**
+ * CPUID exists if the ID flag in EFLAGS can be toggled.
+ */
+static bool cpu_has_cpuid(void)
+{
+	uint32_t before;
+	uint32_t after;
+
+	__asm__ __volatile__ (
+		"pushfl\n\t"
+		"popl %0\n\t"
+		"movl %0, %1\n\t"
+		"xorl %2, %1\n\t"
+		"pushl %1\n\t"
+		"popfl\n\t"
+		"pushfl\n\t"
+		"popl %1\n\t"
+		"pushl %0\n\t"
+		"popfl"
+		: "=&r" (before), "=&r" (after) : "i" (EFLAGS_ID) : "cc");
+
+	return (before ^ after) & EFLAGS_ID;
+}
+
+/**
+ * Find out what the CPU supports. Runs first thing in kmain(), everything
+ * after it may check cpu_has_feature().
+ */
+void cpu_init(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	if (!cpu_has_cpuid()) {
+		return;
+	}
+
+	cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+	cpu_info.max_leaf = eax;
+	memcpy(cpu_info.vendor, &ebx, 4);
+	memcpy(cpu_info.vendor + 4, &edx, 4);
+	memcpy(cpu_info.vendor + 8, &ecx, 4);
+	cpu_info.vendor[12] = '\0';
+
+	cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	cpu_info.family = (eax >> 8) & 0xF;
+	cpu_info.model = (eax >> 4) & 0xF;
+	if (cpu_info.family == 0xF) {
+		cpu_info.family += (eax >> 20) & 0xFF;
+	}
+	if (cpu_info.family >= 0x6) {
+		cpu_info.model |= ((eax >> 16) & 0xF) << 4;
+	}
+
+	if (edx & CPUID_1_EDX_FPU) {
+		cpu_info.features |= CPU_FEATURE_FPU;
+	}
+	if (edx & CPUID_1_EDX_FXSR) {
+		cpu_info.features |= CPU_FEATURE_FXSR;
+	}
+	if (edx & CPUID_1_EDX_SSE) {
+		cpu_info.features |= CPU_FEATURE_SSE;
+	}
+	if (edx & CPUID_1_EDX_SSE2) {
+		cpu_info.features |= CPU_FEATURE_SSE2;
+	}
+
+	if (cpu_info.max_leaf >= 7) {
+		cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+		if (ebx & CPUID_7_EBX_ERMS) {
+			cpu_info.features |= CPU_FEATURE_ERMS;
+		}
+	}
+}
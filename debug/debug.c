@@ -3,7 +3,7 @@
 #include "stddef.h"
 #include <cpu.h>
 #include <video.h>
-#include <bochs/bochs.h>
+#include "log.h"
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -11,11 +11,54 @@
 
 uint8_t panicing = 0;
 
+// Function symbols, sorted by start address
 static struct {
 	struct symbol *symbols;
 	int count;
 } symbol_table;
 
+#define SYMBOL_CACHE_SIZE 64	// Power of two
+
+// Direct mapped by address. An entry is only a hint, it is a hit if the symbol
+// contains the address, so a single word store keeps it consistent.
+static struct symbol *symbol_cache[SYMBOL_CACHE_SIZE];
+
+static void symbol_sift_down(struct symbol *syms, int root, int count)
+{
+	int child;
+
+	while ((child = 2 * root + 1) < count) {
+		if (child + 1 < count && syms[child + 1].start > syms[child].start) {
+			child++;
+		}
+		if (syms[root].start >= syms[child].start) {
+			return;
+		}
+
+		struct symbol tmp = syms[root];
+		syms[root] = syms[child];
+		syms[child] = tmp;
+		root = child;
+	}
+}
+
+/**
+ * Heapsort the symbols by start address, in place and without recursion.
+ */
+static void symbol_sort(struct symbol *syms, int count)
+{
+	for (int i = count / 2 - 1; i >= 0; i--) {
+		symbol_sift_down(syms, i, count);
+	}
+
+	for (int end = count - 1; end > 0; end--) {
+		struct symbol tmp = syms[0];
+		syms[0] = syms[end];
+		syms[end] = tmp;
+		symbol_sift_down(syms, 0, end);
+	}
+}
+
 static void get_elf32_symbols_mboot(uint32_t section_headers, Elf32_Half shnum, Elf32_Half shstrndx)
 {
 	Elf32_Shdr *sh_table;
@@ -109,6 +152,8 @@ static void get_elf32_symbols_mboot(uint32_t section_headers, Elf32_Half shnum,
 	symbol_table.count -= function_syms;
 	symbol_table.symbols = &symbol_table.symbols[function_syms];
 
+	symbol_sort(symbol_table.symbols, symbol_table.count);
+
 	debug("Debugger initialized. Loaded %d kernel symbols\n", symbol_table.count);
 }
 
@@ -123,31 +168,55 @@ void debug_init(multiboot_elf_section_header_table_t * elf_header)
 	get_elf_symbols_mboot(elf_header);
 }
 
-/* Check if the address exists in the given symbol. Returns the offset from the beginning if so */
-static inline uint32_t __symbol_offset(uint32_t *addr, struct symbol *sym)
+static inline bool symbol_contains(struct symbol *sym, uint32_t *addr)
+{
+	return addr >= sym->start && addr < sym->end;
+}
+
+/**
+ * Binary search for the last symbol starting at or below addr.
+ *
+ * returns: the symbol containing addr, NULL if there is none.
+ */
+static struct symbol *symbol_find(uint32_t *addr)
 {
-	if (addr >= sym->end)
-		return 0;
+	int lo = 0;
+	int hi = symbol_table.count;
 
-	if (addr < sym->start)
-		return 0;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (symbol_table.symbols[mid].start <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
 
-	return addr - sym->start;
+	if (lo == 0 || !symbol_contains(&symbol_table.symbols[lo - 1], addr)) {
+		return NULL;
+	}
+
+	return &symbol_table.symbols[lo - 1];
 }
 
+/**
+ * returns: the function containing addr and the offset into it in bytes,
+ * "????" if addr isn't in any.
+ */
 struct sym_offset get_symbol(uint32_t *addr)
 {
-	struct symbol *sym;
-	int i;
+	struct symbol **slot = &symbol_cache[((uintptr_t)addr >> 4) & (SYMBOL_CACHE_SIZE - 1)];
+	struct symbol *sym = *slot;
 
-	for (i = 0; i < symbol_table.count; i++) {
-		sym = &symbol_table.symbols[i];
-		uint32_t offset = __symbol_offset(addr, sym);
-		if (offset)
-			return (struct sym_offset){sym->name, offset};
+	if (!sym || !symbol_contains(sym, addr)) {
+		sym = symbol_find(addr);
+		if (!sym) {
+			return (struct sym_offset){"????", 0};
+		}
+		*slot = sym;
 	}
 
-	return (struct sym_offset){"????", 0};
+	return (struct sym_offset){sym->name, (uintptr_t)addr - (uintptr_t)sym->start};
 }
 
 void backtrace(void *fp)
@@ -182,54 +251,3 @@ void do_backtrace(registers_t * regs)
 	backtrace((void *) regs->ebp);
 }
 
-void debug(char * format, ...)
-{
-	va_list argptr;
-	char s[34], c, *str;
-	int num;
-
-	va_start(argptr, format);
-
-	while (*format != '\0') {
-		if (*format != '%') {
-			BochsConsolePrintChar(*format);
-		} else {
-			*format++;
-			switch(*format) {
-				case '%':
-					BochsConsolePrintChar('%');
-					break;
-				case 'b':
-					num = va_arg(argptr, int);
-					itoa(num, s, 2);
-					debug(s);
-					break;
-				case 'c':
-					c = va_arg(argptr, int); // Yes, it *should* be char but them the compiler complains.
-					BochsConsolePrintChar(c);
-					break;
-				case 's':
-					str = va_arg(argptr, char *);
-					debug(str);
-					break;
-				case 'x':
-					num = va_arg(argptr, int);
-					itoa(num, s, 16);
-					debug(s);
-					break;
-				case 'd':
-					num = va_arg(argptr, int);
-					itoa(num, s, 10);
-					debug(s);
-					break;
-				default:
-					BochsConsolePrintChar(--*format);
-					BochsConsolePrintChar(++*format);
-					break;
-			}
-		}
-		*format++;
-	}
-
-	va_end(argptr);
-}
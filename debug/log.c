@@ -0,0 +1,360 @@
+#include "log.h"
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include "stdio.h"
+#include "string.h"
+#include "cpu.h"
+#include "timer.h"
+#include "video.h"
+#include "fs/vfs.h"
+#include "mem/kmalloc.h"
+#include <bochs/bochs.h>
+#include <stdarg.h>
+
+#define LOG_LINE_MAX (LOG_TAG_MAX + LOG_TEXT_MAX + 48)	// A record as read from /dev/kmsg
+#define LOG_DRAIN_INTERVAL 1	// Timer ticks
+
+/*
+ * Messages go into a ring of fixed size records. Producers claim a sequence
+ * number with an atomic increment and only ever write their own slot, so they
+ * can nest (from interrupt handlers) without locks. A single drainer hands
+ * complete records to the sinks in order, from the timer once log_init() ran
+ * and right away before that.
+ */
+static log_record_t log_ring[LOG_RECORDS];
+static volatile uint32_t log_next = 0;		// Next sequence number to hand out
+static volatile uint32_t log_drained = 0;	// Next sequence number to drain
+static uint32_t log_stream_end = 0;			// Length of /dev/kmsg so far
+static uint32_t log_lost = 0;				// Records overwritten before they were drained
+static volatile uint8_t log_draining = 0;
+static bool log_timer = false;
+
+static void log_bochs_sink(const char *str, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i++) {
+		BochsConsolePrintChar(str[i]);
+	}
+}
+
+// Everything is enabled until told otherwise
+uint32_t log_masks[LOG_DEBUG + 1] = {
+	[0 ... LOG_DEBUG] = (1 << LOG_SYS_COUNT) - 1,
+};
+
+const char *log_subsys_names[LOG_SYS_COUNT] = {
+	[LOG_SYS_KERNEL] = "kernel",
+	[LOG_SYS_PAGING] = "paging",
+	[LOG_SYS_PMM] = "pmm",
+	[LOG_SYS_HEAP] = "heap",
+	[LOG_SYS_VFS] = "vfs",
+	[LOG_SYS_BLK] = "blk",
+	[LOG_SYS_ATA] = "ata",
+	[LOG_SYS_AHCI] = "ahci",
+	[LOG_SYS_VIRTIO] = "virtio",
+	[LOG_SYS_PS2] = "ps2",
+	[LOG_SYS_KBD] = "kbd",
+	[LOG_SYS_PIPE] = "pipe",
+	[LOG_SYS_CONSOLE] = "console",
+	[LOG_SYS_SERIAL] = "serial",
+};
+
+static struct {
+	log_sink_t sink;
+	uint8_t max_level;
+} log_sinks[LOG_MAX_SINKS] = {
+	{&log_bochs_sink, LOG_DEBUG},
+};
+
+/**
+ * Sinks get the text as it was logged, the tag only shows up in /dev/kmsg.
+ */
+static void log_emit(uint8_t level, const char *text, uint32_t len)
+{
+	for (uint32_t i = 0; i < LOG_MAX_SINKS; i++) {
+		if (log_sinks[i].sink && level <= log_sinks[i].max_level) {
+			log_sinks[i].sink(text, len);
+		}
+	}
+}
+
+static void log_video_sink(const char *str, uint32_t len)
+{
+	video_write(str, len);
+}
+
+static inline log_record_t *log_slot(uint32_t seq)
+{
+	return &log_ring[seq & (LOG_RECORDS - 1)];
+}
+
+/**
+ * Copy record seq out of the ring.
+ *
+ * returns: 0 on success, 1 if it isn't complete yet, -1 if it has been overwritten.
+ */
+static int log_copy(uint32_t seq, log_record_t *copy)
+{
+	log_record_t *rec = log_slot(seq);
+
+	uint32_t before = rec->seq;
+	if (before == 0 || before - 1 < seq) {
+		return 1;
+	}
+	if (before - 1 > seq) {
+		return -1;
+	}
+
+	compiler_barrier();
+	memcpy(copy, rec, sizeof(log_record_t));
+	compiler_barrier();
+
+	return rec->seq == before ? 0 : -1;
+}
+
+/**
+ * Format a record the way /dev/kmsg shows it: "level,seq,ticks,tag;text\n".
+ */
+static uint32_t log_format(uint32_t seq, log_record_t *rec, char *line)
+{
+	uint32_t len = rec->len;
+	if (len > 0 && rec->text[len - 1] == '\n') {
+		len--;
+	}
+
+	return snprintf(line, LOG_LINE_MAX, "%u,%u,%u,%s;%.*s\n", rec->level, seq, rec->ticks,
+			rec->tag, len, rec->text);
+}
+
+void vklog(uint8_t level, const char *tag, const char *format, va_list args)
+{
+	uint32_t seq = __sync_fetch_and_add(&log_next, 1);
+	log_record_t *rec = log_slot(seq);
+
+	rec->seq = 0;
+	compiler_barrier();
+
+	rec->ticks = get_timer_ticks();
+	rec->level = level;
+
+	uint32_t i = 0;
+	for (; tag && tag[i] && i < LOG_TAG_MAX - 1; i++) {
+		rec->tag[i] = tag[i];
+	}
+	rec->tag[i] = '\0';
+
+	int len = vsnprintf(rec->text, LOG_TEXT_MAX, format, args);
+	rec->len = len < LOG_TEXT_MAX ? len : LOG_TEXT_MAX - 1;
+
+	compiler_barrier();
+	rec->seq = seq + 1;
+
+	if (!log_timer) {
+		log_flush();
+	}
+}
+
+/**
+ * Log a message for subsystem tag (may be NULL). Only the record is written
+ * here, the sinks see it on the next drain.
+ */
+void klog(uint8_t level, const char *tag, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	vklog(level, tag, format, args);
+	va_end(args);
+}
+
+/**
+ * Add a sink for messages of max_level and more severe.
+ *
+ * returns: 0 on success, -1 if all slots are taken.
+ */
+int log_add_sink(log_sink_t sink, uint8_t max_level)
+{
+	for (uint32_t i = 0; i < LOG_MAX_SINKS; i++) {
+		if (!log_sinks[i].sink) {
+			log_sinks[i].max_level = max_level;
+			compiler_barrier();
+			log_sinks[i].sink = sink;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Let messages of subsys through up to level (less severe ones are dropped
+ * before they are formatted).
+ */
+void log_set_level(uint32_t subsys, uint8_t level)
+{
+	for (uint32_t i = 0; i <= LOG_DEBUG; i++) {
+		if (i <= level) {
+			log_masks[i] |= 1 << subsys;
+		} else {
+			log_masks[i] &= ~(1 << subsys);
+		}
+	}
+}
+
+/**
+ * returns: the subsystem called name, -1 if there is none.
+ */
+int log_find_subsys(const char *name)
+{
+	for (int i = 0; i < LOG_SYS_COUNT; i++) {
+		if (!strcmp(log_subsys_names[i], name)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Hand every complete record to the sinks. Stops at the first record that is
+ * still being written, whoever is writing it drains it later.
+ */
+void log_flush(void)
+{
+	char line[LOG_LINE_MAX];
+	log_record_t rec;
+
+	if (__sync_lock_test_and_set(&log_draining, 1)) {
+		return; // Interrupted a drain, it'll get to our records too
+	}
+
+	while (log_drained != log_next) {
+		uint32_t seq = log_drained;
+
+		int ret = log_copy(seq, &rec);
+		if (ret > 0) {
+			break;
+		}
+		if (ret < 0) {
+			log_lost++;
+			log_drained++;
+			continue;
+		}
+
+		if (log_lost) {
+			uint32_t len = snprintf(line, LOG_LINE_MAX, "(%u log messages lost)\n", log_lost);
+			log_emit(LOG_WARNING, line, len);
+			log_lost = 0;
+		}
+
+		log_slot(seq)->stream_pos = log_stream_end;
+		log_stream_end += log_format(seq, &rec, line);
+
+		log_emit(rec.level, rec.text, rec.len);
+
+		compiler_barrier();
+		log_drained++;
+	}
+
+	__sync_lock_release(&log_draining);
+}
+
+static void log_drain_timer(uint32_t ticks)
+{
+	log_flush();
+}
+
+// Where the last read of /dev/kmsg stopped. Once records were overwritten the
+// reader's offset no longer matches the stream, so a read continuing at the
+// offset the last one returned picks up from here instead.
+static struct {
+	uint32_t offset;
+	uint32_t seq;
+	uint32_t skip;			// Bytes of that record already returned
+} log_kmsg_cursor;
+
+/**
+ * /dev/kmsg: the drained records that are still in the ring, one line each.
+ * Offsets follow the stream while nothing was lost. Reading at an offset
+ * whose records were overwritten starts at the oldest one left, sequential
+ * reads then continue from there.
+ */
+static uint32_t log_kmsg_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	char line[LOG_LINE_MAX];
+	log_record_t rec;
+	uint32_t copied = 0;
+
+	uint32_t end = log_drained;
+	uint32_t oldest = end > LOG_RECORDS ? end - LOG_RECORDS : 0;
+	uint32_t seq = oldest;
+	uint32_t skip = 0;
+	bool by_offset = true;
+
+	if (offset != 0 && offset == log_kmsg_cursor.offset) {
+		by_offset = false;
+		seq = log_kmsg_cursor.seq;
+		skip = log_kmsg_cursor.skip;
+		if ((int32_t)(seq - oldest) < 0) {
+			seq = oldest;
+			skip = 0;
+		}
+	}
+
+	for (; seq != end && copied < size; seq++) {
+		if (log_copy(seq, &rec) != 0) {
+			skip = 0;
+			continue;
+		}
+
+		uint32_t len = log_format(seq, &rec, line);
+		if (by_offset) {
+			if (offset >= rec.stream_pos + len) {
+				continue;
+			}
+			skip = offset > rec.stream_pos ? offset - rec.stream_pos : 0;
+			by_offset = false;
+		}
+
+		uint32_t n = len - skip;
+		if (n > size - copied) {
+			n = size - copied;
+		}
+
+		memcpy(buffer + copied, line + skip, n);
+		copied += n;
+		skip += n;
+
+		if (skip < len) {
+			break; // Buffer full, the rest of this record goes next time
+		}
+		skip = 0;
+	}
+
+	log_kmsg_cursor.offset = offset + copied;
+	log_kmsg_cursor.seq = seq;
+	log_kmsg_cursor.skip = skip;
+
+	return copied;
+}
+
+static const vfs_ops_t log_kmsg_ops = {
+	.read = log_kmsg_read,
+};
+
+/**
+ * Drain from the timer from now on and mount /dev/kmsg.
+ */
+void log_init(void)
+{
+	vfs_node_t *node = (vfs_node_t *)kmalloc(sizeof(vfs_node_t));
+	memset(node, 0, sizeof(vfs_node_t));
+	node->mask = VFS_MASK_DEVICE;
+	node->ops = &log_kmsg_ops;
+	vfs_mount("/dev/kmsg", node);
+
+	log_add_sink(&log_video_sink, LOG_WARNING);
+
+	timer_register_handler(&log_drain_timer, LOG_DRAIN_INTERVAL);
+	log_timer = true;
+}
@@ -0,0 +1,454 @@
+#define LOG_SUBSYS LOG_SYS_AHCI
+
+#include "dev/ahci.h"
+#include "dev/ata.h"
+#include "dev/pci.h"
+#include "dev/blk.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "idt.h"
+#include "cpu.h"
+#include "mem/kmalloc.h"
+#include "mem/paging.h"
+#include "string.h"
+#include "debug.h"
+
+// Command tables per DMA page
+#define AHCI_TABLES_PER_PAGE (0x1000 / sizeof(ahci_cmd_table_t))
+
+static ahci_controller_t *ahci_controllers = NULL;
+
+static void ahci_port_stop(ahci_port_regs_t *regs)
+{
+	regs->cmd &= ~AHCI_PxCMD_ST;
+	while (regs->cmd & AHCI_PxCMD_CR);
+
+	regs->cmd &= ~AHCI_PxCMD_FRE;
+	while (regs->cmd & AHCI_PxCMD_FR);
+}
+
+static void ahci_port_start(ahci_port_regs_t *regs)
+{
+	while (regs->cmd & AHCI_PxCMD_CR);
+
+	regs->cmd |= AHCI_PxCMD_FRE;
+	regs->cmd |= AHCI_PxCMD_ST;
+}
+
+/**
+ * Describe a virtually contiguous buffer in the PRDT, one entry per physical page.
+ *
+ * returns: false if the table ran out of entries.
+ */
+static bool ahci_add_prds(ahci_cmd_table_t *table, uint32_t *n, uint8_t *buffer, uint32_t size)
+{
+	while (size > 0) {
+		uint32_t len = 0x1000 - ((uintptr_t)buffer & 0xFFF);
+		if (len > size) {
+			len = size;
+		}
+
+		if (*n == AHCI_MAX_PRDS) {
+			return false;
+		}
+
+		ahci_prd_t *prd = &table->prdt[(*n)++];
+		prd->dba = virt_to_phys((uintptr_t)buffer);
+		prd->dbau = 0;
+		prd->reserved0 = 0;
+		prd->dbc = len - 1;
+		prd->reserved1 = 0;
+		prd->i = 0;
+
+		buffer += len;
+		size -= len;
+	}
+
+	return true;
+}
+
+typedef struct ahci_prdt {
+	ahci_cmd_table_t *table;
+	uint32_t n;
+} ahci_prdt_t;
+
+static bool ahci_add_segment(void *ctx, uint8_t *buffer, uint32_t size)
+{
+	ahci_prdt_t *prdt = (ahci_prdt_t *)ctx;
+
+	// PRD addresses and byte counts must be word aligned, odd ones go through the bounce buffer
+	if (((uintptr_t)buffer | size) & 1) {
+		return false;
+	}
+
+	return ahci_add_prds(prdt->table, &prdt->n, buffer, size);
+}
+
+static void ahci_build_fis(ahci_cmd_table_t *table, uint8_t command, uint32_t lba, uint32_t count)
+{
+	fis_reg_h2d_t *fis = (fis_reg_h2d_t *)table->cfis;
+	memset(fis, 0, sizeof(fis_reg_h2d_t));
+
+	fis->fis_type = FIS_TYPE_REG_H2D;
+	fis->c = 1;
+	fis->command = command;
+	fis->device = 0x40; // LBA mode
+	fis->lba0 = lba & 0xFF;
+	fis->lba1 = (lba >> 8) & 0xFF;
+	fis->lba2 = (lba >> 16) & 0xFF;
+	fis->lba3 = (lba >> 24) & 0xFF;
+	fis->countl = count & 0xFF;
+	fis->counth = (count >> 8) & 0xFF;
+}
+
+static void ahci_build_header(ahci_port_t *port, uint32_t slot, bool write, uint32_t prds)
+{
+	ahci_cmd_header_t *header = &port->cmd_list[slot];
+
+	header->cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
+	header->a = 0;
+	header->w = write ? 1 : 0;
+	header->p = 0;
+	header->prdtl = prds;
+	header->prdbc = 0;
+}
+
+/**
+ * Run a command on slot 0 and poll for it. Only used before interrupts are enabled.
+ *
+ * returns: 0 on success, -1 on errors or time outs.
+ */
+static int ahci_exec_polled(ahci_port_t *port, uint8_t command, uint8_t *buffer, uint32_t size)
+{
+	ahci_cmd_table_t *table = port->tables[0];
+	uint32_t n = 0;
+
+	ahci_build_fis(table, command, 0, 0);
+	((fis_reg_h2d_t *)table->cfis)->device = 0;
+	if (size) {
+		ahci_add_prds(table, &n, buffer, size);
+	}
+	ahci_build_header(port, 0, false, n);
+
+	port->regs->is = 0xFFFFFFFF;
+	port->regs->ci = 1;
+
+	for (uint32_t i = 0; i < AHCI_CMD_TIMEOUT; i++) {
+		if (port->regs->is & AHCI_PxIS_TFES) {
+			break;
+		}
+		if (!(port->regs->ci & 1)) {
+			port->regs->is = 0xFFFFFFFF;
+			return 0;
+		}
+	}
+
+	log_err("AHCI: Port %d: command 0x%x failed (tfd: 0x%x)\n", port->index, command, port->regs->tfd);
+	port->regs->is = 0xFFFFFFFF;
+	return -1;
+}
+
+static void ahci_release_slot(ahci_port_t *port, uint32_t slot, uint8_t status)
+{
+	blk_request_t *req = port->slot_req[slot];
+
+	if (port->bounce_slot == slot + 1) {
+		if (status == BLK_STATUS_OK && req->dir == BLK_READ) {
+			blk_request_copy_out(req, port->bounce);
+		}
+		port->bounce_slot = 0;
+	}
+
+	port->slot_req[slot] = NULL;
+	port->busy &= ~(1u << slot);
+}
+
+/**
+ * Issue a (possibly merged) request on a free command slot. With NCQ up to the
+ * device's queue depth of these are outstanding at once.
+ */
+static int ahci_dispatch(blk_queue_t *queue, blk_request_t *req)
+{
+	ahci_port_t *port = (ahci_port_t *)queue->driver;
+	uint32_t count = req->end - req->start;
+
+	if (port->busy == 0xFFFFFFFF) {
+		return BLK_DISPATCH_BUSY;
+	}
+
+	uint32_t slot = __builtin_ctz(~port->busy);
+	if (slot >= port->controller->slots) {
+		return BLK_DISPATCH_BUSY;
+	}
+
+	ahci_cmd_table_t *table = port->tables[slot];
+	uint32_t n = 0;
+	bool ncq = port->ncq;
+
+	if (req->dir == BLK_FLUSH) {
+		// Not a queued command. The block layer only sends it to an idle port and
+		// holds everything else back until it completes.
+		ahci_build_fis(table, ATA_CMD_CACHE_FLUSH_EXT, 0, 0);
+		ncq = false;
+	} else {
+		// Scatter straight from and to the merged requests' buffers if possible
+		ahci_prdt_t prdt = {.table = table, .n = 0};
+		if (blk_request_map(req, &ahci_add_segment, &prdt)) {
+			n = prdt.n;
+		} else {
+			// Overlapping members or too fragmented, go through the port's bounce buffer
+			if (port->bounce_slot) {
+				return BLK_DISPATCH_BUSY;
+			}
+			if (req->dir == BLK_WRITE) {
+				blk_request_copy_in(req, port->bounce);
+			}
+			n = 0;
+			ahci_add_prds(table, &n, port->bounce, count * BLK_SECTOR_SIZE);
+			port->bounce_slot = slot + 1;
+		}
+
+		if (ncq) {
+			uint8_t command = req->dir == BLK_READ ? ATA_CMD_READ_FPDMA_QUEUED : ATA_CMD_WRITE_FPDMA_QUEUED;
+			ahci_build_fis(table, command, req->start, slot << 3);
+			fis_reg_h2d_t *fis = (fis_reg_h2d_t *)table->cfis;
+			// The sector count moves to the feature registers, the count register carries the tag
+			fis->featurel = count & 0xFF;
+			fis->featureh = (count >> 8) & 0xFF;
+		} else {
+			uint8_t command = req->dir == BLK_READ ? ATA_CMD_READ_DMA_EXT : ATA_CMD_WRITE_DMA_EXT;
+			ahci_build_fis(table, command, req->start, count);
+		}
+	}
+
+	ahci_build_header(port, slot, req->dir == BLK_WRITE, n);
+
+	port->slot_req[slot] = req;
+	port->busy |= 1u << slot;
+
+	if (ncq) {
+		port->regs->sact = 1u << slot;
+	}
+	port->regs->ci = 1u << slot;
+
+	return BLK_DISPATCH_OK;
+}
+
+/**
+ * A command failed. The port stops processing its command list, so everything
+ * outstanding fails and the port is restarted.
+ */
+static void ahci_port_error(ahci_port_t *port, uint32_t is)
+{
+	blk_request_t *failed[AHCI_MAX_SLOTS];
+	uint32_t nfailed = 0;
+
+	log_err("AHCI: Port %d: error (is: 0x%x, tfd: 0x%x, serr: 0x%x)\n", port->index, is, port->regs->tfd, port->regs->serr);
+
+	ahci_port_stop(port->regs);
+
+	for (uint32_t slot = 0; slot < AHCI_MAX_SLOTS; slot++) {
+		if (port->busy & (1u << slot)) {
+			failed[nfailed++] = port->slot_req[slot];
+			ahci_release_slot(port, slot, BLK_STATUS_ERROR);
+		}
+	}
+
+	port->regs->serr = 0xFFFFFFFF;
+	port->regs->is = 0xFFFFFFFF;
+	ahci_port_start(port->regs);
+
+	// Completing runs the queue, which may issue new commands on the restarted port
+	for (uint32_t i = 0; i < nfailed; i++) {
+		blk_end_request(&port->queue, failed[i], BLK_STATUS_ERROR);
+	}
+}
+
+static void ahci_port_irq(ahci_port_t *port)
+{
+	uint32_t is = port->regs->is;
+	port->regs->is = is;
+
+	if (is & AHCI_PxIS_ERROR) {
+		ahci_port_error(port, is);
+		return;
+	}
+
+	// A slot is done once the HBA cleared it from both the issue and the NCQ active register
+	uint32_t done = port->busy & ~(port->regs->ci | port->regs->sact);
+
+	while (done) {
+		uint32_t slot = __builtin_ctz(done);
+		done &= ~(1u << slot);
+
+		blk_request_t *req = port->slot_req[slot];
+		ahci_release_slot(port, slot, BLK_STATUS_OK);
+		blk_end_request(&port->queue, req, BLK_STATUS_OK);
+	}
+}
+
+static void ahci_irq(registers_t regs)
+{
+	for (ahci_controller_t *c = ahci_controllers; c != NULL; c = c->next) {
+		if ((uint32_t)(IRQ0 + c->irq) != regs.int_no) {
+			continue;
+		}
+
+		uint32_t is = c->hba->is;
+		for (uint32_t i = 0; i < AHCI_MAX_PORTS; i++) {
+			if ((is & (1u << i)) && c->ports[i]) {
+				ahci_port_irq(c->ports[i]);
+			}
+		}
+		c->hba->is = is;
+	}
+}
+
+/**
+ * Set up the command list, received FIS area and command tables of a port.
+ */
+static void ahci_port_setup(ahci_port_t *port)
+{
+	uintptr_t phys;
+
+	ahci_port_stop(port->regs);
+
+	// The 1KB command list and the 256 byte FIS area share a page
+	uint8_t *mem = (uint8_t *)dma_alloc_page(&phys);
+	port->cmd_list = (ahci_cmd_header_t *)mem;
+	port->regs->clb = phys;
+	port->regs->clbu = 0;
+	port->regs->fb = phys + 0x400;
+	port->regs->fbu = 0;
+
+	for (uint32_t slot = 0; slot < port->controller->slots; slot++) {
+		if (slot % AHCI_TABLES_PER_PAGE == 0) {
+			mem = (uint8_t *)dma_alloc_page(&phys);
+		}
+		uint32_t offset = (slot % AHCI_TABLES_PER_PAGE) * sizeof(ahci_cmd_table_t);
+
+		port->tables[slot] = (ahci_cmd_table_t *)(mem + offset);
+		port->cmd_list[slot].ctba = phys + offset;
+		port->cmd_list[slot].ctbau = 0;
+	}
+
+	port->regs->serr = 0xFFFFFFFF;
+	port->regs->is = 0xFFFFFFFF;
+	port->regs->ie = AHCI_PxIS_ENABLE;
+
+	ahci_port_start(port->regs);
+}
+
+static void ahci_port_init(ahci_controller_t *controller, uint32_t index)
+{
+	ahci_port_t *port = (ahci_port_t *)kmalloc(sizeof(ahci_port_t));
+	if (port == NULL) {
+		log_err("AHCI: Port %d: out of memory\n", index);
+		return;
+	}
+	memset(port, 0, sizeof(ahci_port_t));
+
+	port->controller = controller;
+	port->regs = &controller->hba->ports[index];
+	port->index = index;
+
+	ahci_port_setup(port);
+
+	uint8_t *ident_page = (uint8_t *)dma_alloc_page(NULL);
+	if (ahci_exec_polled(port, ATA_CMD_IDENTIFY, ident_page, sizeof(ata_identify_t)) != 0) {
+		ahci_port_stop(port->regs);
+		kfree(port);
+		return;
+	}
+
+	ata_identify_t *ident = (ata_identify_t *)ident_page;
+	uint16_t *words = (uint16_t *)ident_page;
+
+	// Word 76 bit 8: NCQ supported, word 75: maximum queue depth - 1
+	uint32_t depth = 1;
+	if ((controller->hba->cap & AHCI_CAP_SNCQ) && (words[76] & (1 << 8))) {
+		port->ncq = true;
+		depth = (words[75] & 0x1F) + 1;
+		if (depth > controller->slots) {
+			depth = controller->slots;
+		}
+	}
+
+	port->bounce = (uint8_t *)kmalloc(AHCI_MAX_SECTORS * BLK_SECTOR_SIZE);
+	if (port->bounce == NULL) {
+		log_err("AHCI: Port %d: out of memory\n", index);
+		ahci_port_stop(port->regs);
+		kfree(port);
+		return;
+	}
+
+	blk_queue_init(&port->queue, &ahci_dispatch, port, AHCI_MAX_SECTORS, depth);
+	port->queue.sectors = (uint32_t)ident->sectors_48 ? (uint32_t)ident->sectors_48 : ident->sectors_28;
+
+	debug("AHCI: Port %d: %d sectors, %s, queue depth %d\n", index, port->queue.sectors, port->ncq ? "NCQ" : "no NCQ", depth);
+
+	controller->ports[index] = port;
+
+	blk_register_disk(&port->queue);
+}
+
+static void ahci_probe(uint8_t bus, uint8_t slot, uint8_t function)
+{
+	if (getProgIF(bus, slot, function) != 0x01) {
+		return; // Not AHCI, e.g. a controller in IDE mode
+	}
+
+	uint32_t abar = getBAR(bus, slot, function, 5) & PCI_BAR_MEM_MASK;
+
+	ahci_controller_t *controller = (ahci_controller_t *)kmalloc(sizeof(ahci_controller_t));
+	if (controller == NULL) {
+		log_err("AHCI: Out of memory\n");
+		return;
+	}
+	memset(controller, 0, sizeof(ahci_controller_t));
+
+	enableBusMastering(bus, slot, function);
+
+	controller->hba = (ahci_hba_t *)map_mmio(abar, sizeof(ahci_hba_t));
+	controller->irq = getInterruptLine(bus, slot, function);
+
+	controller->hba->ghc |= AHCI_GHC_AE;
+	controller->slots = AHCI_CAP_NCS(controller->hba->cap);
+
+	debug("AHCI: Controller at 0x%x, IRQ %d, %d command slots\n", abar, controller->irq, controller->slots);
+
+	uint32_t pi = controller->hba->pi;
+	for (uint32_t i = 0; i < AHCI_MAX_PORTS; i++) {
+		if (!(pi & (1u << i))) {
+			continue;
+		}
+
+		ahci_port_regs_t *regs = &controller->hba->ports[i];
+		uint32_t ssts = regs->ssts;
+		if ((ssts & 0xF) != AHCI_SSTS_DET_PRESENT || ((ssts >> 8) & 0xF) != AHCI_SSTS_IPM_ACTIVE) {
+			continue;
+		}
+
+		if (regs->sig != AHCI_SIG_ATA) {
+			log_warn("AHCI: Port %d: signature 0x%x not supported\n", i, regs->sig);
+			continue;
+		}
+
+		ahci_port_init(controller, i);
+	}
+
+	uint32_t flags = irq_save();
+	controller->next = ahci_controllers;
+	ahci_controllers = controller;
+	irq_restore(flags);
+
+	register_shared_interrupt_handler(IRQ0 + controller->irq, &ahci_irq);
+
+	controller->hba->is = 0xFFFFFFFF;
+	controller->hba->ghc |= AHCI_GHC_IE;
+}
+
+void ahci_init()
+{
+	pciFindClass(0x01, 0x06, &ahci_probe);
+}
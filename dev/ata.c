@@ -1,3 +1,5 @@
+#define LOG_SUBSYS LOG_SYS_ATA
+
 #include "dev/ata.h"
 #include "stdint.h"
 #include "stdbool.h"
@@ -5,31 +7,49 @@
 #include "idt.h"
 #include "cpu.h"
 #include "fs/vfs.h"
+#include "dev/blk.h"
+#include "mem/kmalloc.h"
 #include "string.h"
 #include "debug.h"
 
-static char ata_current_drive_letter = 'a';
+// Largest PIO transfer we issue. 256 is the limit of a 28-bit LBA command.
+#define ATA_MAX_SECTORS 256
 
 typedef struct ata_device {
 	int32_t io_base;
 	int32_t control;
+	ata_identify_t ident_result;	// Packed, keep it aligned for the IDENTIFY transfer
+	uint8_t channel;
 	bool is_slave;
 	bool is_atapi;
-	ata_identify_t ident_result;
+	bool present;
+	bool lba48;
+	blk_queue_t queue;
+	blk_request_t *current;	// Request being transferred
+	uint8_t *pos;			// Transfer position in the current buffer
+	uint32_t remaining;		// Sectors left to transfer
+	uint8_t *bounce;		// Transfer buffer for merged requests
 } ata_device_t;
 
-static ata_device_t ata_primary_master   = {.io_base = 0x1F0, .control = 0x3F6, .is_slave = false};
-static ata_device_t ata_primary_slave    = {.io_base = 0x1F0, .control = 0x3F6, .is_slave = true};
-static ata_device_t ata_secondary_master = {.io_base = 0x170, .control = 0x376, .is_slave = false};
-static ata_device_t ata_secondary_slave  = {.io_base = 0x170, .control = 0x376, .is_slave = true};
+static ata_device_t ata_primary_master   = {.io_base = 0x1F0, .control = 0x3F6, .channel = ATA_PRIMARY, .is_slave = false};
+static ata_device_t ata_primary_slave    = {.io_base = 0x1F0, .control = 0x3F6, .channel = ATA_PRIMARY, .is_slave = true};
+static ata_device_t ata_secondary_master = {.io_base = 0x170, .control = 0x376, .channel = ATA_SECONDARY, .is_slave = false};
+static ata_device_t ata_secondary_slave  = {.io_base = 0x170, .control = 0x376, .channel = ATA_SECONDARY, .is_slave = true};
+
+// Both drives on a channel share the task file and the IRQ, only one can transfer at a time.
+static ata_device_t *ata_channel_active[2];
+static ata_device_t *ata_channel_devices[2][2] = {
+	{&ata_primary_master, &ata_primary_slave},
+	{&ata_secondary_master, &ata_secondary_slave}
+};
 
 void ata_delay_io(ata_device_t *dev)
 {
 	// 400nS delay
-	inb(dev->io_base + ATA_REG_ALTSTATUS);
-	inb(dev->io_base + ATA_REG_ALTSTATUS);
-	inb(dev->io_base + ATA_REG_ALTSTATUS);
-	inb(dev->io_base + ATA_REG_ALTSTATUS);
+	inb(dev->control);
+	inb(dev->control);
+	inb(dev->control);
+	inb(dev->control);
 }
 
 int32_t ata_delay_status(ata_device_t *dev, int32_t timeout)
@@ -91,20 +111,161 @@ void init_ata_device(ata_device_t *dev)
 	debug("Sectors (48): %d ", (uint32_t)dev->ident_result.sectors_48);
 	debug("Sectors (24): %d\n", dev->ident_result.sectors_28);
 
-	outb(dev->io_base + ATA_REG_CONTROL, 0x02);
+	outb(dev->control, 0x02);
+}
+
+static void ata_issue(ata_device_t *dev, uint32_t lba, uint32_t count, uint8_t direction)
+{
+	bool ext = dev->lba48 && (lba + count > 0x0FFFFFFF);
+	uint8_t command;
+
+	ata_delay_status(dev, -1);
+	outb(dev->control, 0x00); // We want the interrupt
+
+	if (ext) {
+		outb(dev->io_base + ATA_REG_HDDEVSEL, 0x40 | dev->is_slave << 4);
+		ata_delay_io(dev);
+		// High order bytes first, then the low order bytes
+		outb(dev->io_base + ATA_REG_SECCOUNT0, (count >> 8) & 0xFF);
+		outb(dev->io_base + ATA_REG_LBA0, (lba >> 24) & 0xFF);
+		outb(dev->io_base + ATA_REG_LBA1, 0);
+		outb(dev->io_base + ATA_REG_LBA2, 0);
+		outb(dev->io_base + ATA_REG_SECCOUNT0, count & 0xFF);
+		outb(dev->io_base + ATA_REG_LBA0, lba & 0xFF);
+		outb(dev->io_base + ATA_REG_LBA1, (lba >> 8) & 0xFF);
+		outb(dev->io_base + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+		command = direction == ATA_READ ? ATA_CMD_READ_PIO_EXT : ATA_CMD_WRITE_PIO_EXT;
+	} else {
+		outb(dev->io_base + ATA_REG_HDDEVSEL, 0xE0 | dev->is_slave << 4 | ((lba >> 24) & 0x0F));
+		ata_delay_io(dev);
+		outb(dev->io_base + ATA_REG_SECCOUNT0, count & 0xFF); // 0 means 256
+		outb(dev->io_base + ATA_REG_LBA0, lba & 0xFF);
+		outb(dev->io_base + ATA_REG_LBA1, (lba >> 8) & 0xFF);
+		outb(dev->io_base + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+		command = direction == ATA_READ ? ATA_CMD_READ_PIO : ATA_CMD_WRITE_PIO;
+	}
+
+	outb(dev->io_base + ATA_REG_COMMAND, command);
+}
+
+static void ata_issue_flush(ata_device_t *dev)
+{
+	ata_delay_status(dev, -1);
+	outb(dev->control, 0x00);
+
+	outb(dev->io_base + ATA_REG_HDDEVSEL, 0xE0 | dev->is_slave << 4);
+	ata_delay_io(dev);
+	outb(dev->io_base + ATA_REG_COMMAND, dev->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+}
+
+static void ata_finish(ata_device_t *dev, uint8_t status)
+{
+	blk_request_t *req = dev->current;
+
+	if (status == BLK_STATUS_OK && req->dir == BLK_READ && !blk_request_is_simple(req)) {
+		blk_request_copy_out(req, dev->bounce);
+	}
+
+	dev->current = NULL;
+	ata_channel_active[dev->channel] = NULL;
+
+	// Give the other drive on the channel a turn before this one queues up its next request
+	ata_device_t *sibling = ata_channel_devices[dev->channel][!dev->is_slave];
+	if (sibling->present) {
+		blk_run_queue(&sibling->queue);
+	}
+
+	blk_end_request(&dev->queue, req, status);
+}
+
+/**
+ * Start the command for a (possibly merged) request. Data moves sector by sector
+ * from the IRQ handler.
+ */
+static int ata_dispatch(blk_queue_t *queue, blk_request_t *req)
+{
+	ata_device_t *dev = (ata_device_t *)queue->driver;
+
+	if (ata_channel_active[dev->channel]) {
+		return BLK_DISPATCH_BUSY;
+	}
+
+	ata_channel_active[dev->channel] = dev;
+	dev->current = req;
+	dev->remaining = req->end - req->start;
+
+	if (req->dir == BLK_FLUSH) {
+		// Completes with a single interrupt, handled like the end of a write
+		ata_issue_flush(dev);
+		return BLK_DISPATCH_OK;
+	}
+
+	if (blk_request_is_simple(req)) {
+		dev->pos = req->buffer;
+	} else {
+		dev->pos = dev->bounce;
+		if (req->dir == BLK_WRITE) {
+			blk_request_copy_in(req, dev->bounce);
+		}
+	}
+
+	ata_issue(dev, req->start, dev->remaining, req->dir == BLK_READ ? ATA_READ : ATA_WRITE);
+
+	if (req->dir == BLK_WRITE) {
+		// The first sector goes out right away, the drive interrupts after each one after that.
+		int32_t status;
+		ata_delay_io(dev);
+		while (((status = inb(dev->io_base + ATA_REG_STATUS)) & ATA_SR_BSY) || !(status & (ATA_SR_DRQ | ATA_SR_ERR | ATA_SR_DF)));
+		if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+			dev->current = NULL;
+			ata_channel_active[dev->channel] = NULL;
+			return BLK_DISPATCH_ERROR;
+		}
+		outsw(dev->io_base + ATA_REG_DATA, dev->pos, BLK_SECTOR_SIZE / 2);
+		dev->pos += BLK_SECTOR_SIZE;
+		dev->remaining--;
+	}
+
+	return BLK_DISPATCH_OK;
 }
 
-vfs_node_t *create_ata_dev(ata_device_t *dev)
+static void ata_irq(uint8_t channel)
 {
-	vfs_node_t *node = (vfs_node_t *)kmalloc(sizeof(vfs_node_t));
-	memset(node, 0, sizeof(vfs_node_t));
+	ata_device_t *dev = ata_channel_active[channel];
 
-	node->device = dev;
-	node->mask = VFS_MASK_DEVICE;
-//	node->read = ata_read;
-//	node->write = ata_write;
+	if (!dev) {
+		// Nothing in flight, just acknowledge
+		inb(ata_channel_devices[channel][0]->io_base + ATA_REG_STATUS);
+		return;
+	}
 
-	return node;
+	int32_t status = inb(dev->io_base + ATA_REG_STATUS);
+
+	if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+		log_err("ATA: Error 0x%x on sector %d\n", inb(dev->io_base + ATA_REG_ERROR), dev->current->start);
+		ata_finish(dev, BLK_STATUS_ERROR);
+		return;
+	}
+
+	if (dev->current->dir == BLK_READ) {
+		if (!(status & ATA_SR_DRQ)) {
+			return;
+		}
+		insw(dev->io_base + ATA_REG_DATA, dev->pos, BLK_SECTOR_SIZE / 2);
+		dev->pos += BLK_SECTOR_SIZE;
+		if (--dev->remaining == 0) {
+			ata_finish(dev, BLK_STATUS_OK);
+		}
+	} else {
+		// Writes and cache flushes
+		if (dev->remaining == 0) {
+			ata_finish(dev, BLK_STATUS_OK);
+			return;
+		}
+		outsw(dev->io_base + ATA_REG_DATA, dev->pos, BLK_SECTOR_SIZE / 2);
+		dev->pos += BLK_SECTOR_SIZE;
+		dev->remaining--;
+	}
 }
 
 void ata_detect(ata_device_t *dev)
@@ -124,35 +285,31 @@ void ata_detect(ata_device_t *dev)
 	}
 	if ((cyl_low == 0x00 && cyl_high == 0x00) || (cyl_low == 0x3C && cyl_high == 0xC3)) {
 		/* PATA or emulated SATA */
-		char *name = (char *)kmalloc(sizeof(char) * 32);
-		name = strdup("/dev/sd");
-
-		name[7] = ata_current_drive_letter;
-		name[8] = '\0';
-
-		debug("Creating device %s\n", name);
-
-		vfs_node_t *node = create_ata_dev(dev);
-		vfs_mount(name, node);
+		init_ata_device(dev);
 
-		kfree(name);
+		dev->lba48 = dev->ident_result.sectors_48 != 0;
+		dev->bounce = (uint8_t *)kmalloc(ATA_MAX_SECTORS * BLK_SECTOR_SIZE);
 
-		ata_current_drive_letter++;
+		blk_queue_init(&dev->queue, &ata_dispatch, dev, ATA_MAX_SECTORS, 1);
+		dev->queue.sectors = dev->lba48 ? (uint32_t)dev->ident_result.sectors_48 : dev->ident_result.sectors_28;
+		dev->present = true;
 
-		init_ata_device(dev);
+		blk_register_disk(&dev->queue);
 	} else if ((cyl_low == 0x14 && cyl_high == 0xEB) || (cyl_low == 0x69 && cyl_high == 0x96)) {
 		/* ATAPI */
-		debug("Found an ATAPI device. Not supported!\n");
+		log_warn("Found an ATAPI device. Not supported!\n");
 	}
 }
 
 
 static void ata_primary_irq(registers_t regs)
 {
+	ata_irq(ATA_PRIMARY);
 }
 
 static void ata_secondary_irq(registers_t regs)
 {
+	ata_irq(ATA_SECONDARY);
 }
 
 void ata_init()
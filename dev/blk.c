@@ -0,0 +1,776 @@
+#define LOG_SUBSYS LOG_SYS_BLK
+
+#include "dev/blk.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "cpu.h"
+#include "timer.h"
+#include "fs/vfs.h"
+#include "fs/bcache.h"
+#include "fs/poll.h"
+#include "ds/list.h"
+#include "string.h"
+#include "mem/kmalloc.h"
+#include "debug.h"
+
+// Number of requests the synchronous helpers keep in flight at once
+#define BLK_SYNC_BATCH 8
+
+static char blk_current_drive_letter = 'a';
+
+void blk_queue_init(blk_queue_t *queue, blk_dispatch_t dispatch, void *driver, uint32_t max_sectors, uint32_t depth)
+{
+	memset(queue, 0, sizeof(blk_queue_t));
+
+	queue->dispatch = dispatch;
+	queue->driver = driver;
+	queue->max_sectors = max_sectors;
+	queue->depth = depth;
+	queue->write_cache = true;
+}
+
+static inline bool blk_overlaps(blk_request_t *a, uint32_t start, uint32_t end)
+{
+	return a->start < end && start < a->end;
+}
+
+/**
+ * Two requests touching the same sectors must reach the disk in submission order
+ * unless both are reads.
+ */
+static inline bool blk_conflicts(blk_request_t *a, blk_request_t *b)
+{
+	return blk_overlaps(a, b->start, b->end) && (a->dir == BLK_WRITE || b->dir == BLK_WRITE);
+}
+
+/**
+ * Check if req conflicts with any queued or active request other than itself and skip.
+ */
+static bool blk_hazard(blk_queue_t *queue, blk_request_t *req, blk_request_t *skip)
+{
+	for (list_item_t *i = queue->sorted.first; i != NULL; i = i->next) {
+		blk_request_t *other = list_entry(i, blk_request_t, sort_item);
+		if (other != req && other != skip && blk_conflicts(other, req)) {
+			return true;
+		}
+	}
+
+	for (list_item_t *i = queue->active.first; i != NULL; i = i->next) {
+		if (blk_conflicts(list_entry(i, blk_request_t, sort_item), req)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * A request may only be dispatched when nothing submitted before it touches the same sectors.
+ */
+static bool blk_can_dispatch(blk_queue_t *queue, blk_request_t *req)
+{
+	// Nothing overtakes a flush, not even once it went to the driver. This also
+	// keeps queued commands from being mixed with a non-queued flush.
+	if (queue->active_flushes) {
+		return false;
+	}
+
+	// A flush waits for everything before it to finish
+	if (req->dir == BLK_FLUSH) {
+		return queue->in_flight == 0 && queue->fifo.first == &req->fifo_item;
+	}
+
+	for (list_item_t *i = queue->active.first; i != NULL; i = i->next) {
+		if (blk_conflicts(list_entry(i, blk_request_t, sort_item), req)) {
+			return false;
+		}
+	}
+
+	for (list_item_t *i = queue->fifo.first; i != NULL; i = i->next) {
+		blk_request_t *other = list_entry(i, blk_request_t, fifo_item);
+		if (other->seq >= req->seq) {
+			break;
+		}
+		// Nothing overtakes a flush
+		if (other->dir == BLK_FLUSH || blk_conflicts(other, req)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void blk_queue_insert(blk_queue_t *queue, blk_request_t *req)
+{
+	list_item_t *i;
+
+	for (i = queue->sorted.first; i != NULL; i = i->next) {
+		if (list_entry(i, blk_request_t, sort_item)->start > req->start) {
+			break;
+		}
+	}
+	if (i) {
+		list_insert_before(&queue->sorted, &req->sort_item, i);
+	} else {
+		list_insert_end(&queue->sorted, &req->sort_item);
+	}
+
+	for (i = queue->fifo.first; i != NULL; i = i->next) {
+		if (list_entry(i, blk_request_t, fifo_item)->seq > req->seq) {
+			break;
+		}
+	}
+	if (i) {
+		list_insert_before(&queue->fifo, &req->fifo_item, i);
+	} else {
+		list_insert_end(&queue->fifo, &req->fifo_item);
+	}
+}
+
+static void blk_queue_unlink(blk_queue_t *queue, blk_request_t *req)
+{
+	list_remove(&queue->sorted, &req->sort_item);
+	list_remove(&queue->fifo, &req->fifo_item);
+}
+
+static bool blk_can_merge(blk_queue_t *queue, blk_request_t *into, blk_request_t *req)
+{
+	if (into->dir != req->dir || req->dir == BLK_FLUSH) {
+		return false;
+	}
+
+	// Only adjacent or overlapping requests can become one command
+	if (req->start > into->end || into->start > req->end) {
+		return false;
+	}
+
+	uint32_t start = into->start < req->start ? into->start : req->start;
+	uint32_t end = into->end > req->end ? into->end : req->end;
+
+	if (end - start > queue->max_sectors) {
+		return false;
+	}
+
+	// Merging must not let either request overtake something it conflicts with
+	return !blk_hazard(queue, req, into) && !blk_hazard(queue, into, req);
+}
+
+/**
+ * Merge req (and everything merged into it) into the queued request into.
+ */
+static void blk_merge(blk_request_t *into, blk_request_t *req)
+{
+	// Interleave both member lists by submission order so overlapping writes land in the right order
+	blk_request_t *a = into->members;
+	blk_request_t *b = req->members;
+	blk_request_t **tail = &into->members;
+
+	while (a && b) {
+		if (a->seq < b->seq) {
+			*tail = a;
+			a = a->next_member;
+		} else {
+			*tail = b;
+			b = b->next_member;
+		}
+		tail = &(*tail)->next_member;
+	}
+	*tail = a ? a : b;
+
+	if (req->start < into->start) {
+		into->start = req->start;
+	}
+	if (req->end > into->end) {
+		into->end = req->end;
+	}
+	if ((int32_t)(req->deadline - into->deadline) < 0) {
+		into->deadline = req->deadline;
+	}
+	if (req->seq < into->seq) {
+		into->seq = req->seq;
+	}
+}
+
+/**
+ * Try to merge a new request into a queued one, then try to grow the result
+ * further by absorbing its neighbours in the elevator.
+ */
+static bool blk_try_merge(blk_queue_t *queue, blk_request_t *req)
+{
+	blk_request_t *into = NULL;
+
+	for (list_item_t *i = queue->sorted.first; i != NULL; i = i->next) {
+		blk_request_t *queued = list_entry(i, blk_request_t, sort_item);
+		if (queued->start > req->end) {
+			break;
+		}
+		if (blk_can_merge(queue, queued, req)) {
+			into = queued;
+			break;
+		}
+	}
+
+	if (!into) {
+		return false;
+	}
+
+	// Re-sort the request as its start may move
+	blk_queue_unlink(queue, into);
+	blk_merge(into, req);
+
+	list_item_t *i = queue->sorted.first;
+	while (i) {
+		blk_request_t *queued = list_entry(i, blk_request_t, sort_item);
+		i = i->next;
+		if (queued->start > into->end) {
+			break;
+		}
+		if (blk_can_merge(queue, into, queued)) {
+			blk_queue_unlink(queue, queued);
+			blk_merge(into, queued);
+			i = queue->sorted.first;
+		}
+	}
+
+	blk_queue_insert(queue, into);
+
+	return true;
+}
+
+/**
+ * Pick the next request: anything past its deadline first (oldest first), otherwise
+ * the next request in ascending sector order from the current head position (C-LOOK).
+ */
+static blk_request_t *blk_select(blk_queue_t *queue)
+{
+	uint32_t now = get_timer_ticks();
+
+	for (list_item_t *i = queue->fifo.first; i != NULL; i = i->next) {
+		blk_request_t *req = list_entry(i, blk_request_t, fifo_item);
+		if ((int32_t)(now - req->deadline) >= 0 && blk_can_dispatch(queue, req)) {
+			return req;
+		}
+	}
+
+	blk_request_t *wrap = NULL;
+	for (list_item_t *i = queue->sorted.first; i != NULL; i = i->next) {
+		blk_request_t *req = list_entry(i, blk_request_t, sort_item);
+		if (!blk_can_dispatch(queue, req)) {
+			continue;
+		}
+		if (req->start >= queue->head_pos) {
+			return req;
+		}
+		if (!wrap) {
+			wrap = req;
+		}
+	}
+
+	return wrap;
+}
+
+void blk_run_queue(blk_queue_t *queue)
+{
+	uint32_t dispatched = 0;
+	uint32_t flags = irq_save();
+
+	while (!queue->plugged && queue->in_flight < queue->depth) {
+		blk_request_t *req = blk_select(queue);
+		if (!req) {
+			break;
+		}
+
+		blk_queue_unlink(queue, req);
+		list_insert_end(&queue->active, &req->sort_item);
+		queue->in_flight++;
+
+		uint32_t head_pos = queue->head_pos;
+		if (req->dir != BLK_FLUSH) {
+			queue->head_pos = req->end;
+		} else {
+			queue->active_flushes++;
+		}
+
+		int ret = queue->dispatch(queue, req);
+		if (ret == BLK_DISPATCH_BUSY) {
+			// The driver can't take it right now, it will run the queue again once it can.
+			list_remove(&queue->active, &req->sort_item);
+			queue->in_flight--;
+			if (req->dir == BLK_FLUSH) {
+				queue->active_flushes--;
+			}
+			queue->head_pos = head_pos;
+			blk_queue_insert(queue, req);
+			break;
+		}
+
+		if (ret != BLK_DISPATCH_OK) {
+			blk_end_request(queue, req, BLK_STATUS_ERROR);
+		} else {
+			dispatched++;
+		}
+	}
+
+	// Let the driver tell the device about the whole batch at once
+	if (dispatched && queue->commit) {
+		queue->commit(queue);
+	}
+
+	irq_restore(flags);
+}
+
+/**
+ * Stop dispatching so a batch of requests can be queued (and merged) before the
+ * driver sees the first of them. Never wait on a request while its queue is plugged.
+ */
+void blk_plug(blk_queue_t *queue)
+{
+	queue->plugged = true;
+}
+
+void blk_unplug(blk_queue_t *queue)
+{
+	queue->plugged = false;
+	blk_run_queue(queue);
+}
+
+void blk_submit(blk_queue_t *queue, blk_request_t *req)
+{
+	req->status = BLK_STATUS_PENDING;
+	req->start = req->lba;
+	req->end = req->lba + req->count;
+	req->members = req;
+	req->next_member = NULL;
+
+	memset(&req->sort_item, 0, sizeof(list_item_t));
+	memset(&req->fifo_item, 0, sizeof(list_item_t));
+
+	if (req->dir == BLK_FLUSH) {
+		req->start = req->end = 0;
+	} else if (req->count == 0 || req->end > queue->sectors || req->end < req->start) {
+		req->status = BLK_STATUS_ERROR;
+		if (req->end_io) {
+			req->end_io(req);
+		}
+		return;
+	}
+
+	uint32_t flags = irq_save();
+
+	req->seq = queue->seq++;
+	req->deadline = get_timer_ticks() + (req->dir == BLK_READ ? BLK_READ_EXPIRE : BLK_WRITE_EXPIRE);
+
+	if (!blk_try_merge(queue, req)) {
+		blk_queue_insert(queue, req);
+	}
+
+	blk_run_queue(queue);
+
+	irq_restore(flags);
+}
+
+/**
+ * Called by the driver when a dispatched request finished. Completes every merged
+ * request and feeds the driver the next one.
+ */
+void blk_end_request(blk_queue_t *queue, blk_request_t *req, uint8_t status)
+{
+	uint32_t flags = irq_save();
+
+	bool congested = queue->in_flight >= queue->depth;
+
+	list_remove(&queue->active, &req->sort_item);
+	queue->in_flight--;
+	if (req->dir == BLK_FLUSH) {
+		queue->active_flushes--;
+	}
+
+	blk_request_t *member = req->members;
+	while (member) {
+		// The callback may free the request, so fetch the next one first
+		blk_request_t *next = member->next_member;
+		member->status = status;
+		if (member->end_io) {
+			member->end_io(member);
+		}
+		member = next;
+	}
+
+	blk_run_queue(queue);
+
+	if (congested && queue->node && queue->in_flight < queue->depth) {
+		vfs_poll_notify(queue->node, POLLIN | POLLOUT);
+	}
+
+	irq_restore(flags);
+}
+
+/**
+ * True when the request maps 1:1 onto its own buffer so the driver can transfer directly.
+ */
+bool blk_request_is_simple(blk_request_t *req)
+{
+	return req->members == req && req->next_member == NULL;
+}
+
+/**
+ * Gather the data of all merged writes into one buffer covering [start, end).
+ */
+void blk_request_copy_in(blk_request_t *req, uint8_t *data)
+{
+	for (blk_request_t *m = req->members; m != NULL; m = m->next_member) {
+		memcpy(data + (m->lba - req->start) * BLK_SECTOR_SIZE, m->buffer, m->count * BLK_SECTOR_SIZE);
+	}
+}
+
+/**
+ * Scatter a buffer covering [start, end) to all merged reads.
+ */
+void blk_request_copy_out(blk_request_t *req, uint8_t *data)
+{
+	for (blk_request_t *m = req->members; m != NULL; m = m->next_member) {
+		memcpy(m->buffer, data + (m->lba - req->start) * BLK_SECTOR_SIZE, m->count * BLK_SECTOR_SIZE);
+	}
+}
+
+/**
+ * Walk the buffers of a request in disk order, e.g. to build a scatter/gather
+ * list. Only possible when the merged requests don't overlap.
+ *
+ * returns: false if they do, or if segment returned false.
+ */
+bool blk_request_map(blk_request_t *req, blk_segment_t segment, void *ctx)
+{
+	uint32_t total = 0;
+
+	for (blk_request_t *m = req->members; m != NULL; m = m->next_member) {
+		total += m->count;
+	}
+	if (total != req->end - req->start) {
+		return false;
+	}
+
+	// Members are in submission order
+	for (uint32_t lba = req->start; lba < req->end;) {
+		blk_request_t *m;
+		for (m = req->members; m != NULL && m->lba != lba; m = m->next_member);
+		if (!m) {
+			return false;
+		}
+		if (!segment(ctx, m->buffer, m->count * BLK_SECTOR_SIZE)) {
+			return false;
+		}
+		lba += m->count;
+	}
+
+	return true;
+}
+
+void blk_wait(blk_request_t *req)
+{
+	while (1) {
+		__asm__ __volatile__ ("cli");
+		if (req->status != BLK_STATUS_PENDING) {
+			__asm__ __volatile__ ("sti");
+			return;
+		}
+		// sti only takes effect after the next instruction, so no interrupt can slip in before hlt
+		__asm__ __volatile__ ("sti; hlt");
+	}
+}
+
+static int blk_rw_sectors(blk_queue_t *queue, uint8_t dir, uint32_t lba, uint32_t count, uint8_t *buffer)
+{
+	blk_request_t reqs[BLK_SYNC_BATCH];
+	int ret = 0;
+
+	while (count > 0) {
+		uint32_t n = 0;
+
+		// Submit a batch up front so the driver can keep several commands in flight
+		while (count > 0 && n < BLK_SYNC_BATCH) {
+			uint32_t chunk = count > queue->max_sectors ? queue->max_sectors : count;
+
+			memset(&reqs[n], 0, sizeof(blk_request_t));
+			reqs[n].lba = lba;
+			reqs[n].count = chunk;
+			reqs[n].dir = dir;
+			reqs[n].buffer = buffer;
+
+			blk_submit(queue, &reqs[n]);
+
+			lba += chunk;
+			count -= chunk;
+			buffer += chunk * BLK_SECTOR_SIZE;
+			n++;
+		}
+
+		for (uint32_t i = 0; i < n; i++) {
+			blk_wait(&reqs[i]);
+			if (reqs[i].status != BLK_STATUS_OK) {
+				ret = -1;
+			}
+		}
+	}
+
+	return ret;
+}
+
+int blk_read_sectors(blk_queue_t *queue, uint32_t lba, uint32_t count, uint8_t *buffer)
+{
+	return blk_rw_sectors(queue, BLK_READ, lba, count, buffer);
+}
+
+int blk_write_sectors(blk_queue_t *queue, uint32_t lba, uint32_t count, uint8_t *buffer)
+{
+	return blk_rw_sectors(queue, BLK_WRITE, lba, count, buffer);
+}
+
+/**
+ * Wait for everything queued so far and flush the drive's write cache.
+ */
+int blk_flush(blk_queue_t *queue)
+{
+	blk_request_t req;
+
+	if (!queue->write_cache) {
+		return 0;
+	}
+
+	memset(&req, 0, sizeof(blk_request_t));
+	req.dir = BLK_FLUSH;
+
+	blk_submit(queue, &req);
+	blk_wait(&req);
+
+	return req.status == BLK_STATUS_OK ? 0 : -1;
+}
+
+uint32_t blk_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	if (offset >= node->length) {
+		return 0;
+	}
+
+	if (size > node->length - offset) {
+		size = node->length - offset;
+	}
+
+	return bcache_read((blk_queue_t *)node->device, offset, size, buffer);
+}
+
+void blk_readahead(vfs_node_t *node, void *private, uint32_t offset, uint32_t size)
+{
+	if (size == 0 || offset >= node->length) {
+		return;
+	}
+
+	uint32_t block = offset / BCACHE_BLOCK_SIZE;
+	uint32_t last = (offset + size - 1) / BCACHE_BLOCK_SIZE;
+
+	bcache_prefetch((blk_queue_t *)private, block, last - block + 1);
+}
+
+uint32_t blk_write(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	if (offset >= node->length) {
+		return 0;
+	}
+
+	if (size > node->length - offset) {
+		size = node->length - offset;
+	}
+
+	return bcache_write((blk_queue_t *)node->device, offset, size, buffer);
+}
+
+/**
+ * Write back the disk's dirty blocks and flush its write cache.
+ */
+int blk_fsync(vfs_node_t *node)
+{
+	blk_queue_t *queue = (blk_queue_t *)node->device;
+
+	int ret = bcache_sync(queue);
+
+	if (blk_flush(queue) != 0) {
+		ret = -1;
+	}
+
+	return ret;
+}
+
+// Request arrays of finished I/Os, linked through the first request's private
+// field. Completions run in interrupt context, where the allocator can't be
+// used, so the next submission frees them.
+static blk_request_t *blk_io_free_list = NULL;
+
+static void blk_io_end(blk_request_t *req)
+{
+	vfs_io_t *io = (vfs_io_t *)req->private;
+
+	// Requests rejected by blk_submit() end in the submitter's context
+	uint32_t flags = irq_save();
+
+	if (req->status != BLK_STATUS_OK) {
+		io->status = -1;
+	}
+
+	bool last = --io->pending == 0;
+	if (last) {
+		blk_request_t *reqs = (blk_request_t *)io->driver;
+		reqs->private = blk_io_free_list;
+		blk_io_free_list = reqs;
+		io->driver = NULL;
+	}
+
+	irq_restore(flags);
+
+	if (last) {
+		vfs_io_complete(io, io->status == 0 ? io->result : 0, io->status);
+	}
+}
+
+static void blk_io_free_done(void)
+{
+	uint32_t flags = irq_save();
+	blk_request_t *reqs = blk_io_free_list;
+	blk_io_free_list = NULL;
+	irq_restore(flags);
+
+	while (reqs) {
+		blk_request_t *next = (blk_request_t *)reqs->private;
+		kfree(reqs);
+		reqs = next;
+	}
+}
+
+/**
+ * Start a sector aligned I/O straight to the disk, one request per buffer.
+ * The queue is plugged while they go in, so the elevator merges adjacent ones
+ * into a single scatter/gather command. Anything unaligned, or touching blocks
+ * the cache holds, is left to the cached read/write path.
+ *
+ * returns: 0 if the I/O was started, -1 to have the VFS do it synchronously.
+ */
+int blk_submit_io(vfs_node_t *node, vfs_io_t *io)
+{
+	blk_queue_t *queue = (blk_queue_t *)node->device;
+	uint32_t total = 0;
+	uint32_t count = 0;
+
+	blk_io_free_done();
+
+	if (io->offset % BLK_SECTOR_SIZE) {
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < io->iovcnt; i++) {
+		uint32_t sectors = io->iov[i].len / BLK_SECTOR_SIZE;
+		if (io->iov[i].len % BLK_SECTOR_SIZE || total + io->iov[i].len < total) {
+			return -1;
+		}
+		total += io->iov[i].len;
+		count += (sectors + queue->max_sectors - 1) / queue->max_sectors;
+	}
+
+	if (total == 0 || io->offset >= node->length || total > node->length - io->offset) {
+		return -1;
+	}
+
+	uint32_t lba = io->offset / BLK_SECTOR_SIZE;
+	uint32_t first = lba / BCACHE_BLOCK_SECTORS;
+	uint32_t last = (lba + total / BLK_SECTOR_SIZE - 1) / BCACHE_BLOCK_SECTORS;
+	if (bcache_cached(queue, first, last - first + 1)) {
+		return -1;
+	}
+
+	blk_request_t *reqs = (blk_request_t *)kmalloc(count * sizeof(blk_request_t));
+	if (!reqs) {
+		return -1;
+	}
+	memset(reqs, 0, count * sizeof(blk_request_t));
+
+	io->driver = reqs;
+	io->pending = count;
+	io->result = total;
+	io->status = 0;
+
+	blk_plug(queue);
+
+	blk_request_t *req = reqs;
+	for (uint32_t i = 0; i < io->iovcnt; i++) {
+		uint8_t *buffer = io->iov[i].base;
+		uint32_t sectors = io->iov[i].len / BLK_SECTOR_SIZE;
+
+		while (sectors > 0) {
+			uint32_t chunk = sectors > queue->max_sectors ? queue->max_sectors : sectors;
+
+			req->lba = lba;
+			req->count = chunk;
+			req->dir = io->dir == VFS_IO_WRITE ? BLK_WRITE : BLK_READ;
+			req->buffer = buffer;
+			req->end_io = &blk_io_end;
+			req->private = io;
+
+			blk_submit(queue, req++);
+
+			lba += chunk;
+			sectors -= chunk;
+			buffer += chunk * BLK_SECTOR_SIZE;
+		}
+	}
+
+	blk_unplug(queue);
+
+	return 0;
+}
+
+/**
+ * A disk is ready as long as its driver takes more requests.
+ */
+static uint32_t blk_poll(vfs_node_t *node)
+{
+	blk_queue_t *queue = (blk_queue_t *)node->device;
+
+	return queue->in_flight < queue->depth ? POLLIN | POLLOUT : 0;
+}
+
+static const vfs_ops_t blk_ops = {
+	.read = blk_read,
+	.write = blk_write,
+	.readahead = blk_readahead,
+	.fsync = blk_fsync,
+	.submit = blk_submit_io,
+	.poll = blk_poll,
+};
+
+/**
+ * Create the VFS node for a disk and mount it as the next /dev/sdX.
+ */
+vfs_node_t *blk_register_disk(blk_queue_t *queue)
+{
+	vfs_node_t *node = (vfs_node_t *)kmalloc(sizeof(vfs_node_t));
+	memset(node, 0, sizeof(vfs_node_t));
+
+	node->device = queue;
+	queue->node = node;
+	node->mask = VFS_MASK_DEVICE;
+	node->ops = &blk_ops;
+
+	// Byte offsets are 32 bits wide, so only the first 4GB are reachable through the node.
+	if (queue->sectors >= 0xFFFFFFFF / BLK_SECTOR_SIZE) {
+		node->length = 0xFFFFFFFF & ~(BLK_SECTOR_SIZE - 1);
+	} else {
+		node->length = queue->sectors * BLK_SECTOR_SIZE;
+	}
+
+	char name[] = "/dev/sd?";
+	name[7] = blk_current_drive_letter++;
+
+	debug("BLK: Creating device %s (%d sectors)\n", name, queue->sectors);
+
+	vfs_mount(name, node);
+
+	return node;
+}
@@ -1,3 +1,5 @@
+#define LOG_SUBSYS LOG_SYS_KBD
+
 #include "dev/kbd.h"
 #include "dev/ps2.h"
 #include "cpu.h"
@@ -54,7 +56,7 @@ void keyboard_init(ps2_dev_t device)
 	keystates = (uint8_t *)kmalloc(sizeof(uint8_t) * 128);
 
 	if (device.read == 0 || device.write == 0) {
-		debug("KBD: Invalid or incomplete device specification. Aborting.\n");
+		log_err("KBD: Invalid or incomplete device specification. Aborting.\n");
 		return;
 	}
 
@@ -70,7 +72,7 @@ void keyboard_init(ps2_dev_t device)
 		debug("KBD: Wrote 0xF4 command.\n");
 		uint8_t res = kbd_read();
 		if (res != 0xFA) {
-			debug("KBD: Failed to enable scanning.\n");
+			log_warn("KBD: Failed to enable scanning.\n");
 			tries++;
 		} else {
 			debug("KBD: Enabled scanning.\n");
@@ -114,7 +116,7 @@ void keyboard_interrupt(registers_t regs)
 
 	if (kbd_pipe) {
 		if (vfs_write(kbd_pipe, 0, sizeof(kbd_event_t), (uint8_t *)&event) != 0) {
-			debug("KBD: Error pushing to pipe (buffer full?)\n");
+			log_warn("KBD: Error pushing to pipe (buffer full?)\n");
 		}
 	}
 }
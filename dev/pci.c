@@ -1,6 +1,7 @@
 #include "dev/pci.h"
 #include "dev/pcihdr.h"
 #include "stdint.h"
+#include "stdbool.h"
 #include "io.h"
 #include "debug.h"
 
@@ -28,6 +29,32 @@ uint16_t pciConfigReadWord(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offs
 	return (tmp);
 }
 
+static inline uint32_t pciConfigAddress(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+	return 0x80000000 | ((uint32_t)bus << 16) | (((uint32_t)slot & 0x1F) << 11) | (((uint32_t)func & 0x7) << 8) | (offset & 0xFC);
+}
+
+uint32_t pciConfigReadDword(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+	outl(0xCF8, pciConfigAddress(bus, slot, func, offset));
+	return inl(0xCFC);
+}
+
+void pciConfigWriteDword(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value)
+{
+	outl(0xCF8, pciConfigAddress(bus, slot, func, offset));
+	outl(0xCFC, value);
+}
+
+void pciConfigWriteWord(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value)
+{
+	uint32_t tmp = pciConfigReadDword(bus, slot, func, offset);
+	uint32_t shift = (offset & 2) * 8;
+
+	tmp = (tmp & ~(0xFFFF << shift)) | ((uint32_t)value << shift);
+	pciConfigWriteDword(bus, slot, func, offset, tmp);
+}
+
 uint16_t getDeviceID(uint8_t bus, uint8_t slot, uint8_t func)
 {
 	return pciConfigReadWord(bus, slot, func, 2);
@@ -59,6 +86,41 @@ uint8_t getSubClass(uint8_t bus, uint8_t slot, uint8_t function)
 	return (uint8_t) (res & 0xFF);
 }
 
+uint8_t getProgIF(uint8_t bus, uint8_t slot, uint8_t function)
+{
+	uint16_t res = pciConfigReadWord(bus, slot, function, 0x8);
+
+	return (uint8_t) ((res >> 8) & 0xFF);
+}
+
+uint8_t getInterruptLine(uint8_t bus, uint8_t slot, uint8_t function)
+{
+	uint16_t res = pciConfigReadWord(bus, slot, function, 0x3C);
+
+	return (uint8_t) (res & 0xFF);
+}
+
+/**
+ * Read one of the six base address registers of a type 0 header.
+ */
+uint32_t getBAR(uint8_t bus, uint8_t slot, uint8_t function, uint8_t bar)
+{
+	return pciConfigReadDword(bus, slot, function, 0x10 + bar * 4);
+}
+
+/**
+ * Let the device decode its memory BARs, master the bus (DMA) and raise INTx.
+ */
+void enableBusMastering(uint8_t bus, uint8_t slot, uint8_t function)
+{
+	uint16_t command = pciConfigReadWord(bus, slot, function, 0x4);
+
+	command |= PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+	command &= ~PCI_COMMAND_INTX_DISABLE;
+
+	pciConfigWriteWord(bus, slot, function, 0x4, command);
+}
+
 uint8_t getSecondaryBus(uint8_t bus, uint8_t slot, uint8_t function)
 {
 	uint16_t res = pciConfigReadWord(bus, slot, function , 0x18);
@@ -149,3 +211,79 @@ void printDeviceDetails(uint16_t vendorID, uint16_t deviceID, uint8_t bus, uint8
 
 	kprintf(")\n");
 }
+
+/**
+ * Call callback for every function on every bus that matches.
+ */
+static void pciScan(bool (*match)(uint8_t, uint8_t, uint8_t, uint32_t, uint32_t), uint32_t a, uint32_t b, pci_callback_t callback)
+{
+	for (uint32_t bus = 0; bus < 256; bus++) {
+		for (uint8_t device = 0; device < 32; device++) {
+			if (getVendorID(bus, device, 0) == 0xFFFF) {
+				continue;
+			}
+
+			// getHeaderType() masks off the multi-function bit
+			uint8_t functions = (pciConfigReadWord(bus, device, 0, 0x0E) & 0x80) ? 8 : 1;
+
+			for (uint8_t function = 0; function < functions; function++) {
+				if (function && getVendorID(bus, device, function) == 0xFFFF) {
+					continue;
+				}
+				if (match(bus, device, function, a, b)) {
+					callback(bus, device, function);
+				}
+			}
+		}
+	}
+}
+
+static bool pciMatchClass(uint8_t bus, uint8_t slot, uint8_t function, uint32_t baseClass, uint32_t subClass)
+{
+	return getBaseClass(bus, slot, function) == baseClass && getSubClass(bus, slot, function) == subClass;
+}
+
+static bool pciMatchDevice(uint8_t bus, uint8_t slot, uint8_t function, uint32_t vendorID, uint32_t deviceID)
+{
+	return getVendorID(bus, slot, function) == vendorID && getDeviceID(bus, slot, function) == deviceID;
+}
+
+void pciFindClass(uint8_t baseClass, uint8_t subClass, pci_callback_t callback)
+{
+	pciScan(&pciMatchClass, baseClass, subClass, callback);
+}
+
+void pciFindDevice(uint16_t vendorID, uint16_t deviceID, pci_callback_t callback)
+{
+	pciScan(&pciMatchDevice, vendorID, deviceID, callback);
+}
+
+/**
+ * Walk the capability list. Pass 0 as start to get the first capability with
+ * the given ID, or a previous result to get the next one.
+ *
+ * returns: the config space offset of the capability, 0 if there is none.
+ */
+uint8_t pciFindCapability(uint8_t bus, uint8_t slot, uint8_t function, uint8_t id, uint8_t start)
+{
+	uint8_t offset;
+
+	if (start) {
+		offset = (pciConfigReadWord(bus, slot, function, start) >> 8) & 0xFC;
+	} else {
+		if (!(pciConfigReadWord(bus, slot, function, 0x06) & PCI_STATUS_CAP_LIST)) {
+			return 0;
+		}
+		offset = pciConfigReadWord(bus, slot, function, 0x34) & 0xFC;
+	}
+
+	while (offset) {
+		uint16_t header = pciConfigReadWord(bus, slot, function, offset);
+		if ((header & 0xFF) == id) {
+			return offset;
+		}
+		offset = (header >> 8) & 0xFC;
+	}
+
+	return 0;
+}
@@ -1,3 +1,5 @@
+#define LOG_SUBSYS LOG_SYS_PS2
+
 #include "dev/ps2.h"
 #include "io.h"
 #include "stdint.h"
@@ -75,7 +77,7 @@ void ps2_init()
 		has_port_a = 0;
 		has_port_b = 0;
 
-		debug("PS/2: Controller test failed! (0x%x)\n", controller_result);
+		log_err("PS/2: Controller test failed! (0x%x)\n", controller_result);
 		return;
 	} else {
 		debug("PS/2: Controller test OK.\n");
@@ -89,7 +91,7 @@ void ps2_init()
 	if (porta_result != (ps2_byte_t) 0x00) {
 		has_port_a = 0;
 
-		debug("PS/2: Port 1 test failed (0x%x). Disabling.\n", porta_result);
+		log_warn("PS/2: Port 1 test failed (0x%x). Disabling.\n", porta_result);
 	}
 
 	// If we have a port B
@@ -102,13 +104,13 @@ void ps2_init()
 		if (portb_result != (ps2_byte_t) 0x00) {
 			has_port_b = 0;
 
-			debug("PS/2: Port 2 test failed (0x%x). Disabling.\n", portb_result);
+			log_warn("PS/2: Port 2 test failed (0x%x). Disabling.\n", portb_result);
 		}
 	}
 
 	// Validate we still have working ports
 	if (!has_port_a && !has_port_b) {
-		debug("PS/2: No working ports found!\n");
+		log_err("PS/2: No working ports found!\n");
 		return;
 	}
 	// Read the configuration byte
@@ -194,7 +196,7 @@ void detect_device_type(ps2_dev_t *device)
 	res1 = ps2_read(PS2_DATA_PORT);
 
 	if (!res1 == PS2_DEV_RESULT_ACK) {
-		debug("PS/2: Device type detection failed.\n");
+		log_warn("PS/2: Device type detection failed.\n");
 		return;
 	}
 	res1 = 0;
@@ -208,7 +210,7 @@ void detect_device_type(ps2_dev_t *device)
 	res3 = ps2_read(PS2_DATA_PORT);
 
 	if (!res1 == PS2_DEV_RESULT_ACK) {
-		debug("PS/2: Device type detection failed.\n");
+		log_warn("PS/2: Device type detection failed.\n");
 		return;
 	}
 
@@ -244,7 +246,7 @@ bool ps2_wait(uint8_t flag)
 	uint32_t start = get_timer_ticks();
 	while ((inb(PS2_STATUS_PORT) & flag) && (get_timer_ticks() - start < PS2_TIMEOUT));
 	if (get_timer_ticks() - start >= PS2_TIMEOUT) {
-		debug("\tPS/2: Timeout. Status is 0x%x (0x%x)\n", inb(PS2_STATUS_PORT), inb(PS2_STATUS_PORT) & flag);
+		log_warn("\tPS/2: Timeout. Status is 0x%x (0x%x)\n", inb(PS2_STATUS_PORT), inb(PS2_STATUS_PORT) & flag);
 		return 0;
 	}
 //	debug("\tPS/2: Wait is over. Status is 0x%x\n", inb(PS2_STATUS_PORT));
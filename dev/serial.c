@@ -0,0 +1,416 @@
+#define LOG_SUBSYS LOG_SYS_SERIAL
+
+#include "dev/serial.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "io.h"
+#include "idt.h"
+#include "cpu.h"
+#include "fs/vfs.h"
+#include "fs/poll.h"
+#include "mem/kmalloc.h"
+#include "string.h"
+#include "log.h"
+#include "debug.h"
+
+/*
+ * Writers copy into a transmit ring and return, the THRE interrupt feeds the
+ * FIFO from it 16 bytes at a time. Received bytes are moved into a ring from
+ * the interrupt as well. Nothing here ever waits for the line, except
+ * serial_flush().
+ */
+
+typedef struct serial_ring {
+	uint8_t *buffer;
+	uint32_t size;			// Power of two
+	volatile uint32_t head;	// Next byte to fill, free running
+	volatile uint32_t tail;	// Next byte to take, free running
+} serial_ring_t;
+
+typedef struct serial_port {
+	uint16_t base;
+	uint8_t irq;
+	bool present;
+	uint8_t fifo_size;		// 1 if the FIFO doesn't work
+	bool tx_active;			// THRE interrupt enabled, it keeps the FIFO fed
+	bool tx_full;			// A writer found the ring full, tell pollers once it drained
+	uint32_t rx_dropped;	// Received bytes that didn't fit in the ring
+	serial_ring_t tx;
+	serial_ring_t rx;
+	vfs_node_t *node;
+} serial_port_t;
+
+static serial_port_t serial_ports[SERIAL_PORTS] = {
+	{.base = 0x3F8, .irq = 4},
+	{.base = 0x2F8, .irq = 3},
+	{.base = 0x3E8, .irq = 4},
+	{.base = 0x2E8, .irq = 3},
+};
+
+static inline uint32_t serial_ring_used(serial_ring_t *ring)
+{
+	return ring->head - ring->tail;
+}
+
+/**
+ * returns: false if the buffer could not be allocated.
+ */
+static bool serial_ring_init(serial_ring_t *ring, uint32_t size)
+{
+	ring->buffer = (uint8_t *)kmalloc(size);
+	ring->size = size;
+	ring->head = 0;
+	ring->tail = 0;
+
+	return ring->buffer != NULL;
+}
+
+/**
+ * returns: the number of bytes that fit.
+ */
+static uint32_t serial_ring_put(serial_ring_t *ring, const uint8_t *data, uint32_t len)
+{
+	uint32_t space = ring->size - serial_ring_used(ring);
+	if (len > space) {
+		len = space;
+	}
+
+	uint32_t pos = ring->head & (ring->size - 1);
+	uint32_t first = ring->size - pos < len ? ring->size - pos : len;
+	memcpy(ring->buffer + pos, data, first);
+	memcpy(ring->buffer, data + first, len - first);
+	ring->head += len;
+
+	return len;
+}
+
+/**
+ * returns: the number of bytes taken.
+ */
+static uint32_t serial_ring_get(serial_ring_t *ring, uint8_t *data, uint32_t len)
+{
+	uint32_t used = serial_ring_used(ring);
+	if (len > used) {
+		len = used;
+	}
+
+	uint32_t pos = ring->tail & (ring->size - 1);
+	uint32_t first = ring->size - pos < len ? ring->size - pos : len;
+	memcpy(data, ring->buffer + pos, first);
+	memcpy(data + first, ring->buffer, len - first);
+	ring->tail += len;
+
+	return len;
+}
+
+/**
+ * Refill the empty transmit FIFO from the ring.
+ */
+static void serial_tx_fill(serial_port_t *port)
+{
+	for (uint32_t n = port->fifo_size; n > 0 && serial_ring_used(&port->tx); n--) {
+		outb(port->base + SERIAL_REG_DATA, port->tx.buffer[port->tx.tail & (port->tx.size - 1)]);
+		port->tx.tail++;
+	}
+}
+
+/**
+ * Start transmitting if the interrupt isn't already doing it. Called with
+ * interrupts off.
+ */
+static void serial_tx_kick(serial_port_t *port)
+{
+	if (port->tx_active) {
+		return;
+	}
+
+	if (inb(port->base + SERIAL_REG_LSR) & SERIAL_LSR_THRE) {
+		serial_tx_fill(port);
+	}
+
+	if (serial_ring_used(&port->tx)) {
+		port->tx_active = true;
+		outb(port->base + SERIAL_REG_IER, SERIAL_IER_RDI | SERIAL_IER_RLSI | SERIAL_IER_THRI);
+	}
+}
+
+static void serial_tx_irq(serial_port_t *port)
+{
+	serial_tx_fill(port);
+
+	if (!serial_ring_used(&port->tx)) {
+		port->tx_active = false;
+		outb(port->base + SERIAL_REG_IER, SERIAL_IER_RDI | SERIAL_IER_RLSI);
+	}
+
+	if (port->tx_full && serial_ring_used(&port->tx) <= port->tx.size / 2) {
+		port->tx_full = false;
+		vfs_poll_notify(port->node, POLLOUT);
+	}
+}
+
+static void serial_rx_irq(serial_port_t *port)
+{
+	bool was_empty = !serial_ring_used(&port->rx);
+
+	// Reading the line status also clears a receiver line status interrupt
+	while (inb(port->base + SERIAL_REG_LSR) & SERIAL_LSR_DR) {
+		uint8_t c = inb(port->base + SERIAL_REG_DATA);
+		if (!serial_ring_put(&port->rx, &c, 1)) {
+			port->rx_dropped++;
+		}
+	}
+
+	if (was_empty && serial_ring_used(&port->rx)) {
+		vfs_poll_notify(port->node, POLLIN);
+	}
+}
+
+static void serial_irq(registers_t regs)
+{
+	for (uint32_t i = 0; i < SERIAL_PORTS; i++) {
+		serial_port_t *port = &serial_ports[i];
+		if (!port->present || (uint32_t)(IRQ0 + port->irq) != regs.int_no) {
+			continue;
+		}
+
+		uint8_t iir;
+		while (!((iir = inb(port->base + SERIAL_REG_IIR)) & SERIAL_IIR_NO_INT)) {
+			switch (iir & SERIAL_IIR_ID) {
+				case SERIAL_IIR_THRI:
+					serial_tx_irq(port);
+					break;
+				case SERIAL_IIR_RDI:
+				case SERIAL_IIR_TIMEOUT:
+				case SERIAL_IIR_RLSI:
+					serial_rx_irq(port);
+					break;
+				case SERIAL_IIR_MSI:
+					inb(port->base + SERIAL_REG_MSR);
+					break;
+			}
+		}
+	}
+}
+
+bool serial_present(uint32_t port)
+{
+	return port < SERIAL_PORTS && serial_ports[port].present;
+}
+
+/**
+ * Queue data for transmission. Never waits: whatever doesn't fit in the
+ * transmit ring is left to the caller.
+ *
+ * returns: the number of bytes queued.
+ */
+uint32_t serial_write(uint32_t port, const void *buffer, uint32_t size)
+{
+	if (!serial_present(port)) {
+		return 0;
+	}
+
+	serial_port_t *p = &serial_ports[port];
+
+	uint32_t flags = irq_save();
+	uint32_t ret = serial_ring_put(&p->tx, (const uint8_t *)buffer, size);
+	if (ret < size) {
+		p->tx_full = true;
+	}
+	serial_tx_kick(p);
+	irq_restore(flags);
+
+	return ret;
+}
+
+/**
+ * returns: the number of received bytes copied to buffer, 0 if there are none.
+ */
+uint32_t serial_read(uint32_t port, void *buffer, uint32_t size)
+{
+	if (!serial_present(port)) {
+		return 0;
+	}
+
+	uint32_t flags = irq_save();
+	uint32_t ret = serial_ring_get(&serial_ports[port].rx, (uint8_t *)buffer, size);
+	irq_restore(flags);
+
+	return ret;
+}
+
+/**
+ * Push out everything queued by polling the line, for when interrupts won't
+ * come anymore (PANIC).
+ */
+void serial_flush(void)
+{
+	uint32_t flags = irq_save();
+
+	for (uint32_t i = 0; i < SERIAL_PORTS; i++) {
+		serial_port_t *port = &serial_ports[i];
+		if (!port->present) {
+			continue;
+		}
+
+		while (serial_ring_used(&port->tx)) {
+			while (!(inb(port->base + SERIAL_REG_LSR) & SERIAL_LSR_THRE));
+			serial_tx_fill(port);
+		}
+	}
+
+	irq_restore(flags);
+}
+
+static uint32_t serial_node_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	return serial_read((serial_port_t *)node->device - serial_ports, buffer, size);
+}
+
+static uint32_t serial_node_write(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	return serial_write((serial_port_t *)node->device - serial_ports, buffer, size);
+}
+
+static uint32_t serial_node_poll(vfs_node_t *node)
+{
+	serial_port_t *port = (serial_port_t *)node->device;
+	uint32_t events = 0;
+
+	if (serial_ring_used(&port->rx)) {
+		events |= POLLIN;
+	}
+	if (serial_ring_used(&port->tx) < port->tx.size) {
+		events |= POLLOUT;
+	}
+
+	return events;
+}
+
+static const vfs_ops_t serial_ops = {
+	.read = serial_node_read,
+	.write = serial_node_write,
+	.poll = serial_node_poll,
+};
+
+/**
+ * Terminals want a carriage return before every newline.
+ */
+static void serial_log_sink(const char *str, uint32_t len)
+{
+	uint32_t start = 0;
+
+	for (uint32_t i = 0; i < len; i++) {
+		if (str[i] == '\n') {
+			serial_write(SERIAL_LOG_PORT, str + start, i - start);
+			serial_write(SERIAL_LOG_PORT, "\r\n", 2);
+			start = i + 1;
+		}
+	}
+
+	serial_write(SERIAL_LOG_PORT, str + start, len - start);
+}
+
+/**
+ * Check that there is a UART at the port and program it for SERIAL_BAUD 8N1
+ * with FIFOs, interrupts still off.
+ */
+static bool serial_probe(serial_port_t *port)
+{
+	uint16_t base = port->base;
+	uint16_t divisor = SERIAL_CLOCK / SERIAL_BAUD;
+
+	uint8_t mcr = inb(base + SERIAL_REG_MCR);
+	outb(base + SERIAL_REG_IER, 0);
+
+	// Nothing holds a value written to an empty port
+	outb(base + SERIAL_REG_SCR, 0x5A);
+	if (inb(base + SERIAL_REG_SCR) != 0x5A) {
+		return false;
+	}
+
+	outb(base + SERIAL_REG_LCR, SERIAL_LCR_DLAB);
+	outb(base + SERIAL_REG_DATA, divisor & 0xFF);
+	outb(base + SERIAL_REG_IER, divisor >> 8);
+	outb(base + SERIAL_REG_LCR, SERIAL_LCR_8N1);
+
+	outb(base + SERIAL_REG_IIR, SERIAL_FCR_ENABLE | SERIAL_FCR_CLR_RX | SERIAL_FCR_CLR_TX | SERIAL_FCR_TRIG14);
+
+	// A byte sent in loopback mode has to come back, one character time later
+	outb(base + SERIAL_REG_MCR, SERIAL_MCR_LOOP | SERIAL_MCR_RTS | SERIAL_MCR_DTR);
+	outb(base + SERIAL_REG_DATA, 0xAE);
+
+	uint32_t timeout = SERIAL_PROBE_TIMEOUT;
+	while (!(inb(base + SERIAL_REG_LSR) & SERIAL_LSR_DR) && --timeout);
+
+	if (!timeout || inb(base + SERIAL_REG_DATA) != 0xAE) {
+		outb(base + SERIAL_REG_MCR, mcr);
+		return false;
+	}
+
+	port->fifo_size = (inb(base + SERIAL_REG_IIR) & SERIAL_IIR_FIFO) == SERIAL_IIR_FIFO ? SERIAL_FIFO_SIZE : 1;
+
+	outb(base + SERIAL_REG_MCR, SERIAL_MCR_DTR | SERIAL_MCR_RTS | SERIAL_MCR_OUT2);
+
+	// Clear anything pending from before
+	while (inb(base + SERIAL_REG_LSR) & SERIAL_LSR_DR) {
+		inb(base + SERIAL_REG_DATA);
+	}
+	inb(base + SERIAL_REG_IIR);
+	inb(base + SERIAL_REG_MSR);
+
+	return true;
+}
+
+/**
+ * Find the COM ports, mount them as /dev/ttyS0 - /dev/ttyS3 (numbered by port,
+ * missing ones are skipped) and send the kernel log to SERIAL_LOG_PORT.
+ */
+void serial_init(void)
+{
+	for (uint32_t i = 0; i < SERIAL_PORTS; i++) {
+		serial_port_t *port = &serial_ports[i];
+
+		if (!serial_probe(port)) {
+			continue;
+		}
+
+		bool rings = serial_ring_init(&port->tx, SERIAL_TX_SIZE);
+		rings = serial_ring_init(&port->rx, SERIAL_RX_SIZE) && rings;
+
+		vfs_node_t *node = rings ? (vfs_node_t *)kmalloc(sizeof(vfs_node_t)) : NULL;
+		if (node == NULL) {
+			log_err("SERIAL: COM%d: out of memory\n", i + 1);
+			if (port->tx.buffer) {
+				kfree(port->tx.buffer);
+				port->tx.buffer = NULL;
+			}
+			if (port->rx.buffer) {
+				kfree(port->rx.buffer);
+				port->rx.buffer = NULL;
+			}
+			continue;
+		}
+		memset(node, 0, sizeof(vfs_node_t));
+		node->mask = VFS_MASK_DEVICE;
+		node->ops = &serial_ops;
+		node->device = port;
+		port->node = node;
+
+		register_shared_interrupt_handler(IRQ0 + port->irq, &serial_irq);
+
+		port->present = true;
+		outb(port->base + SERIAL_REG_IER, SERIAL_IER_RDI | SERIAL_IER_RLSI);
+
+		char name[] = "/dev/ttyS?";
+		name[9] = '0' + i;
+		vfs_mount(name, node);
+
+		debug("SERIAL: COM%d at 0x%x, IRQ %d, %d byte FIFO, %d baud\n", i + 1, port->base, port->irq,
+				port->fifo_size, SERIAL_BAUD);
+	}
+
+	if (serial_present(SERIAL_LOG_PORT)) {
+		log_add_sink(&serial_log_sink, LOG_DEBUG);
+	}
+}
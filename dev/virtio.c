@@ -0,0 +1,339 @@
+#define LOG_SUBSYS LOG_SYS_VIRTIO
+
+#include "dev/virtio.h"
+#include "dev/pci.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "cpu.h"
+#include "mem/paging.h"
+#include "string.h"
+#include "debug.h"
+
+/**
+ * Map the part of a BAR one of the virtio capabilities points at.
+ */
+static volatile uint8_t *virtio_map_cap(virtio_device_t *dev, uint8_t cap)
+{
+	uint8_t bar = pciConfigReadDword(dev->bus, dev->slot, dev->function, cap + 4) & 0xFF;
+	uint32_t offset = pciConfigReadDword(dev->bus, dev->slot, dev->function, cap + 8);
+	uint32_t length = pciConfigReadDword(dev->bus, dev->slot, dev->function, cap + 12);
+
+	if (bar > 5) {
+		return NULL;
+	}
+
+	uint32_t base = getBAR(dev->bus, dev->slot, dev->function, bar);
+	if (base & PCI_BAR_IO) {
+		log_warn("VIRTIO: I/O BARs are not supported\n");
+		return NULL;
+	}
+	if ((base & PCI_BAR_MEM_TYPE_64) && getBAR(dev->bus, dev->slot, dev->function, bar + 1) != 0) {
+		log_warn("VIRTIO: BAR %d is above 4GB\n", bar);
+		return NULL;
+	}
+
+	base &= PCI_BAR_MEM_MASK;
+
+	return (volatile uint8_t *)map_mmio(base + offset, length);
+}
+
+/**
+ * Find the modern (virtio 1.0) register blocks of a PCI device and reset it.
+ *
+ * returns: 0 on success, -1 if the device has no modern interface.
+ */
+int virtio_pci_init(virtio_device_t *dev, uint8_t bus, uint8_t slot, uint8_t function)
+{
+	memset(dev, 0, sizeof(virtio_device_t));
+	dev->bus = bus;
+	dev->slot = slot;
+	dev->function = function;
+	dev->irq = getInterruptLine(bus, slot, function);
+
+	uint8_t cap = 0;
+	while ((cap = pciFindCapability(bus, slot, function, PCI_CAP_ID_VENDOR, cap))) {
+		uint8_t type = (pciConfigReadDword(bus, slot, function, cap) >> 24) & 0xFF;
+
+		switch (type) {
+			case VIRTIO_PCI_CAP_COMMON_CFG:
+				if (!dev->common) {
+					dev->common = (virtio_pci_common_cfg_t *)virtio_map_cap(dev, cap);
+				}
+				break;
+			case VIRTIO_PCI_CAP_NOTIFY_CFG:
+				if (!dev->notify_base) {
+					dev->notify_base = virtio_map_cap(dev, cap);
+					dev->notify_multiplier = pciConfigReadDword(bus, slot, function, cap + 16);
+				}
+				break;
+			case VIRTIO_PCI_CAP_ISR_CFG:
+				if (!dev->isr) {
+					dev->isr = virtio_map_cap(dev, cap);
+				}
+				break;
+			case VIRTIO_PCI_CAP_DEVICE_CFG:
+				if (!dev->device_cfg) {
+					dev->device_cfg = virtio_map_cap(dev, cap);
+				}
+				break;
+		}
+	}
+
+	if (!dev->common || !dev->notify_base || !dev->isr) {
+		log_warn("VIRTIO: %d:%d:%d has no modern interface\n", bus, slot, function);
+		return -1;
+	}
+
+	enableBusMastering(bus, slot, function);
+
+	dev->common->device_status = 0;
+	while (dev->common->device_status != 0);
+
+	dev->common->device_status = VIRTIO_STATUS_ACKNOWLEDGE;
+	dev->common->device_status |= VIRTIO_STATUS_DRIVER;
+
+	return 0;
+}
+
+/**
+ * Accept the offered features out of the ones the driver asked for.
+ * VIRTIO_F_VERSION_1 is always required.
+ *
+ * returns: 0 on success, -1 if the device refused.
+ */
+int virtio_negotiate(virtio_device_t *dev, uint32_t features_lo, uint32_t features_hi)
+{
+	features_hi |= 1 << (VIRTIO_F_VERSION_1 - 32);
+
+	dev->common->device_feature_select = 0;
+	dev->features[0] = dev->common->device_feature & features_lo;
+	dev->common->device_feature_select = 1;
+	dev->features[1] = dev->common->device_feature & features_hi;
+
+	if (!virtio_has_feature(dev, VIRTIO_F_VERSION_1)) {
+		virtio_fail(dev);
+		return -1;
+	}
+
+	dev->common->driver_feature_select = 0;
+	dev->common->driver_feature = dev->features[0];
+	dev->common->driver_feature_select = 1;
+	dev->common->driver_feature = dev->features[1];
+
+	dev->common->device_status |= VIRTIO_STATUS_FEATURES_OK;
+	if (!(dev->common->device_status & VIRTIO_STATUS_FEATURES_OK)) {
+		virtio_fail(dev);
+		return -1;
+	}
+
+	return 0;
+}
+
+bool virtio_has_feature(virtio_device_t *dev, uint32_t bit)
+{
+	return (dev->features[bit / 32] >> (bit % 32)) & 1;
+}
+
+void virtio_driver_ok(virtio_device_t *dev)
+{
+	dev->common->device_status |= VIRTIO_STATUS_DRIVER_OK;
+}
+
+void virtio_fail(virtio_device_t *dev)
+{
+	dev->common->device_status |= VIRTIO_STATUS_FAILED;
+}
+
+/**
+ * Reading the ISR status acknowledges the (INTx) interrupt.
+ */
+uint8_t virtio_isr_ack(virtio_device_t *dev)
+{
+	return *dev->isr;
+}
+
+/**
+ * Set up a split virtqueue. The descriptor table and the available ring share a
+ * page, the used ring gets its own.
+ *
+ * returns: 0 on success, -1 if the queue doesn't exist.
+ */
+int virtq_init(virtio_device_t *dev, virtqueue_t *vq, uint16_t index)
+{
+	uintptr_t desc_phys;
+	uintptr_t used_phys;
+
+	memset(vq, 0, sizeof(virtqueue_t));
+
+	dev->common->queue_select = index;
+	uint16_t size = dev->common->queue_size;
+	if (size == 0) {
+		return -1;
+	}
+	if (size > VIRTQ_MAX_SIZE) {
+		size = VIRTQ_MAX_SIZE;
+	}
+
+	vq->index = index;
+	vq->size = size;
+	vq->event_idx = virtio_has_feature(dev, VIRTIO_F_RING_EVENT_IDX);
+
+	uint8_t *page = (uint8_t *)dma_alloc_page(&desc_phys);
+	vq->desc = (virtq_desc_t *)page;
+	vq->avail = (virtq_avail_t *)(page + size * sizeof(virtq_desc_t));
+	vq->used = (virtq_used_t *)dma_alloc_page(&used_phys);
+
+	for (uint16_t i = 0; i < size; i++) {
+		vq->desc[i].next = i + 1;
+	}
+	vq->free_head = 0;
+	vq->num_free = size;
+
+	dev->common->queue_size = size;
+	dev->common->queue_desc_lo = desc_phys;
+	dev->common->queue_desc_hi = 0;
+	dev->common->queue_driver_lo = desc_phys + size * sizeof(virtq_desc_t);
+	dev->common->queue_driver_hi = 0;
+	dev->common->queue_device_lo = used_phys;
+	dev->common->queue_device_hi = 0;
+
+	vq->notify = (volatile uint16_t *)(dev->notify_base + dev->common->queue_notify_off * dev->notify_multiplier);
+
+	dev->common->queue_enable = 1;
+
+	return 0;
+}
+
+/**
+ * Queue a chain of out device-readable buffers followed by in device-writable
+ * ones. The device doesn't see it until virtq_kick().
+ *
+ * returns: the chain's head, -1 if there aren't enough free descriptors.
+ */
+int virtq_add(virtqueue_t *vq, virtq_sg_t *sg, uint32_t out, uint32_t in, void *data)
+{
+	uint32_t count = out + in;
+
+	if (count == 0 || count > vq->num_free) {
+		return -1;
+	}
+
+	uint16_t head = vq->free_head;
+	uint16_t i = head;
+	uint16_t last = head;
+
+	for (uint32_t n = 0; n < count; n++) {
+		vq->desc[i].addr = sg[n].addr;
+		vq->desc[i].addr_hi = 0;
+		vq->desc[i].len = sg[n].len;
+		vq->desc[i].flags = (n < out ? 0 : VIRTQ_DESC_F_WRITE) | (n + 1 < count ? VIRTQ_DESC_F_NEXT : 0);
+		last = i;
+		i = vq->desc[i].next;
+	}
+
+	// The last descriptor keeps its link into the free list, it's just not flagged
+	vq->free_head = vq->desc[last].next;
+	vq->num_free -= count;
+
+	vq->data[head] = data;
+	vq->avail->ring[vq->avail_idx % vq->size] = head;
+	vq->avail_idx++;
+
+	return head;
+}
+
+static inline bool virtq_need_event(uint16_t event, uint16_t new_idx, uint16_t old_idx)
+{
+	return (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old_idx);
+}
+
+/**
+ * Publish everything added since the last kick with a single index update and
+ * notify the device, unless it said it doesn't need to hear about it.
+ */
+void virtq_kick(virtqueue_t *vq)
+{
+	uint16_t old_idx = vq->kicked_idx;
+	uint16_t new_idx = vq->avail_idx;
+
+	if (old_idx == new_idx) {
+		return;
+	}
+
+	// The ring entries have to be visible before the index
+	compiler_barrier();
+	vq->avail->idx = new_idx;
+	vq->kicked_idx = new_idx;
+
+	// ... and the index before we look at whether the device wants a notification
+	memory_barrier();
+
+	bool notify;
+	if (vq->event_idx) {
+		uint16_t avail_event = *(volatile uint16_t *)((volatile uint8_t *)vq->used + sizeof(virtq_used_t) + vq->size * sizeof(virtq_used_elem_t));
+		notify = virtq_need_event(avail_event, new_idx, old_idx);
+	} else {
+		notify = !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+	}
+
+	if (notify) {
+		*vq->notify = vq->index;
+	}
+}
+
+/**
+ * Take the next chain the device is done with.
+ *
+ * returns: the token passed to virtq_add(), NULL if there is none.
+ */
+void *virtq_get(virtqueue_t *vq, uint32_t *len)
+{
+	if (vq->last_used == vq->used->idx) {
+		return NULL;
+	}
+
+	// Read the element only after seeing the index
+	compiler_barrier();
+
+	volatile virtq_used_elem_t *elem = &vq->used->ring[vq->last_used % vq->size];
+	uint16_t head = elem->id;
+	if (len) {
+		*len = elem->len;
+	}
+	vq->last_used++;
+
+	void *data = vq->data[head];
+	vq->data[head] = NULL;
+
+	// Give the chain back to the free list
+	uint16_t i = head;
+	uint16_t count = 1;
+	while (vq->desc[i].flags & VIRTQ_DESC_F_NEXT) {
+		i = vq->desc[i].next;
+		count++;
+	}
+	vq->desc[i].next = vq->free_head;
+	vq->free_head = head;
+	vq->num_free += count;
+
+	return data;
+}
+
+/**
+ * Ask for an interrupt on the next completion. With event indices that is the
+ * used entry right after the ones already processed.
+ *
+ * returns: true if more chains completed in the meantime and virtq_get() should be called again.
+ */
+bool virtq_enable_cb(virtqueue_t *vq)
+{
+	if (vq->event_idx) {
+		vq->avail->ring[vq->size] = vq->last_used; // used_event
+	} else {
+		vq->avail->flags &= ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+	}
+
+	memory_barrier();
+
+	return vq->last_used != vq->used->idx;
+}
@@ -0,0 +1,259 @@
+#define LOG_SUBSYS LOG_SYS_VIRTIO
+
+#include "dev/virtio_blk.h"
+#include "dev/virtio.h"
+#include "dev/pci.h"
+#include "dev/blk.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "idt.h"
+#include "cpu.h"
+#include "mem/kmalloc.h"
+#include "mem/paging.h"
+#include "string.h"
+#include "debug.h"
+
+static virtio_blk_dev_t *virtio_blk_devices = NULL;
+
+typedef struct virtio_blk_sg {
+	virtq_sg_t *sg;
+	uint32_t n;
+	uint32_t max;
+} virtio_blk_sg_t;
+
+/**
+ * Add a virtually contiguous buffer to the chain, one element per physical page.
+ */
+static bool virtio_blk_add_segment(void *ctx, uint8_t *buffer, uint32_t size)
+{
+	virtio_blk_sg_t *sgl = (virtio_blk_sg_t *)ctx;
+
+	while (size > 0) {
+		uint32_t len = 0x1000 - ((uintptr_t)buffer & 0xFFF);
+		if (len > size) {
+			len = size;
+		}
+
+		if (sgl->n == sgl->max) {
+			return false;
+		}
+
+		virtq_sg_t *sg = &sgl->sg[sgl->n++];
+		sg->addr = virt_to_phys((uintptr_t)buffer);
+		sg->len = len;
+
+		buffer += len;
+		size -= len;
+	}
+
+	return true;
+}
+
+/**
+ * Put a (possibly merged) request on the virtqueue. The device is notified once
+ * per batch from virtio_blk_commit().
+ */
+static int virtio_blk_dispatch(blk_queue_t *queue, blk_request_t *req)
+{
+	virtio_blk_dev_t *dev = (virtio_blk_dev_t *)queue->driver;
+	virtq_sg_t sg[VIRTIO_BLK_MAX_SEGS + 2];
+
+	if (dev->busy == 0xFFFFFFFF) {
+		return BLK_DISPATCH_BUSY;
+	}
+
+	uint32_t tag = __builtin_ctz(~dev->busy);
+	virtio_blk_req_hdr_t *hdr = &dev->hdrs[tag];
+	bool bounced = false;
+
+	hdr->reserved = 0;
+	hdr->sector_lo = req->start;
+	hdr->sector_hi = 0;
+
+	sg[0].addr = dev->hdrs_phys + tag * sizeof(virtio_blk_req_hdr_t);
+	sg[0].len = sizeof(virtio_blk_req_hdr_t);
+
+	virtio_blk_sg_t sgl = {.sg = &sg[1], .n = 0, .max = dev->seg_max};
+
+	if (req->dir == BLK_FLUSH) {
+		hdr->type = VIRTIO_BLK_T_FLUSH;
+		hdr->sector_lo = 0;
+	} else {
+		hdr->type = req->dir == BLK_READ ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT;
+
+		if (!blk_request_map(req, &virtio_blk_add_segment, &sgl)) {
+			// Overlapping members or too many segments, go through the bounce buffer
+			if (dev->bounce_busy) {
+				return BLK_DISPATCH_BUSY;
+			}
+			if (req->dir == BLK_WRITE) {
+				blk_request_copy_in(req, dev->bounce);
+			}
+			sgl.n = 0;
+			virtio_blk_add_segment(&sgl, dev->bounce, (req->end - req->start) * BLK_SECTOR_SIZE);
+			bounced = true;
+		}
+	}
+
+	uint32_t data = sgl.n;
+	virtq_sg_t *status = &sg[1 + data];
+	status->addr = dev->hdrs_phys + VIRTIO_BLK_MAX_TAGS * sizeof(virtio_blk_req_hdr_t) + tag;
+	status->len = 1;
+
+	dev->status[tag] = 0xFF;
+
+	// The header and written data are device-readable, the read buffers and status byte device-writable
+	uint32_t out = req->dir == BLK_READ ? 1 : 1 + data;
+	if (virtq_add(&dev->vq, sg, out, 1 + data + 1 - out, &dev->tags[tag]) < 0) {
+		return BLK_DISPATCH_BUSY; // Out of descriptors until something completes
+	}
+
+	dev->tags[tag].req = req;
+	dev->tags[tag].bounced = bounced;
+	if (bounced) {
+		dev->bounce_busy = true;
+	}
+	dev->busy |= 1u << tag;
+
+	return BLK_DISPATCH_OK;
+}
+
+static void virtio_blk_commit(blk_queue_t *queue)
+{
+	virtio_blk_dev_t *dev = (virtio_blk_dev_t *)queue->driver;
+
+	virtq_kick(&dev->vq);
+}
+
+static void virtio_blk_complete(virtio_blk_dev_t *dev, virtio_blk_tag_t *tag)
+{
+	uint32_t index = tag - dev->tags;
+	blk_request_t *req = tag->req;
+	uint8_t status = dev->status[index] == VIRTIO_BLK_S_OK ? BLK_STATUS_OK : BLK_STATUS_ERROR;
+
+	if (tag->bounced) {
+		if (status == BLK_STATUS_OK && req->dir == BLK_READ) {
+			blk_request_copy_out(req, dev->bounce);
+		}
+		dev->bounce_busy = false;
+		tag->bounced = false;
+	}
+
+	if (status != BLK_STATUS_OK) {
+		log_err("VIRTIO-BLK: Request for sector %d failed (status %d)\n", req->start, dev->status[index]);
+	}
+
+	tag->req = NULL;
+	dev->busy &= ~(1u << index);
+
+	blk_end_request(&dev->queue, req, status);
+}
+
+static void virtio_blk_irq(registers_t regs)
+{
+	for (virtio_blk_dev_t *dev = virtio_blk_devices; dev != NULL; dev = dev->next) {
+		if ((uint32_t)(IRQ0 + dev->virtio.irq) != regs.int_no) {
+			continue;
+		}
+
+		if (!(virtio_isr_ack(&dev->virtio) & VIRTIO_ISR_QUEUE)) {
+			continue; // Not us, or just a configuration change
+		}
+
+		do {
+			virtio_blk_tag_t *tag;
+			while ((tag = (virtio_blk_tag_t *)virtq_get(&dev->vq, NULL))) {
+				virtio_blk_complete(dev, tag);
+			}
+		} while (virtq_enable_cb(&dev->vq));
+	}
+}
+
+static void virtio_blk_probe(uint8_t bus, uint8_t slot, uint8_t function)
+{
+	virtio_blk_dev_t *dev = (virtio_blk_dev_t *)kmalloc(sizeof(virtio_blk_dev_t));
+	if (dev == NULL) {
+		log_err("VIRTIO-BLK: Out of memory\n");
+		return;
+	}
+	memset(dev, 0, sizeof(virtio_blk_dev_t));
+
+	if (virtio_pci_init(&dev->virtio, bus, slot, function) != 0) {
+		kfree(dev);
+		return;
+	}
+
+	uint32_t features = (1 << VIRTIO_BLK_F_SEG_MAX) | (1 << VIRTIO_BLK_F_FLUSH) | (1 << VIRTIO_F_RING_EVENT_IDX);
+	if (virtio_negotiate(&dev->virtio, features, 0) != 0) {
+		log_err("VIRTIO-BLK: Feature negotiation failed\n");
+		kfree(dev);
+		return;
+	}
+
+	if (virtq_init(&dev->virtio, &dev->vq, 0) != 0) {
+		virtio_fail(&dev->virtio);
+		kfree(dev);
+		return;
+	}
+
+	virtio_blk_config_t *config = (virtio_blk_config_t *)dev->virtio.device_cfg;
+	uint32_t sectors = 0;
+	if (config) {
+		// Only the first 2TB are addressable with 32 bit sector numbers
+		sectors = config->capacity_hi ? 0xFFFFFFFF : config->capacity_lo;
+	}
+
+	// Every request needs a descriptor for its header and its status byte as well
+	uint32_t max_sectors = VIRTIO_BLK_MAX_SECTORS;
+	dev->seg_max = VIRTIO_BLK_MAX_SEGS;
+	if ((uint32_t)(dev->vq.size - 2) < dev->seg_max) {
+		dev->seg_max = dev->vq.size - 2;
+	}
+	if (config && virtio_has_feature(&dev->virtio, VIRTIO_BLK_F_SEG_MAX) && config->seg_max < dev->seg_max) {
+		dev->seg_max = config->seg_max < 2 ? 2 : config->seg_max;
+	}
+	if (dev->seg_max < VIRTIO_BLK_MAX_SEGS) {
+		// The bounce buffer has to fit, it may start in the middle of a page
+		max_sectors = (dev->seg_max - 1) * (0x1000 / BLK_SECTOR_SIZE);
+	}
+
+	dev->bounce = (uint8_t *)kmalloc(max_sectors * BLK_SECTOR_SIZE);
+	if (dev->bounce == NULL) {
+		log_err("VIRTIO-BLK: Out of memory\n");
+		virtio_fail(&dev->virtio);
+		kfree(dev);
+		return;
+	}
+
+	uintptr_t phys;
+	uint8_t *page = (uint8_t *)dma_alloc_page(&phys);
+	dev->hdrs = (virtio_blk_req_hdr_t *)page;
+	dev->status = page + VIRTIO_BLK_MAX_TAGS * sizeof(virtio_blk_req_hdr_t);
+	dev->hdrs_phys = phys;
+
+	blk_queue_init(&dev->queue, &virtio_blk_dispatch, dev, max_sectors, VIRTIO_BLK_MAX_TAGS);
+	dev->queue.commit = &virtio_blk_commit;
+	dev->queue.sectors = sectors;
+	dev->queue.write_cache = virtio_has_feature(&dev->virtio, VIRTIO_BLK_F_FLUSH);
+
+	uint32_t flags = irq_save();
+	dev->next = virtio_blk_devices;
+	virtio_blk_devices = dev;
+	irq_restore(flags);
+
+	register_shared_interrupt_handler(IRQ0 + dev->virtio.irq, &virtio_blk_irq);
+
+	virtq_enable_cb(&dev->vq);
+	virtio_driver_ok(&dev->virtio);
+
+	debug("VIRTIO-BLK: %d sectors, IRQ %d, queue size %d%s\n", sectors, dev->virtio.irq, dev->vq.size,
+			dev->vq.event_idx ? ", event idx" : "");
+
+	blk_register_disk(&dev->queue);
+}
+
+void virtio_blk_init()
+{
+	pciFindDevice(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID_LEGACY, &virtio_blk_probe);
+	pciFindDevice(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, &virtio_blk_probe);
+}
@@ -1,62 +1,253 @@
 #include "ds/hashtable.h"
 #include "mem/kmalloc.h"
-#include "mem/liballoc/liballoc.h"
 #include "string.h"
 #include "stdint.h"
+#include "stdbool.h"
 #include "stddef.h"
 
+/**
+ * FNV-1a, computed in the same pass that finds the end of the key.
+ */
+static uint32_t hashtable_hash(const char *key)
+{
+	uint32_t hash = 0x811C9DC5;
+
+	while (*key) {
+		hash ^= (uint8_t)*key++;
+		hash *= 0x01000193;
+	}
+
+	// 0 marks empty slots
+	return hash ? hash : 1;
+}
+
+static inline uint32_t hashtable_distance(uint32_t hash, uint32_t index, uint32_t size)
+{
+	return (index - (hash & (size - 1))) & (size - 1);
+}
+
+static hashtable_entry_t *hashtable_alloc(uint32_t size)
+{
+	hashtable_entry_t *entries = (hashtable_entry_t *)kmalloc(size * sizeof(hashtable_entry_t));
+
+	if (entries) {
+		memset(entries, 0, size * sizeof(hashtable_entry_t));
+	}
+
+	return entries;
+}
+
+/**
+ * Find a key in one array. Robin Hood ordering lets the probe stop as soon as it
+ * passes an entry that is closer to its home slot than the key would be.
+ */
+static hashtable_entry_t *hashtable_find(hashtable_entry_t *entries, uint32_t size, const char *key, uint32_t hash)
+{
+	uint32_t index = hash & (size - 1);
+
+	for (uint32_t dist = 0; ; dist++, index = (index + 1) & (size - 1)) {
+		hashtable_entry_t *e = &entries[index];
+
+		if (!e->hash || hashtable_distance(e->hash, index, size) < dist) {
+			return NULL;
+		}
+
+		if (e->hash == hash && e->key && !strcmp(e->key, key)) {
+			return e;
+		}
+	}
+}
+
+/**
+ * Place an entry whose key is known not to be in the array yet.
+ */
+static void hashtable_place(hashtable_entry_t *entries, uint32_t size, hashtable_entry_t entry)
+{
+	uint32_t index = entry.hash & (size - 1);
+
+	for (uint32_t dist = 0; ; dist++, index = (index + 1) & (size - 1)) {
+		hashtable_entry_t *e = &entries[index];
+
+		if (!e->hash) {
+			*e = entry;
+			return;
+		}
+
+		// Take the slot from an entry that is closer to home, then go on placing that one
+		uint32_t existing = hashtable_distance(e->hash, index, size);
+		if (existing < dist) {
+			hashtable_entry_t tmp = *e;
+			*e = entry;
+			entry = tmp;
+			dist = existing;
+		}
+	}
+}
+
+/**
+ * Delete by shifting the following entries of the cluster back by one, so no
+ * tombstones are needed.
+ */
+static void hashtable_erase(hashtable_entry_t *entries, uint32_t size, hashtable_entry_t *e)
+{
+	uint32_t index = e - entries;
+
+	while (1) {
+		uint32_t next = (index + 1) & (size - 1);
+
+		if (!entries[next].hash || hashtable_distance(entries[next].hash, next, size) == 0) {
+			break;
+		}
+
+		entries[index] = entries[next];
+		index = next;
+	}
+
+	memset(&entries[index], 0, sizeof(hashtable_entry_t));
+}
+
+/**
+ * Move a few entries out of the old array. Moved and deleted entries there
+ * keep their hash as a tombstone so probes over them still work.
+ */
+static void hashtable_migrate(hashtable_t *table)
+{
+	if (!table->old_entries) {
+		return;
+	}
+
+	for (uint32_t n = 0; n < HASHTABLE_MIGRATE_STEP && table->migrate_pos < table->old_size; n++) {
+		hashtable_entry_t *e = &table->old_entries[table->migrate_pos++];
+
+		if (e->key) {
+			hashtable_place(table->entries, table->size, *e);
+			e->key = NULL;
+		}
+	}
+
+	if (table->migrate_pos == table->old_size) {
+		kfree(table->old_entries);
+		table->old_entries = NULL;
+		table->old_size = 0;
+	}
+}
+
+static int hashtable_grow(hashtable_t *table)
+{
+	// Finish the previous resize first
+	while (table->old_entries) {
+		hashtable_migrate(table);
+	}
+
+	hashtable_entry_t *entries = hashtable_alloc(table->size * 2);
+	if (!entries) {
+		return 1;
+	}
+
+	table->old_entries = table->entries;
+	table->old_size = table->size;
+	table->migrate_pos = 0;
+
+	table->entries = entries;
+	table->size *= 2;
+
+	return 0;
+}
+
 hashtable_t *hashtable_create(size_t size)
 {
-	hashtable_t * table = (hashtable_t *)kmalloc(sizeof(hashtable_t));
+	hashtable_t *table = (hashtable_t *)kmalloc(sizeof(hashtable_t));
+	memset(table, 0, sizeof(hashtable_t));
 
-	table->entries = lcalloc(size, sizeof(hashtable_entry_t *));
-	table->size = size;
-	table->length = 0;
+	// Keep the load factor below 3/4 for the expected number of keys
+	table->size = HASHTABLE_MIN_SIZE;
+	while (table->size * 3 / 4 < size) {
+		table->size *= 2;
+	}
+
+	table->entries = hashtable_alloc(table->size);
 
 	return table;
 }
 
+void hashtable_destroy(hashtable_t *table)
+{
+	if (table->old_entries) {
+		kfree(table->old_entries);
+	}
+	kfree(table->entries);
+	kfree(table);
+}
+
+/**
+ * Insert a key, or replace the value of an existing one. The table keeps the
+ * key pointer, it doesn't copy the string.
+ *
+ * returns: 0 on success, 1 when out of memory.
+ */
 int hashtable_insert(hashtable_t *table, char *key, bool writeable, void *value)
 {
-	if (table->length == table->size) {
-		return 1;
+	uint32_t hash = hashtable_hash(key);
+
+	hashtable_migrate(table);
+
+	hashtable_entry_t *e = hashtable_find(table->entries, table->size, key, hash);
+	if (!e && table->old_entries) {
+		e = hashtable_find(table->old_entries, table->old_size, key, hash);
+	}
+	if (e) {
+		e->key = key;
+		e->writeable = writeable;
+		e->value = value;
+		return 0;
 	}
 
-	table->entries[table->length].key = key;
-	table->entries[table->length].writeable = writeable;
-	table->entries[table->length].value = value;
+	if ((table->length + 1) * 4 > table->size * 3 && hashtable_grow(table) != 0) {
+		return 1;
+	}
 
+	hashtable_entry_t entry = {.key = key, .writeable = writeable, .value = value, .hash = hash};
+	hashtable_place(table->entries, table->size, entry);
 	table->length++;
 
 	return 0;
 }
 
+/**
+ * Remove a key. The key and value themselves are not freed.
+ *
+ * returns: 0 on success, -1 if the key wasn't found.
+ */
 int hashtable_remove(hashtable_t *table, char *key)
 {
-	hashtable_entry_t *entry = hashtable_lookup(table, key);
-	if (!entry) {
+	uint32_t hash = hashtable_hash(key);
+
+	hashtable_migrate(table);
+
+	hashtable_entry_t *e = hashtable_find(table->entries, table->size, key, hash);
+	if (e) {
+		hashtable_erase(table->entries, table->size, e);
+	} else if (table->old_entries && (e = hashtable_find(table->old_entries, table->old_size, key, hash))) {
+		e->key = NULL;	// Tombstone, the old array is going away anyway
+	} else {
 		return -1;
 	}
 
-	kfree(entry);
+	table->length--;
 
 	return 0;
 }
 
 hashtable_entry_t *hashtable_lookup(hashtable_t *table, char *key)
 {
-	debug("HASHMAP: Scanning %d entries.\n", table->length);
-	for (uint32_t i = 0; i < table->length; i++) {
-		debug("HASHMAP: Searching index %d: ", i);
-		if (table->entries[i].key && strcmp(table->entries[i].key, key) == 0) {
-			debug("Found key %s.\n", key);
-			return &table->entries[i];
-		} else {
-			debug("HASHMAP: NOT found.\n");
-		}
+	uint32_t hash = hashtable_hash(key);
+
+	hashtable_entry_t *e = hashtable_find(table->entries, table->size, key, hash);
+	if (!e && table->old_entries) {
+		e = hashtable_find(table->old_entries, table->old_size, key, hash);
 	}
 
-	return (void *)0;
+	return e;
 }
 
 void *hashtable_lookup_value(hashtable_t *table, char *key)
@@ -69,9 +260,48 @@ void *hashtable_lookup_value(hashtable_t *table, char *key)
 	return (void *)0;
 }
 
+void hashtable_iter_init(hashtable_t *table, hashtable_iter_t *iter)
+{
+	iter->table = table;
+	iter->index = 0;
+	iter->old = false;
+}
+
+/**
+ * returns: the next entry, NULL once every entry was visited.
+ */
+hashtable_entry_t *hashtable_iter_next(hashtable_iter_t *iter)
+{
+	hashtable_t *table = iter->table;
+
+	if (!iter->old) {
+		while (iter->index < table->size) {
+			hashtable_entry_t *e = &table->entries[iter->index++];
+			if (e->key) {
+				return e;
+			}
+		}
+
+		iter->old = true;
+		iter->index = 0;
+	}
+
+	while (table->old_entries && iter->index < table->old_size) {
+		hashtable_entry_t *e = &table->old_entries[iter->index++];
+		if (e->key) {
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
 void hashtable_walk(hashtable_t *table, hashtable_walker_t walker)
 {
-	for (uint32_t i = 0; i < table->length; i++) {
-		walker(table, &table->entries[i]);
+	hashtable_iter_t iter;
+	hashtable_entry_t *entry;
+
+	hashtable_foreach(table, iter, entry) {
+		walker(table, entry);
 	}
 }
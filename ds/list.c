@@ -27,6 +27,7 @@ int list_insert_start(list_t *list, list_item_t *item)
 	} else if (list->length == 0) { // Empty list
 		list->first = list->last = item;
 		item->owner = list;
+		list->length++;
 	} else {
 		return -1; // Error
 	}
@@ -47,6 +48,7 @@ int list_insert_end(list_t *list, list_item_t *item)
 	} else if (list->length == 0) { // Empty list
 		list->last = list->first = item;
 		item->owner = list;
+		list->length++;
 	} else {
 		return -1; // Error
 	}
@@ -96,21 +98,22 @@ int list_insert_before(list_t *list, list_item_t *item, list_item_t *before)
 
 int list_remove(list_t *list, list_item_t *item)
 {
-	ASSERT((item->next || item->prev), "Item doesn't belong to a list!");
+	ASSERT(item->owner == list, "Item doesn't belong to this list!");
 
-	if (item->prev && item->next) {
+	if (item->prev) {
 		item->prev->next = item->next;
-		item->next->prev = item->prev;
-	}
-
-	if (!item->prev) {
+	} else {
 		list->first = item->next;
 	}
 
-	if (!item->next) {
+	if (item->next) {
+		item->next->prev = item->prev;
+	} else {
 		list->last = item->prev;
 	}
 
+	item->prev = NULL;
+	item->next = NULL;
 	item->owner = NULL;
 
 	list->length--;
@@ -118,18 +121,6 @@ int list_remove(list_t *list, list_item_t *item)
 	return 0;
 }
 
-int list_append(list_t *list, void *value)
-{
-	list_item_t *item = (list_item_t *)kmalloc(sizeof(list_item_t));
-
-	item->prev = NULL;
-	item->next = NULL;
-	item->owner = list;
-	item->value = value;
-
-	return list_insert_end(list, item);
-}
-
 list_item_t *list_find(list_t *list, list_item_comparator_t comparator, void *value)
 {
 	list_item_t *next = list->first;
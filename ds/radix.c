@@ -0,0 +1,200 @@
+#include "ds/radix.h"
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include "mem/kmalloc.h"
+#include "string.h"
+
+#define RADIX_MAX_HEIGHT ((32 + RADIX_SHIFT - 1) / RADIX_SHIFT)
+
+static radix_node_t *radix_node_alloc(void)
+{
+	radix_node_t *node = (radix_node_t *)kmalloc(sizeof(radix_node_t));
+
+	if (node) {
+		memset(node, 0, sizeof(radix_node_t));
+	}
+
+	return node;
+}
+
+/**
+ * returns: the largest index a tree of the given height can hold.
+ */
+static inline uint32_t radix_max_index(uint32_t height)
+{
+	if (height * RADIX_SHIFT >= 32) {
+		return 0xFFFFFFFF;
+	}
+
+	return (1 << (height * RADIX_SHIFT)) - 1;
+}
+
+void radix_init(radix_tree_t *tree)
+{
+	tree->root = NULL;
+	tree->height = 0;
+}
+
+void *radix_lookup(radix_tree_t *tree, uint32_t index)
+{
+	if (tree->height == 0 || index > radix_max_index(tree->height)) {
+		return NULL;
+	}
+
+	radix_node_t *node = tree->root;
+	for (uint32_t shift = (tree->height - 1) * RADIX_SHIFT; shift > 0; shift -= RADIX_SHIFT) {
+		node = (radix_node_t *)node->slots[(index >> shift) & RADIX_MASK];
+		if (!node) {
+			return NULL;
+		}
+	}
+
+	return node->slots[index & RADIX_MASK];
+}
+
+/**
+ * returns: 0 on success, -1 if the index is taken or we're out of memory.
+ */
+int radix_insert(radix_tree_t *tree, uint32_t index, void *item)
+{
+	// Grow by putting the current root under a new one as its first slot
+	while (tree->height == 0 || index > radix_max_index(tree->height)) {
+		radix_node_t *root = radix_node_alloc();
+		if (!root) {
+			return -1;
+		}
+
+		if (tree->root) {
+			root->slots[0] = tree->root;
+			root->count = 1;
+		}
+
+		tree->root = root;
+		tree->height++;
+	}
+
+	radix_node_t *node = tree->root;
+	for (uint32_t shift = (tree->height - 1) * RADIX_SHIFT; shift > 0; shift -= RADIX_SHIFT) {
+		void **slot = &node->slots[(index >> shift) & RADIX_MASK];
+		if (!*slot) {
+			if (!(*slot = radix_node_alloc())) {
+				return -1;
+			}
+			node->count++;
+		}
+		node = (radix_node_t *)*slot;
+	}
+
+	void **slot = &node->slots[index & RADIX_MASK];
+	if (*slot) {
+		return -1;
+	}
+
+	*slot = item;
+	node->count++;
+
+	return 0;
+}
+
+/**
+ * Remove an index, freeing the nodes that become empty.
+ *
+ * returns: the item that was stored there, NULL if there was none.
+ */
+void *radix_delete(radix_tree_t *tree, uint32_t index)
+{
+	radix_node_t *path[RADIX_MAX_HEIGHT];
+
+	if (tree->height == 0 || index > radix_max_index(tree->height)) {
+		return NULL;
+	}
+
+	radix_node_t *node = tree->root;
+	uint32_t level = 0;
+	for (uint32_t shift = (tree->height - 1) * RADIX_SHIFT; shift > 0; shift -= RADIX_SHIFT) {
+		path[level++] = node;
+		node = (radix_node_t *)node->slots[(index >> shift) & RADIX_MASK];
+		if (!node) {
+			return NULL;
+		}
+	}
+
+	void *item = node->slots[index & RADIX_MASK];
+	if (!item) {
+		return NULL;
+	}
+
+	node->slots[index & RADIX_MASK] = NULL;
+	node->count--;
+
+	// Walk back up while nodes are empty
+	uint32_t shift = 0;
+	while (node->count == 0) {
+		kfree(node);
+
+		if (level == 0) {
+			radix_init(tree);
+			break;
+		}
+
+		shift += RADIX_SHIFT;
+		node = path[--level];
+		node->slots[(index >> shift) & RADIX_MASK] = NULL;
+		node->count--;
+	}
+
+	return item;
+}
+
+/**
+ * returns: true if the node ended up empty and was freed.
+ */
+static bool radix_node_truncate(radix_node_t *node, uint32_t height, uint32_t base, uint32_t first, radix_free_t free_item)
+{
+	uint32_t shift = (height - 1) * RADIX_SHIFT;
+
+	for (uint32_t i = 0; i < RADIX_SLOTS; i++) {
+		if (!node->slots[i]) {
+			continue;
+		}
+
+		uint32_t start = base + (i << shift);
+		uint32_t last = start + radix_max_index(height - 1);
+		if (last < first) {
+			continue;
+		}
+
+		if (height == 1) {
+			if (free_item) {
+				free_item(node->slots[i]);
+			}
+		} else if (!radix_node_truncate((radix_node_t *)node->slots[i], height - 1, start, first, free_item)) {
+			continue;
+		}
+
+		node->slots[i] = NULL;
+		node->count--;
+	}
+
+	if (node->count == 0) {
+		kfree(node);
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Remove every index from first on, passing the items to free_item.
+ */
+void radix_truncate(radix_tree_t *tree, uint32_t first, radix_free_t free_item)
+{
+	if (tree->height == 0 || first > radix_max_index(tree->height)) {
+		return;
+	}
+
+	if (radix_node_truncate(tree->root, tree->height, 0, first, free_item)) {
+		radix_init(tree);
+	}
+}
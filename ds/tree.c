@@ -1,11 +1,11 @@
 #include "ds/tree.h"
-#include "ds/list.h"
 #include "stdint.h"
+#include "stddef.h"
 #include "mem/kmalloc.h"
 
 tree_t *tree_create()
 {
-	tree_t * tree = (tree_t *)kmalloc(sizeof(tree));
+	tree_t * tree = (tree_t *)kmalloc(sizeof(tree_t));
 
 	tree->nodes = 0;
 	tree->root = NULL;
@@ -13,57 +13,63 @@ tree_t *tree_create()
 	return tree;
 }
 
-tree_node_t *tree_node_create(void *value)
+void tree_node_init(tree_node_t *node)
 {
-	tree_node_t * node = (tree_node_t *)kmalloc(sizeof(tree_node_t));
-	if (!node) {
-		return NULL;
-	}
-
-	node->children = list_create();
 	node->parent = NULL;
-	node->value = value;
-
-	return node;
+	node->first_child = NULL;
+	node->next_sibling = NULL;
 }
 
-void tree_set_root(tree_t *tree, void *value)
+void tree_set_root(tree_t *tree, tree_node_t *node)
 {
-	tree_node_t *node = tree_node_create(value);
+	tree_node_init(node);
 
 	tree->root = node;
 	tree->nodes = 1;
 }
 
-void tree_node_insert_child_node(tree_t *tree, tree_node_t *parent, tree_node_t *node)
+/**
+ * Add node as the first child of parent. Node must not be in a tree yet.
+ */
+void tree_node_insert_child(tree_t *tree, tree_node_t *parent, tree_node_t *node)
 {
-	list_append(parent->children, node);
 	node->parent = parent;
+	node->next_sibling = parent->first_child;
+	parent->first_child = node;
 	tree->nodes++;
 }
 
-tree_node_t *tree_node_insert_child(tree_t *tree, tree_node_t *parent, void *value)
+/**
+ * Unlink a leaf from its parent.
+ */
+void tree_node_remove(tree_t *tree, tree_node_t *node)
 {
-	tree_node_t *node = tree_node_create(value);
-	tree_node_insert_child_node(tree, parent, node);
-	return node;
+	tree_node_t **link = &node->parent->first_child;
+
+	while (*link != node) {
+		link = &(*link)->next_sibling;
+	}
+	*link = node->next_sibling;
+
+	node->parent = NULL;
+	node->next_sibling = NULL;
+	tree->nodes--;
 }
 
 tree_node_t *tree_node_find(tree_node_t *node, void *value, tree_node_comparator_t comparator)
 {
-	if (comparator(node->value, value)) {
+	if (comparator(node, value)) {
 		return node;
 	}
 
-	tree_node_t *found;
-	for (list_item_t * i = node->children->first; i != NULL; i = i->next) {
-		found = tree_node_find((tree_node_t *)i->value, value, comparator);
+	tree_foreach_child(node, child) {
+		tree_node_t *found = tree_node_find(child, value, comparator);
 		if (found) {
 			return found;
 		}
 	}
 
-	return 0;
+	return NULL;
 }
 
 tree_node_t *tree_find(tree_t *tree, void *value, tree_node_comparator_t comparator)
@@ -0,0 +1,158 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "idt.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+#include "debug.h"
+
+#define FPU_NM_VECTOR 7	// Device not available
+
+static bool fpu_fxsr = false;
+
+static fpu_state_t fpu_initial;		// Right after fninit, copied into new contexts
+static fpu_state_t fpu_kernel;		// The context running kmain()
+
+static fpu_state_t *fpu_current;	// Context that is running
+static fpu_state_t *fpu_loaded;		// Context whose state is in the registers, NULL if none
+
+static inline void fpu_save(fpu_state_t *state)
+{
+	if (fpu_fxsr) {
+		__asm__ __volatile__ ("fxsave %0" : "=m" (*state));
+	} else {
+		__asm__ __volatile__ ("fnsave %0; fwait" : "=m" (*state));
+	}
+}
+
+static inline void fpu_restore(fpu_state_t *state)
+{
+	if (fpu_fxsr) {
+		__asm__ __volatile__ ("fxrstor %0" :: "m" (*state));
+	} else {
+		__asm__ __volatile__ ("frstor %0" :: "m" (*state));
+	}
+}
+
+static inline void clts(void)
+{
+	__asm__ __volatile__ ("clts" ::: "memory");
+}
+
+static inline void stts(void)
+{
+	write_cr0(read_cr0() | CR0_TS);
+}
+
+/**
+ * #NM: the running context touched the FPU while TS was set. Park whoever's
+ * state is in the registers and load the running context's.
+ */
+static void fpu_trap(registers_t regs)
+{
+	clts();
+
+	if (fpu_loaded == fpu_current) {
+		return;
+	}
+
+	if (fpu_loaded) {
+		fpu_save(fpu_loaded);
+	}
+	fpu_restore(fpu_current);
+	fpu_loaded = fpu_current;
+}
+
+/**
+ * Enable the FPU, and SSE where there is one. TS is left set, so nothing is
+ * saved or restored until some code actually uses the FPU.
+ */
+void fpu_init(void)
+{
+	if (!cpu_has_feature(CPU_FEATURE_FPU)) {
+		log_warn("FPU: None found\n");
+		return;
+	}
+
+	uint32_t cr0 = read_cr0();
+	cr0 &= ~(CR0_EM | CR0_TS);
+	cr0 |= CR0_MP | CR0_NE;
+	write_cr0(cr0);
+
+	if (cpu_has_feature(CPU_FEATURE_FXSR)) {
+		uint32_t cr4 = read_cr4() | CR4_OSFXSR;
+		if (cpu_has_feature(CPU_FEATURE_SSE)) {
+			cr4 |= CR4_OSXMMEXCPT;
+		}
+		write_cr4(cr4);
+		fpu_fxsr = true;
+	}
+
+	__asm__ __volatile__ ("fninit");
+	fpu_save(&fpu_initial);
+
+	fpu_state_init(&fpu_kernel);
+	fpu_current = &fpu_kernel;
+	fpu_loaded = NULL;
+
+	register_interrupt_handler(FPU_NM_VECTOR, &fpu_trap);
+	stts();
+
+	debug("FPU: Lazy switching with %s\n", fpu_fxsr ? "fxsave" : "fnsave");
+}
+
+/**
+ * Give a new context a clean FPU state.
+ */
+void fpu_state_init(fpu_state_t *state)
+{
+	memcpy(state, &fpu_initial, sizeof(fpu_state_t));
+}
+
+/**
+ * Make next the running context, to be called on every context switch. Its
+ * state is only loaded once it uses the FPU.
+ */
+void fpu_switch(fpu_state_t *next)
+{
+	if (!fpu_current) {
+		return; // No FPU
+	}
+
+	uint32_t flags = irq_save();
+
+	fpu_current = next;
+	if (fpu_loaded == next) {
+		clts();
+	} else {
+		stts();
+	}
+
+	irq_restore(flags);
+}
+
+/**
+ * Start a section of kernel code using FPU/SSE registers. The running context's
+ * state is saved first and loaded back lazily after kernel_fpu_end(). Interrupts
+ * stay off in between, so keep it short.
+ *
+ * returns: the flags to pass to kernel_fpu_end().
+ */
+uint32_t kernel_fpu_begin(void)
+{
+	uint32_t flags = irq_save();
+
+	clts();
+	if (fpu_loaded) {
+		fpu_save(fpu_loaded);
+		fpu_loaded = NULL;
+	}
+
+	return flags;
+}
+
+void kernel_fpu_end(uint32_t flags)
+{
+	stts();
+	irq_restore(flags);
+}
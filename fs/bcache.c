@@ -0,0 +1,560 @@
+#include "fs/bcache.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "dev/blk.h"
+#include "ds/list.h"
+#include "mem/kmalloc.h"
+#include "string.h"
+#include "cpu.h"
+#include "timer.h"
+#include "debug.h"
+
+// Number of blocks a single bcache_read() puts in flight before it starts copying
+#define BCACHE_READ_CHUNK 128
+
+// Number of distinct queues a single write-back pass keeps plugged
+#define BCACHE_MAX_PLUGGED 8
+
+static bcache_buffer_t *bcache_hash[BCACHE_HASH_SIZE];
+static list_t bcache_lru;	// Least recently used buffer first
+static uint32_t bcache_buffers = 0;
+
+static list_t bcache_dirty;	// Dirty buffers, oldest first
+static uint32_t bcache_dirty_count = 0;
+static volatile uint32_t bcache_writeback_count = 0;
+
+static inline uint32_t bcache_hash_index(blk_queue_t *queue, uint32_t block)
+{
+	return ((((uint32_t)queue) >> 4) ^ (block * 0x9E3779B1)) % BCACHE_HASH_SIZE;
+}
+
+static bcache_buffer_t *bcache_lookup(blk_queue_t *queue, uint32_t block)
+{
+	bcache_buffer_t *buf = bcache_hash[bcache_hash_index(queue, block)];
+
+	while (buf) {
+		if (buf->queue == queue && buf->block == block) {
+			return buf;
+		}
+		buf = buf->hash_next;
+	}
+
+	return NULL;
+}
+
+static void bcache_unhash(bcache_buffer_t *buf)
+{
+	bcache_buffer_t **p = &bcache_hash[bcache_hash_index(buf->queue, buf->block)];
+
+	while (*p) {
+		if (*p == buf) {
+			*p = buf->hash_next;
+			break;
+		}
+		p = &(*p)->hash_next;
+	}
+
+	buf->hash_next = NULL;
+	buf->queue = NULL;
+}
+
+static void bcache_touch(bcache_buffer_t *buf)
+{
+	list_remove(&bcache_lru, &buf->lru_item);
+	list_insert_end(&bcache_lru, &buf->lru_item);
+}
+
+/**
+ * Get an unused buffer, either a fresh one or the least recently used clean and idle one.
+ */
+static bcache_buffer_t *bcache_alloc(blk_queue_t *queue, uint32_t block)
+{
+	bcache_buffer_t *buf = NULL;
+
+	if (bcache_buffers < BCACHE_MAX_BUFFERS) {
+		buf = (bcache_buffer_t *)kmalloc(sizeof(bcache_buffer_t));
+		if (buf) {
+			memset(buf, 0, sizeof(bcache_buffer_t));
+			buf->data = (uint8_t *)kmalloc(BCACHE_BLOCK_SIZE);
+			if (!buf->data) {
+				kfree(buf);
+				buf = NULL;
+			} else {
+				list_insert_end(&bcache_lru, &buf->lru_item);
+				bcache_buffers++;
+			}
+		}
+	}
+
+	if (!buf) {
+		for (list_item_t *i = bcache_lru.first; i != NULL; i = i->next) {
+			bcache_buffer_t *candidate = list_entry(i, bcache_buffer_t, lru_item);
+			if (!(candidate->flags & (BCACHE_FLAG_BUSY | BCACHE_FLAG_DIRTY | BCACHE_FLAG_WRITEBACK))) {
+				buf = candidate;
+				break;
+			}
+		}
+
+		if (!buf) {
+			return NULL;
+		}
+
+		if (buf->queue) {
+			bcache_unhash(buf);
+		}
+	}
+
+	buf->queue = queue;
+	buf->block = block;
+	buf->flags = 0;
+
+	uint32_t index = bcache_hash_index(queue, block);
+	buf->hash_next = bcache_hash[index];
+	bcache_hash[index] = buf;
+
+	bcache_touch(buf);
+
+	return buf;
+}
+
+static void bcache_end_io(blk_request_t *req)
+{
+	bcache_buffer_t *buf = (bcache_buffer_t *)req->private;
+
+	if (req->dir == BLK_READ) {
+		if (req->status == BLK_STATUS_OK) {
+			buf->flags = BCACHE_FLAG_UPTODATE;
+		} else {
+			buf->flags = BCACHE_FLAG_ERROR;
+		}
+		return;
+	}
+
+	// The data stays valid even if the disk didn't take it, bcache_sync() reports the error
+	buf->flags &= ~BCACHE_FLAG_WRITEBACK;
+	if (req->status != BLK_STATUS_OK) {
+		buf->flags |= BCACHE_FLAG_ERROR;
+	}
+	bcache_writeback_count--;
+}
+
+/**
+ * Start reading or writing a buffer's block. The last block of a disk may be short.
+ */
+static void bcache_submit(bcache_buffer_t *buf, uint8_t dir)
+{
+	uint32_t lba = buf->block * BCACHE_BLOCK_SECTORS;
+	uint32_t count = BCACHE_BLOCK_SECTORS;
+
+	if (lba + count > buf->queue->sectors) {
+		count = buf->queue->sectors - lba;
+		if (dir == BLK_READ) {
+			memset(buf->data, 0, BCACHE_BLOCK_SIZE);
+		}
+	}
+
+	memset(&buf->req, 0, sizeof(blk_request_t));
+	buf->req.lba = lba;
+	buf->req.count = count;
+	buf->req.dir = dir;
+	buf->req.buffer = buf->data;
+	buf->req.end_io = &bcache_end_io;
+	buf->req.private = buf;
+
+	if (dir == BLK_READ) {
+		buf->flags = BCACHE_FLAG_BUSY;
+	} else {
+		buf->flags = (buf->flags & ~(BCACHE_FLAG_DIRTY | BCACHE_FLAG_ERROR)) | BCACHE_FLAG_WRITEBACK;
+		bcache_writeback_count++;
+	}
+
+	blk_submit(buf->queue, &buf->req);
+}
+
+/**
+ * Wait for the next interrupt, which may complete some I/O.
+ */
+static void bcache_wait_io(void)
+{
+	__asm__ __volatile__("sti; hlt");
+}
+
+static void bcache_mark_dirty(bcache_buffer_t *buf)
+{
+	if (buf->flags & BCACHE_FLAG_DIRTY) {
+		return;
+	}
+
+	buf->flags |= BCACHE_FLAG_DIRTY;
+	buf->dirty_since = get_timer_ticks();
+	list_insert_end(&bcache_dirty, &buf->dirty_item);
+	bcache_dirty_count++;
+}
+
+static void bcache_clear_dirty(bcache_buffer_t *buf)
+{
+	if (!(buf->flags & BCACHE_FLAG_DIRTY)) {
+		return;
+	}
+
+	buf->flags &= ~BCACHE_FLAG_DIRTY;
+	list_remove(&bcache_dirty, &buf->dirty_item);
+	bcache_dirty_count--;
+}
+
+/**
+ * Start writing back up to max dirty buffers, oldest first. If queue is NULL
+ * buffers of every device are written. With expired_only set only buffers that
+ * have been dirty for BCACHE_DIRTY_EXPIRE ticks are considered.
+ */
+void bcache_writeback(blk_queue_t *queue, uint32_t max, bool expired_only)
+{
+	blk_queue_t *plugged[BCACHE_MAX_PLUGGED];
+	uint32_t nplugged = 0;
+	uint32_t now = get_timer_ticks();
+
+	uint32_t flags = irq_save();
+
+	list_item_t *i = bcache_dirty.first;
+	while (i != NULL && max > 0) {
+		bcache_buffer_t *buf = list_entry(i, bcache_buffer_t, dirty_item);
+		i = i->next;
+
+		if (expired_only && (int32_t)(now - buf->dirty_since) < BCACHE_DIRTY_EXPIRE) {
+			break; // Everything after this one is younger
+		}
+
+		if (queue && buf->queue != queue) {
+			continue;
+		}
+
+		if (buf->flags & BCACHE_FLAG_WRITEBACK) {
+			continue; // Picked up again once the current write finishes
+		}
+
+		// Hold the queue until the whole batch is in so neighbouring blocks get merged
+		uint32_t p;
+		for (p = 0; p < nplugged && plugged[p] != buf->queue; p++);
+		if (p == nplugged && nplugged < BCACHE_MAX_PLUGGED && !buf->queue->plugged) {
+			blk_plug(buf->queue);
+			plugged[nplugged++] = buf->queue;
+		}
+
+		bcache_clear_dirty(buf);
+		bcache_submit(buf, BLK_WRITE);
+		max--;
+	}
+
+	for (uint32_t p = 0; p < nplugged; p++) {
+		blk_unplug(plugged[p]);
+	}
+
+	irq_restore(flags);
+}
+
+/**
+ * Periodic write-back, run from the timer interrupt as there are no kernel
+ * threads. Keeps the dirty count below the background threshold and makes sure
+ * nothing stays dirty for longer than BCACHE_DIRTY_EXPIRE ticks.
+ */
+static void bcache_flush_timer(uint32_t ticks)
+{
+	ticks = ticks; // Suppress compiler warning about unused parameter
+
+	if (bcache_dirty_count > BCACHE_DIRTY_BACKGROUND) {
+		bcache_writeback(NULL, bcache_dirty_count - BCACHE_DIRTY_BACKGROUND, false);
+	}
+
+	bcache_writeback(NULL, bcache_dirty_count, true);
+}
+
+/**
+ * Throttle a writer that dirtied more than the cache can hold back.
+ */
+static void bcache_balance_dirty(void)
+{
+	while (bcache_dirty_count + bcache_writeback_count > BCACHE_DIRTY_LIMIT) {
+		if (bcache_dirty_count > BCACHE_DIRTY_BACKGROUND) {
+			bcache_writeback(NULL, bcache_dirty_count - BCACHE_DIRTY_BACKGROUND, false);
+		}
+		bcache_wait_io();
+	}
+}
+
+/**
+ * Get any buffer for a block, waiting for write-back to free one up if the
+ * cache is full of dirty buffers.
+ */
+static bcache_buffer_t *bcache_alloc_wait(blk_queue_t *queue, uint32_t block)
+{
+	bcache_buffer_t *buf;
+
+	while (!(buf = bcache_alloc(queue, block))) {
+		if (bcache_dirty_count) {
+			bcache_writeback(NULL, bcache_dirty_count, false);
+		}
+		bcache_wait_io();
+	}
+
+	return buf;
+}
+
+static inline bool bcache_block_valid(blk_queue_t *queue, uint32_t block)
+{
+	return block < (queue->sectors + BCACHE_BLOCK_SECTORS - 1) / BCACHE_BLOCK_SECTORS;
+}
+
+/**
+ * Get an up to date buffer for a block, reading it if necessary.
+ *
+ * returns: the buffer or NULL on I/O errors.
+ */
+bcache_buffer_t *bcache_get(blk_queue_t *queue, uint32_t block)
+{
+	if (!bcache_block_valid(queue, block)) {
+		return NULL;
+	}
+
+	bcache_buffer_t *buf = bcache_lookup(queue, block);
+
+	if (!buf) {
+		buf = bcache_alloc_wait(queue, block);
+	} else {
+		bcache_touch(buf);
+	}
+
+	if (buf->flags & BCACHE_FLAG_BUSY) {
+		blk_wait(&buf->req);
+	}
+
+	if (!(buf->flags & BCACHE_FLAG_UPTODATE)) {
+		bcache_submit(buf, BLK_READ);
+		blk_wait(&buf->req);
+	}
+
+	if (!(buf->flags & BCACHE_FLAG_UPTODATE)) {
+		return NULL;
+	}
+
+	return buf;
+}
+
+/**
+ * Start reading count blocks that are not cached yet without waiting for them.
+ * The request queue merges the reads into as few commands as possible.
+ */
+void bcache_prefetch(blk_queue_t *queue, uint32_t block, uint32_t count)
+{
+	bool plug = !queue->plugged;
+
+	if (plug) {
+		blk_plug(queue);
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (!bcache_block_valid(queue, block + i)) {
+			break;
+		}
+
+		if (bcache_lookup(queue, block + i)) {
+			continue;
+		}
+
+		bcache_buffer_t *buf = bcache_alloc(queue, block + i);
+		if (!buf) {
+			break; // Everything is in flight already
+		}
+
+		bcache_submit(buf, BLK_READ);
+	}
+
+	if (plug) {
+		blk_unplug(queue);
+	}
+}
+
+/**
+ * returns: true if any of the blocks is cached, in whatever state.
+ */
+bool bcache_cached(blk_queue_t *queue, uint32_t block, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		if (bcache_lookup(queue, block + i)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Drop cached copies of blocks, e.g. after they were written behind the cache's back.
+ * Dirty data in the range is discarded.
+ */
+void bcache_invalidate(blk_queue_t *queue, uint32_t block, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		bcache_buffer_t *buf = bcache_lookup(queue, block + i);
+		if (!buf) {
+			continue;
+		}
+
+		if (buf->flags & (BCACHE_FLAG_BUSY | BCACHE_FLAG_WRITEBACK)) {
+			blk_wait(&buf->req);
+		}
+
+		uint32_t flags = irq_save();
+		bcache_clear_dirty(buf);
+		irq_restore(flags);
+
+		bcache_unhash(buf);
+		buf->flags = 0;
+
+		// Reuse it first
+		list_remove(&bcache_lru, &buf->lru_item);
+		list_insert_start(&bcache_lru, &buf->lru_item);
+	}
+}
+
+uint32_t bcache_read(blk_queue_t *queue, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	uint32_t done = 0;
+
+	if (size == 0) {
+		return 0;
+	}
+
+	uint32_t block = offset / BCACHE_BLOCK_SIZE;
+	uint32_t last = (offset + size - 1) / BCACHE_BLOCK_SIZE;
+	uint32_t skip = offset % BCACHE_BLOCK_SIZE;
+
+	while (block <= last) {
+		uint32_t chunk = last - block + 1;
+		if (chunk > BCACHE_READ_CHUNK) {
+			chunk = BCACHE_READ_CHUNK;
+		}
+
+		// Put every missing block of this chunk in flight before waiting on the first one
+		bcache_prefetch(queue, block, chunk);
+
+		for (uint32_t i = 0; i < chunk; i++, block++) {
+			bcache_buffer_t *buf = bcache_get(queue, block);
+			if (!buf) {
+				return done;
+			}
+
+			uint32_t len = BCACHE_BLOCK_SIZE - skip;
+			if (len > size - done) {
+				len = size - done;
+			}
+
+			memcpy(buffer + done, buf->data + skip, len);
+			done += len;
+			skip = 0;
+		}
+	}
+
+	return done;
+}
+
+/**
+ * Write through the cache. The data reaches the disk later, from the flusher or
+ * bcache_sync(). Blocks that are overwritten completely are not read first.
+ *
+ * returns: the number of bytes written.
+ */
+uint32_t bcache_write(blk_queue_t *queue, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	uint32_t done = 0;
+
+	uint32_t block = offset / BCACHE_BLOCK_SIZE;
+	uint32_t skip = offset % BCACHE_BLOCK_SIZE;
+
+	while (done < size) {
+		uint32_t len = BCACHE_BLOCK_SIZE - skip;
+		if (len > size - done) {
+			len = size - done;
+		}
+
+		bcache_buffer_t *buf;
+
+		if (len == BCACHE_BLOCK_SIZE) {
+			if (!bcache_block_valid(queue, block)) {
+				break;
+			}
+
+			buf = bcache_lookup(queue, block);
+			if (!buf) {
+				buf = bcache_alloc_wait(queue, block);
+			} else {
+				bcache_touch(buf);
+			}
+
+			// Don't let a pending read overwrite the new data
+			if (buf->flags & BCACHE_FLAG_BUSY) {
+				blk_wait(&buf->req);
+			}
+		} else {
+			buf = bcache_get(queue, block);
+			if (!buf) {
+				break;
+			}
+		}
+
+		// The block can't change while the disk is reading it out of the buffer
+		uint32_t flags = irq_save();
+		while (buf->flags & BCACHE_FLAG_WRITEBACK) {
+			irq_restore(flags);
+			blk_wait(&buf->req);
+			flags = irq_save();
+		}
+
+		memcpy(buf->data + skip, buffer + done, len);
+		buf->flags = (buf->flags & ~BCACHE_FLAG_ERROR) | BCACHE_FLAG_UPTODATE;
+		bcache_mark_dirty(buf);
+		irq_restore(flags);
+
+		done += len;
+		skip = 0;
+		block++;
+	}
+
+	bcache_balance_dirty();
+
+	return done;
+}
+
+/**
+ * Write back every dirty buffer of a device and wait for the writes to finish.
+ *
+ * returns: 0 on success, -1 if any of the writes failed.
+ */
+int bcache_sync(blk_queue_t *queue)
+{
+	int ret = 0;
+
+	bcache_writeback(queue, bcache_dirty_count, false);
+
+	for (list_item_t *i = bcache_lru.first; i != NULL; i = i->next) {
+		bcache_buffer_t *buf = list_entry(i, bcache_buffer_t, lru_item);
+		if (buf->queue != queue) {
+			continue;
+		}
+
+		if (buf->flags & BCACHE_FLAG_WRITEBACK) {
+			blk_wait(&buf->req);
+		}
+
+		if ((buf->flags & BCACHE_FLAG_ERROR) && buf->req.dir == BLK_WRITE) {
+			buf->flags &= ~BCACHE_FLAG_ERROR; // Report it once
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+void bcache_init(void)
+{
+	timer_register_handler(&bcache_flush_timer, BCACHE_FLUSH_INTERVAL);
+}
@@ -0,0 +1,112 @@
+#include "fs/dcache.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+
+// All entries are preallocated so neither lookups nor inserts allocate
+static dcache_entry_t dcache_entries[DCACHE_ENTRIES];
+static dcache_entry_t *dcache_buckets[DCACHE_BUCKETS];
+static uint32_t dcache_next_victim = 0;
+static uint32_t dcache_generation = 1;
+
+/**
+ * FNV-1a over one path component.
+ */
+uint32_t dcache_hash(const char *name, uint32_t len)
+{
+	uint32_t hash = 0x811C9DC5;
+
+	for (uint32_t i = 0; i < len; i++) {
+		hash ^= (uint8_t)name[i];
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+static inline uint32_t dcache_bucket(void *parent, uint32_t hash)
+{
+	return (hash ^ ((uint32_t)parent >> 4)) % DCACHE_BUCKETS;
+}
+
+static void dcache_unlink(dcache_entry_t *entry)
+{
+	dcache_entry_t **p = &dcache_buckets[dcache_bucket(entry->parent, entry->hash)];
+
+	while (*p) {
+		if (*p == entry) {
+			*p = entry->hash_next;
+			break;
+		}
+		p = &(*p)->hash_next;
+	}
+
+	entry->parent = NULL;
+	entry->hash_next = NULL;
+}
+
+/**
+ * Look a component of a path up in the cache.
+ *
+ * returns: true on a hit, with *child set to the cached result (NULL if the
+ * name is known not to exist).
+ */
+bool dcache_lookup(void *parent, const char *name, uint32_t len, uint32_t hash, void **child)
+{
+	if (len >= DCACHE_NAME_MAX) {
+		return false;
+	}
+
+	for (dcache_entry_t *e = dcache_buckets[dcache_bucket(parent, hash)]; e != NULL; e = e->hash_next) {
+		if (e->parent != parent || e->hash != hash || e->len != len || memcmp(e->name, name, len)) {
+			continue;
+		}
+
+		if (!e->child && e->generation != dcache_generation) {
+			// Something may have been mounted under this name since
+			dcache_unlink(e);
+			return false;
+		}
+
+		*child = e->child;
+		return true;
+	}
+
+	return false;
+}
+
+void dcache_insert(void *parent, const char *name, uint32_t len, uint32_t hash, void *child)
+{
+	if (len >= DCACHE_NAME_MAX) {
+		return;
+	}
+
+	// Replace entries round robin, a cheap approximation of LRU for a cache this size
+	dcache_entry_t *entry = &dcache_entries[dcache_next_victim];
+	dcache_next_victim = (dcache_next_victim + 1) % DCACHE_ENTRIES;
+
+	if (entry->parent) {
+		dcache_unlink(entry);
+	}
+
+	entry->parent = parent;
+	entry->child = child;
+	entry->hash = hash;
+	entry->generation = dcache_generation;
+	entry->len = len;
+	memcpy(entry->name, name, len);
+	entry->name[len] = '\0';
+
+	uint32_t bucket = dcache_bucket(parent, hash);
+	entry->hash_next = dcache_buckets[bucket];
+	dcache_buckets[bucket] = entry;
+}
+
+/**
+ * Forget every negative entry, e.g. because something was mounted. Positive
+ * entries stay valid as nodes are never removed from the tree.
+ */
+void dcache_invalidate_negative(void)
+{
+	dcache_generation++;
+}
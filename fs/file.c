@@ -0,0 +1,235 @@
+#include "fs/file.h"
+#include "fs/vfs.h"
+#include "fs/readahead.h"
+#include "stdint.h"
+#include "stddef.h"
+#include "mem/kmalloc.h"
+#include "string.h"
+
+static file_t *fd_table[FILE_MAX_FDS];
+
+static int fd_alloc(file_t *file)
+{
+	for (int fd = 0; fd < FILE_MAX_FDS; fd++) {
+		if (!fd_table[fd]) {
+			fd_table[fd] = file;
+			file->refcount++;
+			return fd;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * returns: the open file behind fd, NULL if fd isn't open.
+ */
+file_t *file_get(int fd)
+{
+	if (fd < 0 || fd >= FILE_MAX_FDS) {
+		return NULL;
+	}
+
+	return fd_table[fd];
+}
+
+/**
+ * Create the last component of path in its parent directory.
+ *
+ * returns: the new node, NULL if the parent doesn't exist or can't create it.
+ */
+static vfs_node_t *file_create(const char *path)
+{
+	int len = strlen(path);
+	int slash = len - 1;
+	while (slash > 0 && path[slash] != '/') {
+		slash--;
+	}
+
+	const char *name = path + slash + 1;
+	if (!*name || len - slash - 1 > VFS_NAME_MAX) {
+		return NULL;
+	}
+
+	vfs_node_t *dir;
+	if (slash == 0) {
+		dir = kopen("/");
+	} else {
+		char *parent = (char *)kmalloc(slash + 1);
+		if (!parent) {
+			return NULL;
+		}
+		memcpy(parent, path, slash);
+		parent[slash] = '\0';
+		dir = kopen(parent);
+		kfree(parent);
+	}
+
+	if (!dir || dir->mask != VFS_MASK_DIR) {
+		return NULL;
+	}
+
+	return vfs_create(dir, name, VFS_MASK_FILE);
+}
+
+/**
+ * Open path, resolving it once for all later calls on the descriptor.
+ *
+ * returns: the descriptor, -1 if the file doesn't exist (and O_CREAT wasn't
+ * given), all descriptors are in use or out of memory.
+ */
+int file_open(const char *path, uint32_t flags)
+{
+	vfs_node_t *node = kopen((char *)path);
+	if (!node && (flags & O_CREAT)) {
+		node = file_create(path);
+	}
+	if (!node) {
+		return -1;
+	}
+
+	if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY) {
+		vfs_truncate(node, 0);
+	}
+
+	file_t *file = (file_t *)kmalloc(sizeof(file_t));
+	if (!file) {
+		return -1;
+	}
+	file->node = node;
+	file->private = node->device;
+	file->pos = 0;
+	file->flags = flags;
+	file->refcount = 0;
+	ra_init(&file->ra);
+
+	int fd = fd_alloc(file);
+	if (fd < 0) {
+		kfree(file);
+	}
+
+	return fd;
+}
+
+/**
+ * Release a descriptor. The open file goes away with the last one.
+ *
+ * returns: 0 on success, -1 if fd isn't open.
+ */
+int file_close(int fd)
+{
+	file_t *file = file_get(fd);
+	if (!file) {
+		return -1;
+	}
+
+	fd_table[fd] = NULL;
+	if (--file->refcount == 0) {
+		kfree(file);
+	}
+
+	return 0;
+}
+
+/**
+ * Read from the current position and advance it. Sequential reads through the
+ * same open file prefetch ahead of themselves.
+ *
+ * returns: the number of bytes read, -1 if fd isn't open for reading.
+ */
+int32_t file_read(int fd, void *buffer, uint32_t size)
+{
+	file_t *file = file_get(fd);
+	if (!file || (file->flags & O_ACCMODE) == O_WRONLY) {
+		return -1;
+	}
+
+	if (file->node->mask == VFS_MASK_FILE) {
+		if (file->pos >= file->node->length) {
+			return 0;
+		}
+		if (size > file->node->length - file->pos) {
+			size = file->node->length - file->pos;
+		}
+	}
+
+	uint32_t ret = vfs_read_ra(file->node, file->private, &file->ra, file->pos, size, (uint8_t *)buffer);
+	file->pos += ret;
+
+	return ret;
+}
+
+/**
+ * Write at the current position (or the end with O_APPEND) and advance it.
+ *
+ * returns: the number of bytes written, -1 if fd isn't open for writing.
+ */
+int32_t file_write(int fd, const void *buffer, uint32_t size)
+{
+	file_t *file = file_get(fd);
+	if (!file || (file->flags & O_ACCMODE) == O_RDONLY) {
+		return -1;
+	}
+
+	if (file->flags & O_APPEND) {
+		file->pos = file->node->length;
+	}
+
+	uint32_t ret = vfs_write(file->node, file->pos, size, (uint8_t *)buffer);
+	file->pos += ret;
+
+	return ret;
+}
+
+/**
+ * Move the position of an open file. Seeking past the end is allowed, a write
+ * there grows the file.
+ *
+ * returns: the new position, -1 on a bad descriptor, whence or resulting position.
+ */
+int32_t file_seek(int fd, int32_t offset, int whence)
+{
+	file_t *file = file_get(fd);
+	if (!file) {
+		return -1;
+	}
+
+	uint32_t base;
+	switch (whence) {
+		case SEEK_SET:
+			base = 0;
+			break;
+		case SEEK_CUR:
+			base = file->pos;
+			break;
+		case SEEK_END:
+			base = file->node->length;
+			break;
+		default:
+			return -1;
+	}
+
+	if (offset < 0 && 0u - (uint32_t)offset > base) {
+		return -1;
+	}
+
+	file->pos = base + offset;
+
+	return file->pos;
+}
+
+/**
+ * Duplicate a descriptor. Both refer to the same open file and share its
+ * position and read-ahead state.
+ *
+ * returns: the lowest free descriptor, -1 if fd isn't open or none is free.
+ */
+int file_dup(int fd)
+{
+	file_t *file = file_get(fd);
+	if (!file) {
+		return -1;
+	}
+
+	return fd_alloc(file);
+}
@@ -0,0 +1,317 @@
+#define LOG_SUBSYS LOG_SYS_VFS
+
+#include "fs/initrd.h"
+#include "fs/vfs.h"
+#include "multiboot.h"
+#include "ds/hashtable.h"
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include "mem/kmalloc.h"
+#include "string.h"
+#include "debug.h"
+
+#define INITRD_NODE(n) container_of(n, initrd_node_t, dirent.node)
+
+static initrd_module_t initrd_modules[INITRD_MAX_MODULES];
+static uint32_t initrd_module_count = 0;
+static uint32_t initrd_next_inode = 1;
+
+static const vfs_ops_t initrd_file_ops;
+static const vfs_ops_t initrd_dir_ops;
+
+/**
+ * Remember where the boot loader put its modules before anything allocates
+ * memory. The modules are used in place, so the memory they occupy must stay
+ * out of the allocators' hands.
+ *
+ * returns: the end of the highest module, 0 if there are none.
+ */
+uintptr_t initrd_reserve(struct multiboot *mboot)
+{
+	uintptr_t end = 0;
+
+	if (!(mboot->flags & MULTIBOOT_FLAG_MODS)) {
+		return 0;
+	}
+
+	multiboot_module_t *mods = (multiboot_module_t *)mboot->mods_addr;
+	for (uint32_t i = 0; i < mboot->mods_count && initrd_module_count < INITRD_MAX_MODULES; i++) {
+		initrd_module_t *mod = &initrd_modules[initrd_module_count++];
+		mod->start = mods[i].mod_start;
+		mod->end = mods[i].mod_end;
+
+		const char *cmdline = (const char *)mods[i].cmdline;
+		uint32_t len = 0;
+		if (cmdline) {
+			// The path is the first word after the module's file name, if any
+			while (*cmdline && *cmdline != ' ') {
+				cmdline++;
+			}
+			while (*cmdline == ' ') {
+				cmdline++;
+			}
+			while (cmdline[len] && cmdline[len] != ' ' && len < sizeof(mod->path) - 1) {
+				mod->path[len] = cmdline[len];
+				len++;
+			}
+		}
+		mod->path[len] = '\0';
+
+		if (mod->end > end) {
+			end = mod->end;
+		}
+	}
+
+	return (end + 0xFFF) & ~0xFFF;
+}
+
+static uint32_t tar_parse_octal(const char *field, uint32_t size)
+{
+	uint32_t value = 0;
+
+	for (uint32_t i = 0; i < size && field[i] >= '0' && field[i] <= '7'; i++) {
+		value = value * 8 + (field[i] - '0');
+	}
+
+	return value;
+}
+
+/**
+ * returns: the new node, NULL when out of memory.
+ */
+static initrd_node_t *initrd_node_alloc(const char *name, uint32_t mask)
+{
+	initrd_node_t *node = (initrd_node_t *)kmalloc(sizeof(initrd_node_t));
+	if (node == NULL) {
+		log_err("INITRD: Out of memory\n");
+		return NULL;
+	}
+	memset(node, 0, sizeof(initrd_node_t));
+
+	node->dirent.fname = vfs_intern(name);
+	if (node->dirent.fname == NULL) {
+		log_err("INITRD: Out of memory\n");
+		kfree(node);
+		return NULL;
+	}
+
+	node->dirent.node.mask = mask;
+	node->dirent.node.flags = 0x555;
+	node->dirent.node.inode = initrd_next_inode++;
+
+	if (mask == VFS_MASK_DIR) {
+		node->dirent.node.ops = &initrd_dir_ops;
+		node->children = hashtable_create(INITRD_DIR_SIZE);
+	} else {
+		node->dirent.node.ops = &initrd_file_ops;
+	}
+
+	return node;
+}
+
+/**
+ * Find or create the child of dir. An existing entry of the wrong type makes
+ * the path unusable.
+ *
+ * returns: the child, NULL if the path is unusable or memory ran out.
+ */
+static initrd_node_t *initrd_child(initrd_node_t *dir, const char *name, uint32_t mask)
+{
+	initrd_node_t *node = (initrd_node_t *)hashtable_lookup_value(dir->children, (char *)name);
+
+	if (node) {
+		return node->dirent.node.mask == mask ? node : NULL;
+	}
+
+	node = initrd_node_alloc(name, mask);
+	if (node == NULL) {
+		return NULL;
+	}
+	if (hashtable_insert(dir->children, (char *)node->dirent.fname, 0, node) != 0) {
+		log_err("INITRD: Out of memory\n");
+		if (node->children) {
+			hashtable_destroy(node->children);
+		}
+		vfs_intern_put(node->dirent.fname);
+		kfree(node);
+		return NULL;
+	}
+	node->dirent.next = dir->first_child;
+	dir->first_child = &node->dirent;
+
+	return node;
+}
+
+/**
+ * Add a tar member under root, creating the directories on its path.
+ */
+static initrd_node_t *initrd_add(initrd_node_t *root, char *path, uint32_t mask)
+{
+	initrd_node_t *dir = root;
+	char *name = path;
+
+	while (dir) {
+		while (*name == '/') {
+			name++;
+		}
+
+		char *slash = name;
+		while (*slash && *slash != '/') {
+			slash++;
+		}
+
+		bool last = true;
+		for (char *c = slash; *c; c++) {
+			if (*c != '/') {
+				last = false;
+				break;
+			}
+		}
+		*slash = '\0';
+
+		if (!*name || !strcmp(name, ".")) {
+			if (last) {
+				return dir;
+			}
+		} else if (last) {
+			return initrd_child(dir, name, mask);
+		} else {
+			dir = initrd_child(dir, name, VFS_MASK_DIR);
+		}
+
+		name = slash + 1;
+	}
+
+	return NULL;
+}
+
+/**
+ * Index a ustar archive. Only the headers are read, file nodes point straight
+ * at their data in the module.
+ */
+static initrd_node_t *initrd_load_tar(initrd_module_t *mod)
+{
+	initrd_node_t *root = initrd_node_alloc("/", VFS_MASK_DIR);
+	if (root == NULL) {
+		return NULL;
+	}
+
+	char path[INITRD_PATH_MAX];
+	uint32_t files = 0;
+
+	uintptr_t pos = mod->start;
+	while (pos + TAR_BLOCK_SIZE <= mod->end) {
+		tar_header_t *header = (tar_header_t *)pos;
+		if (!header->name[0]) {
+			break; // End of archive
+		}
+
+		uint32_t size = tar_parse_octal(header->size, sizeof(header->size));
+		uintptr_t data = pos + TAR_BLOCK_SIZE;
+		if (data + size < data || data + size > mod->end) {
+			log_err("INITRD: Truncated archive at 0x%x\n", pos);
+			break;
+		}
+
+		// ustar splits long names into a prefix and a name, neither terminated when full
+		uint32_t len = 0;
+		if (!memcmp(header->magic, "ustar", 5)) {
+			for (uint32_t i = 0; i < sizeof(header->prefix) && header->prefix[i]; i++) {
+				path[len++] = header->prefix[i];
+			}
+			if (len) {
+				path[len++] = '/';
+			}
+		}
+		for (uint32_t i = 0; i < sizeof(header->name) && header->name[i]; i++) {
+			path[len++] = header->name[i];
+		}
+		path[len] = '\0';
+
+		if (header->type == TAR_TYPE_DIR) {
+			initrd_add(root, path, VFS_MASK_DIR);
+		} else if (header->type == TAR_TYPE_FILE || header->type == '\0') {
+			initrd_node_t *file = initrd_add(root, path, VFS_MASK_FILE);
+			if (file) {
+				file->dirent.node.device = (void *)data;
+				file->dirent.node.length = size;
+				files++;
+			}
+		}
+
+		pos = data + ((size + TAR_BLOCK_SIZE - 1) & ~(TAR_BLOCK_SIZE - 1));
+	}
+
+	debug("INITRD: %d files in 0x%x - 0x%x\n", files, mod->start, mod->end);
+
+	return root;
+}
+
+static uint32_t initrd_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	if (offset >= node->length) {
+		return 0;
+	}
+	if (size > node->length - offset) {
+		size = node->length - offset;
+	}
+
+	memcpy(buffer, (uint8_t *)node->device + offset, size);
+
+	return size;
+}
+
+/**
+ * returns: the index'th entry of the directory, NULL past the last one.
+ */
+static vfs_dirent_t *initrd_read_dir(vfs_dir_t *dir, uint32_t index)
+{
+	vfs_dirent_t *dirent = INITRD_NODE(&dir->node)->first_child;
+
+	while (dirent && index--) {
+		dirent = dirent->next;
+	}
+
+	return dirent;
+}
+
+static vfs_dirent_t *initrd_find_dir(vfs_dir_t *dir, char *fname)
+{
+	return (vfs_dirent_t *)hashtable_lookup_value(INITRD_NODE(&dir->node)->children, fname);
+}
+
+static const vfs_ops_t initrd_file_ops = {
+	.read = initrd_read,
+};
+
+static const vfs_ops_t initrd_dir_ops = {
+	.read_dir = initrd_read_dir,
+	.find_dir = initrd_find_dir,
+};
+
+/**
+ * Mount every boot module as a read-only tree, at the path given on its
+ * command line or at /initrd.
+ */
+void initrd_init()
+{
+	for (uint32_t i = 0; i < initrd_module_count; i++) {
+		initrd_module_t *mod = &initrd_modules[i];
+
+		if (mod->path[0] != '/') {
+			memcpy(mod->path, "/initrd", 8);
+			if (i > 0) {
+				mod->path[7] = '0' + i;
+				mod->path[8] = '\0';
+			}
+		}
+
+		initrd_node_t *root = initrd_load_tar(mod);
+		if (root == NULL) {
+			log_err("INITRD: Not mounting %s\n", mod->path);
+			continue;
+		}
+		vfs_mount(mod->path, &root->dirent.node);
+	}
+}
@@ -0,0 +1,270 @@
+#define LOG_SUBSYS LOG_SYS_VFS
+
+#include "fs/mmap.h"
+#include "fs/pagecache.h"
+#include "fs/vfs.h"
+#include "ds/list.h"
+#include "ds/radix.h"
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include "cpu.h"
+#include "mem/kmalloc.h"
+#include "mem/paging.h"
+#include "string.h"
+#include "debug.h"
+
+#define MMAP_PAGE_SIZE 0x1000
+
+#define PF_PRESENT 0x1	// Protection violation rather than a missing page
+#define PF_WRITE   0x2
+
+extern page_directory_t *current_directory;
+
+static list_t vm_areas;
+
+static vm_area_t *vm_area_find(uintptr_t address)
+{
+	list_foreach(&vm_areas, i) {
+		vm_area_t *vma = list_entry(i, vm_area_t, item);
+		if (address < vma->start) {
+			break;
+		}
+		if (address < vma->end) {
+			return vma;
+		}
+	}
+
+	return NULL;
+}
+
+static inline void mmap_invalidate(uintptr_t address)
+{
+	asm volatile ("invlpg (%0)" :: "r"(address) : "memory");
+}
+
+/**
+ * Map a node into the address space. Nothing is read until the pages are
+ * touched, and every mapping of a page shares the same cached copy.
+ *
+ * returns: the address of the mapping, NULL on failure.
+ */
+void *vfs_mmap(vfs_node_t *node, uint32_t offset, uint32_t length, uint32_t prot, uint32_t flags)
+{
+	if (length == 0 || offset % MMAP_PAGE_SIZE || !(flags & (MAP_SHARED | MAP_PRIVATE))) {
+		return NULL;
+	}
+	if (node->mask == VFS_MASK_DIR || node->length == 0) {
+		return NULL; // Also keeps streams like pipes out
+	}
+	if (!node->ops->get_page && !node->ops->read) {
+		return NULL;
+	}
+
+	length = (length + MMAP_PAGE_SIZE - 1) & ~(MMAP_PAGE_SIZE - 1);
+
+	vm_area_t *vma = (vm_area_t *)kmalloc(sizeof(vm_area_t));
+	if (!vma) {
+		return NULL;
+	}
+	memset(vma, 0, sizeof(vm_area_t));
+	vma->node = node;
+	vma->offset = offset;
+	vma->prot = prot;
+	vma->flags = flags;
+	radix_init(&vma->copies);
+
+	if (!node->ops->get_page && !pagecache_create(node)) {
+		kfree(vma);
+		return NULL;
+	}
+
+	uint32_t irq = irq_save();
+
+	// First fit between the existing areas
+	uintptr_t start = MMAP_BASE;
+	list_item_t *next = NULL;
+	list_foreach(&vm_areas, i) {
+		vm_area_t *area = list_entry(i, vm_area_t, item);
+		if (area->start - start >= length) {
+			next = i;
+			break;
+		}
+		start = area->end;
+	}
+
+	if (!next && MMAP_END - start < length) {
+		irq_restore(irq);
+		kfree(vma);
+		return NULL;
+	}
+
+	vma->start = start;
+	vma->end = start + length;
+
+	if (next) {
+		list_insert_before(&vm_areas, &vma->item, next);
+	} else {
+		list_insert_end(&vm_areas, &vma->item);
+	}
+
+	node->mappings++;
+
+	irq_restore(irq);
+
+	return (void *)vma->start;
+}
+
+/**
+ * Write the dirty pages of a shared mapping back to its node. Filesystems
+ * handing out their own pages are always up to date.
+ */
+static int vm_area_sync(vm_area_t *vma, uintptr_t start, uintptr_t end)
+{
+	int ret = 0;
+	vfs_node_t *node = vma->node;
+
+	for (uintptr_t address = start; address < end; address += MMAP_PAGE_SIZE) {
+		page_t *page = get_page(address, 1, current_directory);
+		if (!page->present || !page->dirty) {
+			continue;
+		}
+
+		page->dirty = 0;
+		mmap_invalidate(address);
+
+		if (!(vma->flags & MAP_SHARED) || node->ops->get_page) {
+			continue;
+		}
+
+		uint32_t offset = vma->offset + (address - vma->start);
+		if (offset >= node->length) {
+			continue; // Mappings don't extend the file
+		}
+
+		uint32_t size = node->length - offset;
+		if (size > MMAP_PAGE_SIZE) {
+			size = MMAP_PAGE_SIZE;
+		}
+
+		if (!node->ops->write || node->ops->write(node, offset, size, (uint8_t *)address) != size) {
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Write back a range of a shared mapping.
+ *
+ * returns: 0 on success, -1 if the range isn't mapped or a write failed.
+ */
+int vfs_msync(void *addr, uint32_t length)
+{
+	uintptr_t start = (uintptr_t)addr & ~(MMAP_PAGE_SIZE - 1);
+	uintptr_t end = (uintptr_t)addr + length;
+
+	vm_area_t *vma = vm_area_find(start);
+	if (!vma || end > vma->end) {
+		return -1;
+	}
+
+	return vm_area_sync(vma, start, end);
+}
+
+/**
+ * Remove a whole mapping, writing back what was written through it. The
+ * node's page cache goes away with its last mapping.
+ *
+ * returns: 0 on success, -1 if addr and length don't describe a mapping.
+ */
+int vfs_munmap(void *addr, uint32_t length)
+{
+	vm_area_t *vma = vm_area_find((uintptr_t)addr);
+
+	length = (length + MMAP_PAGE_SIZE - 1) & ~(MMAP_PAGE_SIZE - 1);
+	if (!vma || vma->start != (uintptr_t)addr || vma->end - vma->start != length) {
+		return -1;
+	}
+
+	int ret = vm_area_sync(vma, vma->start, vma->end);
+
+	for (uintptr_t address = vma->start; address < vma->end; address += MMAP_PAGE_SIZE) {
+		page_t *page = get_page(address, 1, current_directory);
+		memset(page, 0, sizeof(page_t));
+		mmap_invalidate(address);
+	}
+
+	radix_truncate(&vma->copies, 0, &page_free);
+
+	uint32_t irq = irq_save();
+	list_remove(&vm_areas, &vma->item);
+	bool last = --vma->node->mappings == 0;
+	irq_restore(irq);
+
+	// Every mapping was written back when it went away. If that failed the
+	// cache keeps the only up to date copy.
+	if (last && ret == 0) {
+		pagecache_destroy(vma->node);
+	}
+
+	kfree(vma);
+
+	return ret;
+}
+
+/**
+ * Called for every page fault. Missing pages of a mapping are mapped to the
+ * node's cached page, writes to private mappings get their own copy.
+ *
+ * returns: true if the fault was handled and the access can be retried.
+ */
+bool vfs_mmap_fault(uintptr_t address, uint32_t err_code)
+{
+	vm_area_t *vma = vm_area_find(address);
+	if (!vma) {
+		return false;
+	}
+
+	bool write = err_code & PF_WRITE;
+	if (write && !(vma->prot & PROT_WRITE)) {
+		return false;
+	}
+
+	address &= ~(MMAP_PAGE_SIZE - 1);
+	uint32_t index = (address - vma->start) / MMAP_PAGE_SIZE;
+	page_t *page = get_page(address, 1, current_directory);
+
+	if (err_code & PF_PRESENT) {
+		// Only private pages are mapped read-only while the area is writable
+		if (!write || !(vma->flags & MAP_PRIVATE)) {
+			return false;
+		}
+
+		void *copy = page_alloc();
+		if (!copy || radix_insert(&vma->copies, index, copy) != 0) {
+			return false;
+		}
+		memcpy(copy, (void *)address, MMAP_PAGE_SIZE);
+
+		page->frame = virt_to_phys((uintptr_t)copy) / MMAP_PAGE_SIZE;
+		page->rw = 1;
+	} else {
+		void *data = pagecache_get(vma->node, (vma->offset / MMAP_PAGE_SIZE) + index);
+		if (!data) {
+			log_warn("MMAP: Access past the end of the mapped node at 0x%x\n", address);
+			return false;
+		}
+
+		page->frame = virt_to_phys((uintptr_t)data) / MMAP_PAGE_SIZE;
+		page->rw = (vma->flags & MAP_SHARED) && (vma->prot & PROT_WRITE);
+		page->user = 0;
+		page->dirty = 0;
+		page->present = 1;
+	}
+
+	mmap_invalidate(address);
+
+	return true;
+}
@@ -0,0 +1,163 @@
+#include "fs/pagecache.h"
+#include "fs/vfs.h"
+#include "ds/radix.h"
+#include "stdint.h"
+#include "stddef.h"
+#include "mem/kmalloc.h"
+#include "mem/paging.h"
+#include "string.h"
+
+page_cache_t *pagecache_create(vfs_node_t *node)
+{
+	if (!node->cache) {
+		page_cache_t *cache = (page_cache_t *)kmalloc(sizeof(page_cache_t));
+		if (!cache) {
+			return NULL;
+		}
+
+		radix_init(&cache->pages);
+
+		node->cache = cache;
+	}
+
+	return node->cache;
+}
+
+/**
+ * Get the page holding a part of the node, reading it in on a miss. Filesystems
+ * that keep their data in pages hand those out directly instead.
+ *
+ * returns: a page aligned page, NULL past the end of the node or when out of memory.
+ */
+void *pagecache_get(vfs_node_t *node, uint32_t index)
+{
+	if (node->ops->get_page) {
+		return node->ops->get_page(node, index);
+	}
+
+	if (index >= (node->length + PAGECACHE_PAGE_SIZE - 1) / PAGECACHE_PAGE_SIZE) {
+		return NULL;
+	}
+
+	page_cache_t *cache = pagecache_create(node);
+	if (!cache) {
+		return NULL;
+	}
+
+	void *page = radix_lookup(&cache->pages, index);
+	if (page) {
+		return page;
+	}
+
+	page = page_alloc();
+	if (!page) {
+		return NULL;
+	}
+
+	uint32_t offset = index * PAGECACHE_PAGE_SIZE;
+	uint32_t size = node->length - offset;
+	if (size > PAGECACHE_PAGE_SIZE) {
+		size = PAGECACHE_PAGE_SIZE;
+	}
+	if (node->ops->read) {
+		node->ops->read(node, offset, size, (uint8_t *)page);
+	}
+
+	if (radix_insert(&cache->pages, index, page) != 0) {
+		page_free(page);
+		return NULL;
+	}
+
+	return page;
+}
+
+uint32_t pagecache_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	if (offset >= node->length) {
+		return 0;
+	}
+	if (size > node->length - offset) {
+		size = node->length - offset;
+	}
+
+	uint32_t done = 0;
+	while (done < size) {
+		uint32_t pos = offset + done;
+		uint32_t in_page = pos % PAGECACHE_PAGE_SIZE;
+		uint32_t chunk = PAGECACHE_PAGE_SIZE - in_page;
+		if (chunk > size - done) {
+			chunk = size - done;
+		}
+
+		uint8_t *page = (uint8_t *)pagecache_get(node, pos / PAGECACHE_PAGE_SIZE);
+		if (!page) {
+			break;
+		}
+
+		memcpy(buffer + done, page + in_page, chunk);
+		done += chunk;
+	}
+
+	return done;
+}
+
+/**
+ * Copy data that was just written to the node into the pages already cached,
+ * so mappings see it. Pages that aren't cached are left alone.
+ */
+void pagecache_update(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	page_cache_t *cache = node->cache;
+
+	for (uint32_t done = 0; done < size; ) {
+		uint32_t pos = offset + done;
+		uint32_t in_page = pos % PAGECACHE_PAGE_SIZE;
+		uint32_t chunk = PAGECACHE_PAGE_SIZE - in_page;
+		if (chunk > size - done) {
+			chunk = size - done;
+		}
+
+		uint8_t *page = (uint8_t *)radix_lookup(&cache->pages, pos / PAGECACHE_PAGE_SIZE);
+		if (page) {
+			memcpy(page + in_page, buffer + done, chunk);
+		}
+
+		done += chunk;
+	}
+}
+
+/**
+ * Drop the cached pages past a new end of the node, unless they are mapped.
+ */
+void pagecache_truncate(vfs_node_t *node, uint32_t length)
+{
+	page_cache_t *cache = node->cache;
+
+	if (!cache || node->mappings) {
+		return;
+	}
+
+	radix_truncate(&cache->pages, (length + PAGECACHE_PAGE_SIZE - 1) / PAGECACHE_PAGE_SIZE, &page_free);
+
+	uint8_t *page = (uint8_t *)radix_lookup(&cache->pages, length / PAGECACHE_PAGE_SIZE);
+	if (page && length % PAGECACHE_PAGE_SIZE) {
+		memset(page + length % PAGECACHE_PAGE_SIZE, 0, PAGECACHE_PAGE_SIZE - length % PAGECACHE_PAGE_SIZE);
+	}
+}
+
+/**
+ * Free the cache of a node that isn't mapped anymore. Writes always reach the
+ * node itself as well, so once the mappings are written back nothing is lost.
+ */
+void pagecache_destroy(vfs_node_t *node)
+{
+	page_cache_t *cache = node->cache;
+
+	if (!cache || node->mappings) {
+		return;
+	}
+
+	node->cache = NULL;
+	radix_truncate(&cache->pages, 0, &page_free);
+	kfree(cache);
+}
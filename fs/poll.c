@@ -0,0 +1,212 @@
+#include "fs/poll.h"
+#include "fs/vfs.h"
+#include "ds/list.h"
+#include "stdint.h"
+#include "stddef.h"
+#include "cpu.h"
+#include "timer.h"
+#include "mem/kmalloc.h"
+#include "string.h"
+
+typedef struct poll_entry {
+	list_item_t watch_item;	// In poll_watchers
+	list_item_t ready_item;	// In the set's ready list while revents != 0
+	pollset_t *set;
+	vfs_node_t *node;
+	uint32_t events;		// Interest
+	uint32_t revents;		// Not yet reported by pollset_wait()
+	void *data;
+} poll_entry_t;
+
+struct pollset {
+	list_t ready;
+};
+
+// Every entry of every set. Notifications come from interrupt handlers, so it is
+// only touched with interrupts off.
+static list_t poll_watchers;
+
+/**
+ * returns: the POLL* bits node is ready for right now. Nodes without a poll
+ * operation never block.
+ */
+uint32_t vfs_poll(vfs_node_t *node)
+{
+	if (node->ops->poll) {
+		return node->ops->poll(node);
+	}
+
+	return POLLIN | POLLOUT;
+}
+
+static void poll_entry_signal(poll_entry_t *entry, uint32_t events)
+{
+	events &= entry->events | POLLERR | POLLHUP;
+	if (!events) {
+		return;
+	}
+
+	if (!entry->revents) {
+		list_insert_end(&entry->set->ready, &entry->ready_item);
+	}
+	entry->revents |= events;
+}
+
+/**
+ * Called by drivers when node becomes ready for events. Interested sets see the
+ * transition once (edge triggered), whatever the node's state is later on.
+ */
+void vfs_poll_notify(vfs_node_t *node, uint32_t events)
+{
+	uint32_t flags = irq_save();
+
+	list_foreach(&poll_watchers, i) {
+		poll_entry_t *entry = list_entry(i, poll_entry_t, watch_item);
+		if (entry->node == node) {
+			poll_entry_signal(entry, events);
+		}
+	}
+
+	irq_restore(flags);
+}
+
+pollset_t *pollset_create()
+{
+	pollset_t *set = (pollset_t *)kmalloc(sizeof(pollset_t));
+	memset(set, 0, sizeof(pollset_t));
+
+	return set;
+}
+
+static poll_entry_t *pollset_find(pollset_t *set, vfs_node_t *node)
+{
+	list_foreach(&poll_watchers, i) {
+		poll_entry_t *entry = list_entry(i, poll_entry_t, watch_item);
+		if (entry->set == set && entry->node == node) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static void pollset_unlink(poll_entry_t *entry)
+{
+	list_remove(&poll_watchers, &entry->watch_item);
+	if (entry->revents) {
+		list_remove(&entry->set->ready, &entry->ready_item);
+	}
+}
+
+void pollset_destroy(pollset_t *set)
+{
+	uint32_t flags = irq_save();
+
+	list_item_t *i = poll_watchers.first;
+	while (i) {
+		poll_entry_t *entry = list_entry(i, poll_entry_t, watch_item);
+		i = i->next;
+		if (entry->set == set) {
+			pollset_unlink(entry);
+			kfree(entry);
+		}
+	}
+
+	irq_restore(flags);
+
+	kfree(set);
+}
+
+/**
+ * Watch node for events. If it is ready already it is reported by the next
+ * pollset_wait(), after that only on new notifications.
+ *
+ * returns: 0 on success, -1 if node is already in the set.
+ */
+int pollset_add(pollset_t *set, vfs_node_t *node, uint32_t events, void *data)
+{
+	poll_entry_t *entry = (poll_entry_t *)kmalloc(sizeof(poll_entry_t));
+	memset(entry, 0, sizeof(poll_entry_t));
+	entry->set = set;
+	entry->node = node;
+	entry->events = events;
+	entry->data = data;
+
+	uint32_t flags = irq_save();
+
+	if (pollset_find(set, node)) {
+		irq_restore(flags);
+		kfree(entry);
+		return -1;
+	}
+
+	list_insert_end(&poll_watchers, &entry->watch_item);
+	poll_entry_signal(entry, vfs_poll(node));
+
+	irq_restore(flags);
+
+	return 0;
+}
+
+/**
+ * returns: 0 on success, -1 if node isn't in the set.
+ */
+int pollset_remove(pollset_t *set, vfs_node_t *node)
+{
+	uint32_t flags = irq_save();
+
+	poll_entry_t *entry = pollset_find(set, node);
+	if (entry) {
+		pollset_unlink(entry);
+	}
+
+	irq_restore(flags);
+
+	if (!entry) {
+		return -1;
+	}
+
+	kfree(entry);
+
+	return 0;
+}
+
+static uint32_t pollset_collect(pollset_t *set, poll_event_t *events, uint32_t max)
+{
+	uint32_t n = 0;
+
+	while (n < max && set->ready.first) {
+		poll_entry_t *entry = list_entry(set->ready.first, poll_entry_t, ready_item);
+		list_remove(&set->ready, &entry->ready_item);
+
+		events[n].events = entry->revents;
+		events[n].data = entry->data;
+		entry->revents = 0;
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ * Take up to max events off the ready list, waiting up to timeout milliseconds
+ * (forever if negative) for the first one. Each event is reported once, drain
+ * the node before waiting again.
+ *
+ * returns: the number of events stored.
+ */
+int pollset_wait(pollset_t *set, poll_event_t *events, uint32_t max, int32_t timeout)
+{
+	uint32_t start = get_timer_ticks();
+	uint32_t ticks = timeout >= 0 ? timer_ms_to_ticks(timeout) : 0;
+
+	while (1) {
+		__asm__ __volatile__ ("cli");
+		uint32_t n = pollset_collect(set, events, max);
+		if (n || max == 0 || (timeout >= 0 && get_timer_ticks() - start >= ticks)) {
+			__asm__ __volatile__ ("sti");
+			return n;
+		}
+		__asm__ __volatile__ ("sti; hlt");
+	}
+}
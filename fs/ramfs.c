@@ -0,0 +1,307 @@
+#include "fs/ramfs.h"
+#include "fs/vfs.h"
+#include "ds/radix.h"
+#include "ds/hashtable.h"
+#include "stdint.h"
+#include "stddef.h"
+#include "mem/kmalloc.h"
+#include "mem/paging.h"
+#include "string.h"
+#include "debug.h"
+
+#define RAMFS_NODE(n) container_of(n, ramfs_node_t, dirent.node)
+
+static uint32_t ramfs_next_inode = 1;
+
+static const vfs_ops_t ramfs_file_ops;
+static const vfs_ops_t ramfs_dir_ops;
+
+static ramfs_node_t *ramfs_node_alloc(ramfs_node_t *parent, const char *name, uint32_t mask)
+{
+	ramfs_node_t *node = (ramfs_node_t *)kmalloc(sizeof(ramfs_node_t));
+	if (!node) {
+		return NULL;
+	}
+	memset(node, 0, sizeof(ramfs_node_t));
+
+	node->dirent.node.mask = mask;
+	node->dirent.node.flags = 0x775;
+	node->dirent.node.inode = ramfs_next_inode++;
+	node->dirent.fname = vfs_intern(name);
+	if (!node->dirent.fname) {
+		kfree(node);
+		return NULL;
+	}
+	node->parent = parent;
+
+	if (mask == VFS_MASK_DIR) {
+		node->dirent.node.ops = &ramfs_dir_ops;
+		node->children = hashtable_create(RAMFS_DIR_SIZE);
+	} else {
+		node->dirent.node.ops = &ramfs_file_ops;
+		radix_init(&node->pages);
+	}
+
+	return node;
+}
+
+static uint32_t ramfs_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	ramfs_node_t *file = RAMFS_NODE(node);
+
+	if (offset >= node->length) {
+		return 0;
+	}
+	if (size > node->length - offset) {
+		size = node->length - offset;
+	}
+
+	for (uint32_t done = 0; done < size; ) {
+		uint32_t pos = offset + done;
+		uint32_t in_page = pos % RAMFS_PAGE_SIZE;
+		uint32_t chunk = RAMFS_PAGE_SIZE - in_page;
+		if (chunk > size - done) {
+			chunk = size - done;
+		}
+
+		uint8_t *page = (uint8_t *)radix_lookup(&file->pages, pos / RAMFS_PAGE_SIZE);
+		if (page) {
+			memcpy(buffer + done, page + in_page, chunk);
+		} else {
+			memset(buffer + done, 0, chunk); // Hole
+		}
+
+		done += chunk;
+	}
+
+	return size;
+}
+
+/**
+ * Write, allocating pages as needed and growing the file past its end.
+ *
+ * returns: the number of bytes written, less than size when out of memory.
+ */
+static uint32_t ramfs_write(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	ramfs_node_t *file = RAMFS_NODE(node);
+
+	if (size > 0xFFFFFFFF - offset) {
+		size = 0xFFFFFFFF - offset;
+	}
+
+	uint32_t done = 0;
+	while (done < size) {
+		uint32_t pos = offset + done;
+		uint32_t in_page = pos % RAMFS_PAGE_SIZE;
+		uint32_t chunk = RAMFS_PAGE_SIZE - in_page;
+		if (chunk > size - done) {
+			chunk = size - done;
+		}
+
+		uint8_t *page = (uint8_t *)radix_lookup(&file->pages, pos / RAMFS_PAGE_SIZE);
+		if (!page) {
+			page = (uint8_t *)page_alloc();
+			if (!page) {
+				break;
+			}
+			if (radix_insert(&file->pages, pos / RAMFS_PAGE_SIZE, page) != 0) {
+				page_free(page);
+				break;
+			}
+		}
+
+		memcpy(page + in_page, buffer + done, chunk);
+		done += chunk;
+	}
+
+	if (offset + done > node->length) {
+		node->length = offset + done;
+	}
+
+	return done;
+}
+
+static int ramfs_truncate(vfs_node_t *node, uint32_t length)
+{
+	ramfs_node_t *file = RAMFS_NODE(node);
+
+	if (node->mask != VFS_MASK_FILE) {
+		return -1;
+	}
+
+	if (length < node->length) {
+		uint32_t keep = (length + RAMFS_PAGE_SIZE - 1) / RAMFS_PAGE_SIZE;
+
+		if (node->mappings) {
+			// Mapped pages can't be freed, clear them instead
+			uint32_t end = (node->length + RAMFS_PAGE_SIZE - 1) / RAMFS_PAGE_SIZE;
+			for (uint32_t i = keep; i < end; i++) {
+				void *page = radix_lookup(&file->pages, i);
+				if (page) {
+					memset(page, 0, RAMFS_PAGE_SIZE);
+				}
+			}
+		} else {
+			radix_truncate(&file->pages, keep, &page_free);
+		}
+
+		// Growing the file again has to read zeroes, not the old tail
+		uint8_t *page = (uint8_t *)radix_lookup(&file->pages, length / RAMFS_PAGE_SIZE);
+		if (page) {
+			memset(page + length % RAMFS_PAGE_SIZE, 0, RAMFS_PAGE_SIZE - length % RAMFS_PAGE_SIZE);
+		}
+	}
+
+	node->length = length;
+
+	return 0;
+}
+
+/**
+ * The file's own pages serve as its page cache, so mappings write straight
+ * into the file. Holes get a page allocated.
+ */
+static void *ramfs_get_page(vfs_node_t *node, uint32_t index)
+{
+	ramfs_node_t *file = RAMFS_NODE(node);
+
+	if (index >= (node->length + RAMFS_PAGE_SIZE - 1) / RAMFS_PAGE_SIZE) {
+		return NULL;
+	}
+
+	void *page = radix_lookup(&file->pages, index);
+	if (!page) {
+		page = page_alloc();
+		if (page && radix_insert(&file->pages, index, page) != 0) {
+			page_free(page);
+			page = NULL;
+		}
+	}
+
+	return page;
+}
+
+/**
+ * returns: the index'th entry of the directory, NULL past the last one.
+ */
+static vfs_dirent_t *ramfs_read_dir(vfs_dir_t *dir, uint32_t index)
+{
+	ramfs_node_t *parent = RAMFS_NODE(&dir->node);
+
+	vfs_dirent_t *dirent = parent->first_child;
+	while (dirent && index--) {
+		dirent = dirent->next;
+	}
+
+	return dirent;
+}
+
+static vfs_dirent_t *ramfs_find_dir(vfs_dir_t *dir, char *fname)
+{
+	ramfs_node_t *parent = RAMFS_NODE(&dir->node);
+
+	return (vfs_dirent_t *)hashtable_lookup_value(parent->children, fname);
+}
+
+static vfs_node_t *ramfs_create(vfs_node_t *dir, const char *name, uint32_t mask)
+{
+	ramfs_node_t *parent = RAMFS_NODE(dir);
+
+	if (mask != VFS_MASK_FILE && mask != VFS_MASK_DIR) {
+		return NULL;
+	}
+	if (!name[0] || hashtable_lookup(parent->children, (char *)name)) {
+		return NULL;
+	}
+
+	ramfs_node_t *node = ramfs_node_alloc(parent, name, mask);
+	if (!node) {
+		return NULL;
+	}
+
+	if (hashtable_insert(parent->children, (char *)node->dirent.fname, 0, node) != 0) {
+		if (mask == VFS_MASK_DIR) {
+			hashtable_destroy(node->children);
+		}
+		vfs_intern_put(node->dirent.fname);
+		kfree(node);
+		return NULL;
+	}
+
+	node->dirent.next = parent->first_child;
+	parent->first_child = &node->dirent;
+
+	return &node->dirent.node;
+}
+
+/**
+ * Remove a file, freeing its pages, or an empty directory. Nodes that are
+ * mount points must not be unlinked.
+ *
+ * returns: 0 on success, -1 if there is no such entry, the directory isn't
+ * empty or the file is mapped.
+ */
+static int ramfs_unlink(vfs_node_t *dir, const char *name)
+{
+	ramfs_node_t *parent = RAMFS_NODE(dir);
+	ramfs_node_t *node = (ramfs_node_t *)hashtable_lookup_value(parent->children, (char *)name);
+
+	if (!node || node->dirent.node.mappings) {
+		return -1;
+	}
+
+	if (node->dirent.node.mask == VFS_MASK_DIR) {
+		if (node->first_child) {
+			return -1;
+		}
+		hashtable_destroy(node->children);
+	} else {
+		radix_truncate(&node->pages, 0, &page_free);
+	}
+
+	hashtable_remove(parent->children, (char *)name);
+
+	vfs_dirent_t **link = &parent->first_child;
+	while (*link != &node->dirent) {
+		link = &(*link)->next;
+	}
+	*link = node->dirent.next;
+
+	vfs_intern_put(node->dirent.fname);
+	kfree(node);
+
+	return 0;
+}
+
+static const vfs_ops_t ramfs_file_ops = {
+	.read = ramfs_read,
+	.write = ramfs_write,
+	.truncate = ramfs_truncate,
+	.get_page = ramfs_get_page,
+};
+
+static const vfs_ops_t ramfs_dir_ops = {
+	.read_dir = ramfs_read_dir,
+	.find_dir = ramfs_find_dir,
+	.create = ramfs_create,
+	.unlink = ramfs_unlink,
+};
+
+/**
+ * Create an empty ramfs, mount it as the root and give it a /dev directory for
+ * device nodes.
+ *
+ * returns: the root directory.
+ */
+vfs_node_t *ramfs_init()
+{
+	ramfs_node_t *root = ramfs_node_alloc(NULL, "/", VFS_MASK_DIR);
+
+	vfs_mount("/", &root->dirent.node);
+
+	vfs_node_t *dev = ramfs_create(&root->dirent.node, "dev", VFS_MASK_DIR);
+	vfs_mount("/dev", dev);
+
+	return &root->dirent.node;
+}
@@ -0,0 +1,56 @@
+#include "fs/readahead.h"
+#include "stdint.h"
+
+void ra_init(ra_state_t *ra)
+{
+	ra->prev_end = 0;
+	ra->start = 0;
+	ra->size = 0;
+	ra->async_start = 0;
+}
+
+/**
+ * Account for a read of size bytes at offset.
+ *
+ * returns: the number of bytes that should be prefetched starting at *ra_offset, or 0.
+ */
+uint32_t ra_update(ra_state_t *ra, uint32_t offset, uint32_t size, uint32_t *ra_offset)
+{
+	uint32_t end = offset + size;
+	uint32_t sequential = (offset == ra->prev_end);
+
+	ra->prev_end = end;
+
+	if (!sequential || size == 0) {
+		// Random access, stop prefetching until a new stream shows up
+		ra->size = 0;
+		return 0;
+	}
+
+	if (ra->size == 0) {
+		// A new stream, start with the smallest window right behind this read
+		ra->start = end;
+		ra->size = RA_MIN_WINDOW;
+		ra->async_start = ra->start;
+
+		*ra_offset = ra->start;
+		return ra->size;
+	}
+
+	if (end > ra->async_start) {
+		// The reader entered the last window we fetched, fetch the next one while it consumes this one.
+		uint32_t next = ra->start + ra->size;
+		if (next < end) {
+			next = end; // The reader overtook us
+		}
+
+		ra->size = ra->size * 2 > RA_MAX_WINDOW ? RA_MAX_WINDOW : ra->size * 2;
+		ra->start = next;
+		ra->async_start = next;
+
+		*ra_offset = next;
+		return ra->size;
+	}
+
+	return 0;
+}
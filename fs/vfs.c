@@ -1,62 +1,450 @@
+#define LOG_SUBSYS LOG_SYS_VFS
+
 #include "fs/vfs.h"
 #include "stdint.h"
 #include "ds/tree.h"
-#include "ds/list.h"
 #include "ds/hashtable.h"
+#include "fs/dcache.h"
+#include "fs/pagecache.h"
 #include "string.h"
 #include "mem/kmalloc.h"
 #include "debug.h"
+#include "cpu.h"
 
 #define MOUNT_MAX_NODES 128
+#define VFS_NAMES_SIZE 256
 
 tree_t *vfs_tree;
 hashtable_t *mount_table;
+static hashtable_t *vfs_names;
 
 uint32_t vfs_read (vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
 {
-	if (node->read) {
-		return node->read(node, offset, size, buffer);
+	// Mapped nodes are read through their pages, which may have been written to
+	if (node->cache) {
+		return pagecache_read(node, offset, size, buffer);
+	}
+
+	if (node->ops->read) {
+		return node->ops->read(node, offset, size, buffer);
 	}
 
 	return size;
 }
 
+/**
+ * Read through a stream's read-ahead state. Sequential readers get the data after
+ * the requested range prefetched in growing windows while they consume this one.
+ * private is the driver data the stream cached when it was opened.
+ */
+uint32_t vfs_read_ra (vfs_node_t *node, void *private, ra_state_t *ra, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	uint32_t ra_offset = 0;
+	uint32_t ra_size = ra_update(ra, offset, size, &ra_offset);
+
+	uint32_t ret = vfs_read(node, offset, size, buffer);
+
+	if (ra_size && node->ops->readahead && ra_offset < node->length) {
+		if (ra_size > node->length - ra_offset) {
+			ra_size = node->length - ra_offset;
+		}
+		node->ops->readahead(node, private, ra_offset, ra_size);
+	}
+
+	return ret;
+}
+
 uint32_t vfs_write (vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
 {
-	if (node->write) {
-		return node->write(node, offset, size, buffer);
+	if (node->ops->write) {
+		uint32_t ret = node->ops->write(node, offset, size, buffer);
+		if (node->cache) {
+			pagecache_update(node, offset, ret, buffer);
+		}
+		return ret;
 	}
 
 	return size;
 }
 
+/**
+ * Make sure everything written to node so far is on stable storage.
+ *
+ * returns: 0 on success, -1 on I/O errors.
+ */
+int vfs_fsync (vfs_node_t *node)
+{
+	if (node->ops->fsync) {
+		return node->ops->fsync(node);
+	}
+
+	return 0;
+}
+
+static int vfs_sync_node (vfs_entry_t *entry)
+{
+	int ret = 0;
+
+	if (entry->node && vfs_fsync(entry->node) != 0) {
+		ret = -1;
+	}
+
+	tree_foreach_child(&entry->tree, child) {
+		if (vfs_sync_node(tree_entry(child, vfs_entry_t, tree)) != 0) {
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Sync every mounted node.
+ *
+ * returns: 0 on success, -1 if any of them failed.
+ */
+int vfs_sync (void)
+{
+	if (!vfs_tree) {
+		return 0;
+	}
+
+	return vfs_sync_node(tree_entry(vfs_tree->root, vfs_entry_t, tree));
+}
+
+/**
+ * Create a file or directory in dir.
+ *
+ * returns: the new node, NULL if it exists or the filesystem can't create it.
+ */
+vfs_node_t *vfs_create (vfs_node_t *dir, const char *name, uint32_t mask)
+{
+	if (dir->ops->create) {
+		return dir->ops->create(dir, name, mask);
+	}
+
+	return NULL;
+}
+
+/**
+ * returns: 0 on success, -1 if there's no such name or it can't be removed.
+ */
+int vfs_unlink (vfs_node_t *dir, const char *name)
+{
+	if (dir->ops->unlink) {
+		return dir->ops->unlink(dir, name);
+	}
+
+	return -1;
+}
+
+/**
+ * Shrink or grow a file. Grown files read back zeroes past the old end.
+ *
+ * returns: 0 on success, -1 on failure.
+ */
+int vfs_truncate (vfs_node_t *node, uint32_t length)
+{
+	if (node->ops->truncate) {
+		int ret = node->ops->truncate(node, length);
+		if (ret == 0 && node->cache) {
+			pagecache_truncate(node, length);
+		}
+		return ret;
+	}
+
+	return -1;
+}
+
+/**
+ * Start an I/O. Nodes that implement submit run it asynchronously, anything
+ * else (and mapped nodes, which have to go through their page cache) is done
+ * synchronously through read/write and has completed by the time this returns.
+ *
+ * returns: 0 if the I/O was started, -1 if it is invalid.
+ */
+int vfs_submit (vfs_io_t *io)
+{
+	vfs_node_t *node = io->node;
+
+	if (io->dir != VFS_IO_READ && io->dir != VFS_IO_WRITE) {
+		return -1;
+	}
+
+	io->complete = false;
+
+	if (node->ops->submit && !node->cache && node->ops->submit(node, io) == 0) {
+		return 0;
+	}
+
+	uint32_t offset = io->offset;
+	for (uint32_t i = 0; i < io->iovcnt; i++) {
+		uint32_t ret;
+		if (io->dir == VFS_IO_READ) {
+			ret = vfs_read(node, offset, io->iov[i].len, io->iov[i].base);
+		} else {
+			ret = vfs_write(node, offset, io->iov[i].len, io->iov[i].base);
+		}
+
+		offset += ret;
+		if (ret != io->iov[i].len) {
+			break;
+		}
+	}
+
+	vfs_io_complete(io, offset - io->offset, 0);
+
+	return 0;
+}
+
+/**
+ * Called by implementations of submit once all of an I/O is done.
+ */
+void vfs_io_complete (vfs_io_t *io, uint32_t result, int status)
+{
+	io->result = result;
+	io->status = status;
+
+	if (io->cq) {
+		vfs_cq_t *cq = io->cq;
+		uint32_t flags = irq_save();
+		ASSERT(cq->tail - cq->head < cq->size, "Completion queue overflow!");
+		cq->entries[cq->tail & (cq->size - 1)] = io;
+		compiler_barrier();
+		cq->tail++;
+		irq_restore(flags);
+	}
+
+	// The submitter may reuse the I/O as soon as it sees this
+	compiler_barrier();
+	io->complete = true;
+
+	if (io->done) {
+		io->done(io);
+	}
+}
+
+void vfs_io_wait (vfs_io_t *io)
+{
+	while (1) {
+		__asm__ __volatile__ ("cli");
+		if (io->complete) {
+			__asm__ __volatile__ ("sti");
+			return;
+		}
+		__asm__ __volatile__ ("sti; hlt");
+	}
+}
+
+static uint32_t vfs_rw_vec (vfs_node_t *node, uint8_t dir, uint32_t offset, vfs_iovec_t *iov, uint32_t iovcnt)
+{
+	vfs_io_t io;
+
+	memset(&io, 0, sizeof(vfs_io_t));
+	io.node = node;
+	io.dir = dir;
+	io.offset = offset;
+	io.iov = iov;
+	io.iovcnt = iovcnt;
+
+	if (vfs_submit(&io) != 0) {
+		return 0;
+	}
+
+	vfs_io_wait(&io);
+
+	return io.result;
+}
+
+/**
+ * Read into several buffers with a single request where the node supports it.
+ *
+ * returns: the number of bytes read.
+ */
+uint32_t vfs_readv (vfs_node_t *node, uint32_t offset, vfs_iovec_t *iov, uint32_t iovcnt)
+{
+	return vfs_rw_vec(node, VFS_IO_READ, offset, iov, iovcnt);
+}
+
+uint32_t vfs_writev (vfs_node_t *node, uint32_t offset, vfs_iovec_t *iov, uint32_t iovcnt)
+{
+	return vfs_rw_vec(node, VFS_IO_WRITE, offset, iov, iovcnt);
+}
+
+void vfs_cq_init (vfs_cq_t *cq, vfs_io_t **entries, uint32_t size)
+{
+	cq->entries = entries;
+	cq->size = size;
+	cq->head = 0;
+	cq->tail = 0;
+}
+
+/**
+ * returns: the oldest completed I/O, NULL if there is none.
+ */
+vfs_io_t *vfs_cq_pop (vfs_cq_t *cq)
+{
+	if (cq->head == cq->tail) {
+		return NULL;
+	}
+
+	compiler_barrier();
+	vfs_io_t *io = cq->entries[cq->head & (cq->size - 1)];
+	cq->head++;
+
+	return io;
+}
+
+vfs_io_t *vfs_cq_wait (vfs_cq_t *cq)
+{
+	while (1) {
+		__asm__ __volatile__ ("cli");
+		vfs_io_t *io = vfs_cq_pop(cq);
+		if (io) {
+			__asm__ __volatile__ ("sti");
+			return io;
+		}
+		__asm__ __volatile__ ("sti; hlt");
+	}
+}
+
 vfs_dirent_t *vfs_read_dir (vfs_dir_t *dir, uint32_t inode)
 {
-	if (dir->node.read_dir != 0) {
-		//debug("\tVFS: read for directory %s is at 0x%x\n", dir->fname, dir->node.read_dir);
-		return dir->node.read_dir(dir, inode);
+	if (dir->node.ops->read_dir != 0) {
+		return dir->node.ops->read_dir(dir, inode);
 	}
 	return 0;
 }
 
 vfs_dirent_t *vfs_find_dir (vfs_dir_t *dir, char *fname)
 {
-	if (dir->node.find_dir != 0) {
-		return dir->node.find_dir(dir, fname);
+	if (dir->node.ops->find_dir != 0) {
+		return dir->node.ops->find_dir(dir, fname);
 	}
 	return 0;
 }
 
+/**
+ * Get the shared copy of a name, taking a reference on it. Equal names compare
+ * equal by pointer as long as they are referenced.
+ *
+ * returns: the interned name, NULL when out of memory.
+ */
+const char *vfs_intern(const char *name)
+{
+	if (!vfs_names) {
+		vfs_names = hashtable_create(VFS_NAMES_SIZE);
+	}
+
+	// The value is the reference count
+	hashtable_entry_t *entry = hashtable_lookup(vfs_names, (char *)name);
+	if (entry) {
+		entry->value = (void *)((uintptr_t)entry->value + 1);
+		return entry->key;
+	}
+
+	char *copy = strdup(name);
+	if (!copy) {
+		return NULL;
+	}
+	if (hashtable_insert(vfs_names, copy, 0, (void *)1) != 0) {
+		kfree(copy);
+		return NULL;
+	}
+
+	return copy;
+}
+
+/**
+ * Drop a reference taken by vfs_intern(), freeing the name with the last one.
+ */
+void vfs_intern_put(const char *name)
+{
+	hashtable_entry_t *entry = hashtable_lookup(vfs_names, (char *)name);
+	if (!entry || entry->key != name) {
+		return;
+	}
+
+	entry->value = (void *)((uintptr_t)entry->value - 1);
+	if (!entry->value) {
+		hashtable_remove(vfs_names, (char *)name);
+		kfree((void *)name);
+	}
+}
+
+/**
+ * Look a relative path up component by component through the filesystem's
+ * find_dir.
+ *
+ * returns: the node, NULL if any component is missing.
+ */
+static vfs_node_t *vfs_walk(vfs_node_t *node, const char *path)
+{
+	char name[VFS_NAME_MAX + 1];
+
+	while (node && *path) {
+		if (*path == '/') {
+			path++;
+			continue;
+		}
+
+		uint32_t len = 0;
+		while (path[len] && path[len] != '/') {
+			len++;
+		}
+		if (len > VFS_NAME_MAX) {
+			return NULL;
+		}
+
+		memcpy(name, path, len);
+		name[len] = '\0';
+		path += len;
+
+		vfs_dirent_t *dirent = vfs_find_dir((vfs_dir_t *)node, name);
+		node = dirent ? &dirent->node : NULL;
+	}
+
+	return node;
+}
+
+/**
+ * Find the child of a directory in the mount tree by name, going through the
+ * dentry cache first.
+ *
+ * returns: the child's entry, NULL if there is none.
+ */
+static vfs_entry_t *vfs_lookup_child(vfs_entry_t *parent, const char *name, uint32_t len)
+{
+	uint32_t hash = dcache_hash(name, len);
+	void *child = NULL;
+
+	if (dcache_lookup(parent, name, len, hash, &child)) {
+		return (vfs_entry_t *)child;
+	}
+
+	tree_foreach_child(&parent->tree, node) {
+		vfs_entry_t *entry = tree_entry(node, vfs_entry_t, tree);
+		if ((uint32_t)strlen(entry->name) == len && !memcmp(entry->name, name, len)) {
+			child = entry;
+			break;
+		}
+	}
+
+	dcache_insert(parent, name, len, hash, child);
+
+	return (vfs_entry_t *)child;
+}
+
 void vfs_install()
 {
 	vfs_tree = tree_create();
 
 	vfs_entry_t *root = (vfs_entry_t *)kmalloc(sizeof(vfs_entry_t));
 
-	root->name = strdup("/");
+	root->name = vfs_intern("/");
 	root->node = NULL;
 
-	tree_set_root(vfs_tree, root);
+	tree_set_root(vfs_tree, &root->tree);
 
 	mount_table = hashtable_create(MOUNT_MAX_NODES);
 }
@@ -64,16 +452,16 @@ void vfs_install()
 void *vfs_mount(char *path, vfs_node_t *node)
 {
 	if (!vfs_tree) {
-		debug("Tried to mount while VFS not initialized.\n");
+		log_err("Tried to mount while VFS not initialized.\n");
 		return NULL;
 	}
 
-	if (!path || !path[0] == '/') {
-		debug("Mount paths must be absolute!\n");
+	if (!path || path[0] != '/') {
+		log_err("Mount paths must be absolute!\n");
 		return NULL;
 	}
 
-	tree_node_t *ret = NULL;
+	vfs_entry_t *ret = NULL;
 
 	char *p = strdup(path);
 	char *i = p;
@@ -90,23 +478,22 @@ void *vfs_mount(char *path, vfs_node_t *node)
 	p[path_length] = '\0';
 	i = p + 1;
 
-	tree_node_t *root = vfs_tree->root;
+	vfs_entry_t *root = tree_entry(vfs_tree->root, vfs_entry_t, tree);
 
 	if (*i == '\0') {
 		// Mount root.
-		vfs_entry_t *root_node = (vfs_entry_t *)root->value;
-		if (root_node->node) {
-			debug("%s is already mounted. Unmount first.\n", path);
+		if (root->node) {
+			log_warn("%s is already mounted. Unmount first.\n", path);
 			return NULL;
 		}
 
-		root_node->node = node;
+		root->node = node;
 		ret = root;
 
 		// Make sure we know where everything's mounted
 		hashtable_insert(mount_table, "root", 0, strdup(path));
 	} else {
-		tree_node_t *cur_node = root;
+		vfs_entry_t *cur_node = root;
 		char *pos = i;
 
 		while (1) {
@@ -114,40 +501,37 @@ void *vfs_mount(char *path, vfs_node_t *node)
 				break;
 			}
 
-			int found = 0;
-
-			for (list_item_t *i = cur_node->children->first; i != NULL; i = i->next) {
-				tree_node_t *child = (tree_node_t *)i->value;
-				vfs_entry_t *entry = (vfs_entry_t *)child->value;
-				if (!strcmp(entry->name, pos)) {
-					found = 1;
-					cur_node = child;
-					ret = cur_node;
-					break;
-				}
-			}
+			vfs_entry_t *child = vfs_lookup_child(cur_node, pos, strlen(pos));
 
-			if (!found) {
+			if (child) {
+				cur_node = child;
+				ret = cur_node;
+			} else {
 				debug("Didn't find %s, Creating it.\n", path);
 				vfs_entry_t *entry = (vfs_entry_t *)kmalloc(sizeof(vfs_entry_t));
-				entry->name = strdup(pos);
+				entry->name = vfs_intern(pos);
 				entry->node = NULL;
-				cur_node = tree_node_insert_child(vfs_tree, cur_node, entry);
+				tree_node_init(&entry->tree);
+				tree_node_insert_child(vfs_tree, &cur_node->tree, &entry->tree);
+				cur_node = entry;
+
+				// The name may be cached as missing
+				dcache_invalidate_negative();
 			}
 
 			pos = pos + strlen(pos) + 1;
 		}
 
-		vfs_entry_t *entry = (vfs_entry_t *)cur_node->value;
+		vfs_entry_t *entry = cur_node;
 		if (entry->node) {
-			debug("%s is already mounted. Unmount first.\n", path);
+			log_warn("%s is already mounted. Unmount first.\n", path);
 			return NULL;
 		}
 		entry->node = node;
 		ret = cur_node;
 
 		// Make sure we know where everything's mounted
-		hashtable_insert(mount_table, strdup(entry->name), 0, strdup(path));
+		hashtable_insert(mount_table, (char *)entry->name, 0, strdup(path));
 	}
 
 	debug("Mounted %s.\n", path);
@@ -157,68 +541,46 @@ void *vfs_mount(char *path, vfs_node_t *node)
 	return ret;
 }
 
+/**
+ * Resolve an absolute path. Components are looked up in place, one dentry cache
+ * probe each, without copying the path. Past the last mount point on the way
+ * the rest of the path is looked up in the filesystem mounted there.
+ */
 vfs_node_t *kopen(char *filename)
 {
-	if (!filename || !filename[0] == '/') {
-		debug("Kopen needs absolute paths (for now)!\n");
+	if (!filename || filename[0] != '/') {
+		log_err("Kopen needs absolute paths (for now)!\n");
 		return NULL;
 	}
 
-	tree_node_t *ret = NULL;
-
-	char *p = strdup(filename);
-	char *i = p;
-
-	int path_length = strlen(p);
+	vfs_entry_t *cur_node = tree_entry(vfs_tree->root, vfs_entry_t, tree);
+	vfs_entry_t *mounted = cur_node;	// Deepest entry with something mounted
+	const char *rest = filename;		// Path left after mounted
+	const char *pos = filename;
 
-	while (i < p + path_length) {
-		if (*i == '/') {
-			*i = '\0';
+	while (*pos) {
+		if (*pos == '/') {
+			pos++;
+			continue;
 		}
-		i++;
-	}
 
-	p[path_length] = '\0';
-	i = p + 1;
-
-	tree_node_t *root = vfs_tree->root;
-
-	if (*i == '\0') {
-		return root;
-	} else {
-		tree_node_t *cur_node = root;
-		char *pos = i;
-
-		while (1) {
-			if (pos >= p + path_length) {
-				break;
-			}
-
-			int found = 0;
-
-			for (list_item_t *i = cur_node->children->first; i != NULL; i = i->next) {
-				tree_node_t *child = (tree_node_t *)i->value;
-				vfs_entry_t *entry = (vfs_entry_t *)child->value;
-				if (!strcmp(entry->name, pos)) {
-					found = 1;
-					cur_node = child;
-					ret = entry->node;
-					break;
-				}
-			}
+		const char *start = pos;
+		while (*pos && *pos != '/') {
+			pos++;
+		}
 
-			if (!found) {
-				ret = NULL;
-				break;
-			}
+		cur_node = vfs_lookup_child(cur_node, start, pos - start);
+		if (!cur_node) {
+			return vfs_walk(mounted->node, rest);
+		}
 
-			pos = pos + strlen(pos) + 1;
+		if (cur_node->node) {
+			mounted = cur_node;
+			rest = pos;
 		}
 	}
 
-	kfree(p);
-
-	return ret;
+	return cur_node->node;
 }
 
 hashtable_t *vfs_get_mount_table()
@@ -226,16 +588,14 @@ hashtable_t *vfs_get_mount_table()
 	return mount_table;
 }
 
-void debug_print_vfs_tree_node(tree_node_t * node, size_t height)
+void debug_print_vfs_tree_node(vfs_entry_t * fnode, size_t height)
 {
 	/* End recursion on a blank entry */
-	if (!node) return;
+	if (!fnode) return;
 	/* Indent output */
 	for (uint32_t i = 0; i < height; ++i) {
 		debug("\t");
 	}
-	/* Get the current process */
-	vfs_entry_t * fnode = (struct vfs_entry *)node->value;
 	/* Print the process name */
 	if (fnode->node) {
 		debug("%s → 0x%x", fnode->name, fnode->node);
@@ -245,13 +605,13 @@ void debug_print_vfs_tree_node(tree_node_t * node, size_t height)
 	/* Linefeed */
 	debug("\n");
 
-	for (list_item_t *i = node->children->first; i != NULL; i = i->next) {
+	tree_foreach_child(&fnode->tree, child) {
 		/* Recursively print the children */
-		debug_print_vfs_tree_node(i->value, height + 1);
+		debug_print_vfs_tree_node(tree_entry(child, vfs_entry_t, tree), height + 1);
 	}
 }
 
 void debug_print_vfs_tree(void)
 {
-	debug_print_vfs_tree_node(vfs_tree->root, 0);
+	debug_print_vfs_tree_node(tree_entry(vfs_tree->root, vfs_entry_t, tree), 0);
 }
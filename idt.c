@@ -14,11 +14,40 @@ idt_ptr_t idt_ptr;
 
 isr_t interrupt_handlers[256];
 
+// PCI devices may share an IRQ line, every handler on it gets called
+#define IDT_MAX_SHARED 4
+static isr_t shared_handlers[16][IDT_MAX_SHARED];
+
 void register_interrupt_handler(uint8_t n, isr_t handler)
 {
 	interrupt_handlers[n] = handler;
 }
 
+/**
+ * Add a handler to an IRQ that other devices may be using too. Each handler has
+ * to check whether its device actually raised the interrupt.
+ *
+ * returns: 0 on success, -1 when the IRQ has no free slots.
+ */
+int register_shared_interrupt_handler(uint8_t n, isr_t handler)
+{
+	if (n < IRQ0 || n > IRQ15) {
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < IDT_MAX_SHARED; i++) {
+		if (shared_handlers[n - IRQ0][i] == handler) {
+			return 0;
+		}
+		if (!shared_handlers[n - IRQ0][i]) {
+			shared_handlers[n - IRQ0][i] = handler;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
 void init_idt()
 {
 	idt_ptr.base=(uint32_t) &idt_entries;
@@ -118,6 +147,10 @@ void irq_handler(registers_t regs)
 	}
 	outb(0x20, 0x20);
 
+	for (uint32_t i = 0; regs.int_no <= IRQ15 && i < IDT_MAX_SHARED && shared_handlers[regs.int_no - IRQ0][i]; i++) {
+		shared_handlers[regs.int_no - IRQ0][i](regs);
+	}
+
 	if (interrupt_handlers[regs.int_no] != 0)
 	{
 		isr_t handler = interrupt_handlers[regs.int_no];
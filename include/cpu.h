@@ -2,6 +2,7 @@
 #define __CPU_H
 
 #include "stdint.h"
+#include "stdbool.h"
 
 struct registers
 {
@@ -12,4 +13,111 @@ struct registers
 };
 typedef struct registers registers_t;
 
+#define EFLAGS_IF 0x200
+#define EFLAGS_ID 0x200000	// Writable if CPUID is supported
+
+#define CR0_MP         0x02	// wait/fwait honour TS
+#define CR0_EM         0x04	// No FPU, emulate it
+#define CR0_TS         0x08	// Task switched, the next FPU instruction raises #NM
+#define CR0_NE         0x20	// Report FPU errors as #MF rather than through the PIC
+
+#define CR4_OSFXSR     0x200	// fxsave/fxrstor and SSE instructions
+#define CR4_OSXMMEXCPT 0x400	// Unmasked SSE exceptions raise #XM
+
+// Features detected by cpu_init()
+#define CPU_FEATURE_FPU  0x01
+#define CPU_FEATURE_FXSR 0x02	// fxsave/fxrstor
+#define CPU_FEATURE_SSE  0x04
+#define CPU_FEATURE_SSE2 0x08
+#define CPU_FEATURE_ERMS 0x10	// Enhanced rep movsb/stosb
+
+// CPUID leaf 1
+#define CPUID_1_EDX_FPU  (1 << 0)
+#define CPUID_1_EDX_FXSR (1 << 24)
+#define CPUID_1_EDX_SSE  (1 << 25)
+#define CPUID_1_EDX_SSE2 (1 << 26)
+
+// CPUID leaf 7, subleaf 0
+#define CPUID_7_EBX_ERMS (1 << 9)
+
+typedef struct cpu_info {
+	char vendor[13];
+	uint32_t max_leaf;
+	uint32_t family;
+	uint32_t model;
+	uint32_t features;		// CPU_FEATURE_*
+} cpu_info_t;
+
+extern cpu_info_t cpu_info;
+
+void cpu_init(void);
+
+static inline bool cpu_has_feature(uint32_t feature)
+{
+	return (cpu_info.features & feature) == feature;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+	__asm__ __volatile__ ("cpuid" : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx) : "a" (leaf), "c" (subleaf));
+}
+
+static inline uint32_t read_cr0(void)
+{
+	uint32_t cr0;
+	__asm__ __volatile__ ("mov %%cr0, %0" : "=r" (cr0));
+	return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0)
+{
+	__asm__ __volatile__ ("mov %0, %%cr0" :: "r" (cr0) : "memory");
+}
+
+static inline uint32_t read_cr4(void)
+{
+	uint32_t cr4;
+	__asm__ __volatile__ ("mov %%cr4, %0" : "=r" (cr4));
+	return cr4;
+}
+
+static inline void write_cr4(uint32_t cr4)
+{
+	__asm__ __volatile__ ("mov %0, %%cr4" :: "r" (cr4) : "memory");
+}
+
+/**
+ * Disable interrupts and return the previous EFLAGS so they can be restored.
+ */
+static inline uint32_t irq_save(void)
+{
+	uint32_t flags;
+	__asm__ __volatile__ ("pushfl; popl %0; cli" : "=r" (flags) :: "memory");
+	return flags;
+}
+
+static inline void irq_restore(uint32_t flags)
+{
+	if (flags & EFLAGS_IF) {
+		__asm__ __volatile__ ("sti" ::: "memory");
+	}
+}
+
+/**
+ * x86 only reorders stores after later loads, so ordering stores among
+ * themselves (or loads among themselves) just needs the compiler to behave.
+ */
+static inline void compiler_barrier(void)
+{
+	__asm__ __volatile__ ("" ::: "memory");
+}
+
+/**
+ * Full barrier, also orders a store before a later load.
+ */
+static inline void memory_barrier(void)
+{
+	__asm__ __volatile__ ("lock; addl $0, 0(%%esp)" ::: "memory", "cc");
+}
+
 #endif
@@ -8,6 +8,8 @@
 #include <cpu.h>
 #include <video.h>
 #include <mem/paging.h>
+#include <log.h>
+#include <dev/serial.h>
 
 #define BOCHS_BREAK() { asm volatile ("xchgw %bx, %bx"); }
 
@@ -29,7 +31,11 @@ void debug_init(multiboot_elf_section_header_table_t *);
 
 void backtrace_now(void);
 
-void debug(char * format, ...);
+/**
+ * Debug output of the file's LOG_SUBSYS, compiled out with LOG_LEVEL below
+ * LOG_DEBUG. See log_at().
+ */
+#define debug(format, ...) log_debug(format, ##__VA_ARGS__)
 
 void do_backtrace(registers_t * regs);
 
@@ -37,11 +43,14 @@ void do_backtrace(registers_t * regs);
 	cls(); \
 	__asm__ volatile ("cli"); \
 	kprintf("PANIC: "); \
-	debug("PANIC: "); \
+	klog(LOG_EMERG, NULL, "PANIC: "); \
 	kprintf(format, ##__VA_ARGS__); \
 	kprintf("\n"); \
-	debug(format, ##__VA_ARGS__); \
+	klog(LOG_EMERG, NULL, format, ##__VA_ARGS__); \
 	backtrace_now(); \
+	log_flush(); \
+	serial_flush(); \
+	video_flush(); \
 	if (panicing == 1) { \
 		__asm__ volatile("ud2"); \
 	} \
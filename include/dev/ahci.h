@@ -0,0 +1,172 @@
+#ifndef __AHCI_H
+#define __AHCI_H
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "dev/blk.h"
+
+#define AHCI_MAX_PORTS     32
+#define AHCI_MAX_SLOTS     32
+#define AHCI_MAX_SECTORS   128	// 64KB per command
+#define AHCI_MAX_PRDS      56	// Keeps a command table at 1KB
+#define AHCI_CMD_TIMEOUT   1000000
+
+// Generic host control
+#define AHCI_CAP_NCS(cap)  ((((cap) >> 8) & 0x1F) + 1)	// Number of command slots
+#define AHCI_CAP_SNCQ      (1 << 30)
+#define AHCI_GHC_IE        (1 << 1)
+#define AHCI_GHC_AE        0x80000000
+
+// Port command and status
+#define AHCI_PxCMD_ST      (1 << 0)
+#define AHCI_PxCMD_FRE     (1 << 4)
+#define AHCI_PxCMD_FR      (1 << 14)
+#define AHCI_PxCMD_CR      (1 << 15)
+
+// Port interrupts
+#define AHCI_PxIS_DHRS     (1 << 0)	// D2H register FIS
+#define AHCI_PxIS_PSS      (1 << 1)	// PIO setup FIS
+#define AHCI_PxIS_DSS      (1 << 2)	// DMA setup FIS
+#define AHCI_PxIS_SDBS     (1 << 3)	// Set device bits FIS (NCQ completion)
+#define AHCI_PxIS_IFS      (1 << 27)
+#define AHCI_PxIS_HBDS     (1 << 28)
+#define AHCI_PxIS_HBFS     (1 << 29)
+#define AHCI_PxIS_TFES     (1 << 30)
+#define AHCI_PxIS_ERROR    (AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+#define AHCI_PxIS_ENABLE   (AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_DSS | AHCI_PxIS_SDBS | AHCI_PxIS_ERROR)
+
+#define AHCI_PxTFD_ERR     0x01
+#define AHCI_PxTFD_DRQ     0x08
+#define AHCI_PxTFD_BSY     0x80
+
+#define AHCI_SSTS_DET_PRESENT 0x3
+#define AHCI_SSTS_IPM_ACTIVE  0x1
+
+#define AHCI_SIG_ATA       0x00000101
+
+#define FIS_TYPE_REG_H2D   0x27
+
+#define ATA_CMD_READ_FPDMA_QUEUED  0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+
+typedef volatile struct ahci_port_regs {
+	uint32_t clb;		// Command list base
+	uint32_t clbu;
+	uint32_t fb;		// FIS base
+	uint32_t fbu;
+	uint32_t is;		// Interrupt status
+	uint32_t ie;		// Interrupt enable
+	uint32_t cmd;
+	uint32_t reserved0;
+	uint32_t tfd;		// Task file data
+	uint32_t sig;
+	uint32_t ssts;		// SATA status
+	uint32_t sctl;
+	uint32_t serr;
+	uint32_t sact;		// Outstanding NCQ tags
+	uint32_t ci;		// Command issue
+	uint32_t sntf;
+	uint32_t fbs;
+	uint32_t reserved1[11];
+	uint32_t vendor[4];
+} ahci_port_regs_t;
+
+typedef volatile struct ahci_hba {
+	uint32_t cap;
+	uint32_t ghc;
+	uint32_t is;
+	uint32_t pi;		// Ports implemented
+	uint32_t vs;
+	uint32_t ccc_ctl;
+	uint32_t ccc_pts;
+	uint32_t em_loc;
+	uint32_t em_ctl;
+	uint32_t cap2;
+	uint32_t bohc;
+	uint8_t reserved[0xA0 - 0x2C];
+	uint8_t vendor[0x100 - 0xA0];
+	ahci_port_regs_t ports[AHCI_MAX_PORTS];
+} ahci_hba_t;
+
+typedef struct ahci_cmd_header {
+	uint8_t cfl:5;		// FIS length in dwords
+	uint8_t a:1;		// ATAPI
+	uint8_t w:1;		// Write (host to device)
+	uint8_t p:1;		// Prefetchable
+	uint8_t r:1;		// Reset
+	uint8_t b:1;		// BIST
+	uint8_t c:1;		// Clear busy upon R_OK
+	uint8_t reserved0:1;
+	uint8_t pmp:4;		// Port multiplier port
+	uint16_t prdtl;		// Number of PRDT entries
+	volatile uint32_t prdbc;	// Bytes transferred
+	uint32_t ctba;		// Command table base, 128 byte aligned
+	uint32_t ctbau;
+	uint32_t reserved1[4];
+} __attribute__((packed)) ahci_cmd_header_t;
+
+typedef struct ahci_prd {
+	uint32_t dba;		// Data base address, word aligned
+	uint32_t dbau;
+	uint32_t reserved0;
+	uint32_t dbc:22;	// Byte count - 1, at most 4MB
+	uint32_t reserved1:9;
+	uint32_t i:1;		// Interrupt on completion
+} __attribute__((packed)) ahci_prd_t;
+
+typedef struct fis_reg_h2d {
+	uint8_t fis_type;	// FIS_TYPE_REG_H2D
+	uint8_t pmport:4;
+	uint8_t reserved0:3;
+	uint8_t c:1;		// 1: Command, 0: Control
+	uint8_t command;
+	uint8_t featurel;
+	uint8_t lba0;
+	uint8_t lba1;
+	uint8_t lba2;
+	uint8_t device;
+	uint8_t lba3;
+	uint8_t lba4;
+	uint8_t lba5;
+	uint8_t featureh;
+	uint8_t countl;
+	uint8_t counth;
+	uint8_t icc;
+	uint8_t control;
+	uint8_t reserved1[4];
+} __attribute__((packed)) fis_reg_h2d_t;
+
+typedef struct ahci_cmd_table {
+	uint8_t cfis[64];	// Command FIS
+	uint8_t acmd[16];	// ATAPI command
+	uint8_t reserved[48];
+	ahci_prd_t prdt[AHCI_MAX_PRDS];
+} __attribute__((packed)) ahci_cmd_table_t;
+
+typedef struct ahci_controller ahci_controller_t;
+
+typedef struct ahci_port {
+	ahci_controller_t *controller;
+	ahci_port_regs_t *regs;
+	uint8_t index;
+	bool ncq;
+	ahci_cmd_header_t *cmd_list;	// 32 headers, 1KB
+	ahci_cmd_table_t *tables[AHCI_MAX_SLOTS];
+	uint32_t busy;				// Slots in use
+	blk_request_t *slot_req[AHCI_MAX_SLOTS];
+	uint8_t *bounce;			// For merged requests that can't be scattered directly
+	uint32_t bounce_slot;		// Slot using the bounce buffer + 1, 0 if free
+	blk_queue_t queue;
+} ahci_port_t;
+
+struct ahci_controller {
+	ahci_hba_t *hba;
+	uint8_t irq;
+	uint32_t slots;
+	ahci_port_t *ports[AHCI_MAX_PORTS];
+	struct ahci_controller *next;	// Controllers sharing the handler
+};
+
+void ahci_init();
+
+#endif
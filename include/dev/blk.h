@@ -0,0 +1,104 @@
+#ifndef __BLK_H
+#define __BLK_H
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "ds/list.h"
+#include "fs/vfs.h"
+
+#define BLK_SECTOR_SIZE 512
+
+// Directions:
+#define BLK_READ      0x00
+#define BLK_WRITE     0x01
+#define BLK_FLUSH     0x02	// Flush the device's write cache. Acts as a barrier.
+
+#define BLK_STATUS_PENDING 0x00
+#define BLK_STATUS_OK      0x01
+#define BLK_STATUS_ERROR   0x02
+
+// Return values of a driver's dispatch function
+#define BLK_DISPATCH_OK     0
+#define BLK_DISPATCH_BUSY   1
+#define BLK_DISPATCH_ERROR -1
+
+// Deadlines in timer ticks. Reads are expired sooner as somebody is usually waiting for them.
+#define BLK_READ_EXPIRE  25
+#define BLK_WRITE_EXPIRE 250
+
+typedef struct blk_queue blk_queue_t;
+typedef struct blk_request blk_request_t;
+
+typedef void (*blk_end_io_t)(blk_request_t *);
+typedef int (*blk_dispatch_t)(blk_queue_t *, blk_request_t *);
+typedef void (*blk_commit_t)(blk_queue_t *);
+typedef bool (*blk_segment_t)(void *, uint8_t *, uint32_t);
+
+struct blk_request {
+	// Filled in by the submitter
+	uint32_t lba;
+	uint32_t count;			// In sectors
+	uint8_t dir;			// BLK_READ, BLK_WRITE or BLK_FLUSH
+	uint8_t *buffer;
+	blk_end_io_t end_io;	// Called on completion, from interrupt context. May be NULL.
+	void *private;
+
+	volatile uint8_t status;	// See BLK_STATUS_*
+
+	// Internal to the queue
+	uint32_t start;			// Range covered by this request and everything merged into it
+	uint32_t end;
+	uint32_t seq;			// Submission order
+	uint32_t deadline;
+	blk_request_t *members;		// Merged requests in submission order (includes this one)
+	blk_request_t *next_member;
+	list_item_t sort_item;	// Position in the elevator (or the active list once dispatched)
+	list_item_t fifo_item;	// Position in the deadline FIFO
+};
+
+struct blk_queue {
+	list_t sorted;			// Queued requests, sorted by start sector
+	list_t fifo;			// Queued requests, in submission order
+	list_t active;			// Requests handed to the driver
+	uint32_t in_flight;
+	uint32_t active_flushes;	// Flushes handed to the driver, nothing else is dispatched next to them
+	uint32_t depth;			// Maximum number of requests the driver accepts at once
+	uint32_t max_sectors;	// Largest single command the driver can issue
+	uint32_t head_pos;		// Sector following the last dispatched request
+	uint32_t seq;
+	bool plugged;			// Hold back dispatching while a batch is being submitted
+	uint32_t sectors;		// Capacity of the device
+	bool write_cache;		// The device caches writes, flushes have to reach it
+	blk_dispatch_t dispatch;
+	blk_commit_t commit;	// Called after a batch of dispatches, optional
+	void *driver;
+	vfs_node_t *node;		// Set by blk_register_disk()
+};
+
+void blk_queue_init(blk_queue_t *queue, blk_dispatch_t dispatch, void *driver, uint32_t max_sectors, uint32_t depth);
+
+void blk_submit(blk_queue_t *queue, blk_request_t *req);
+void blk_run_queue(blk_queue_t *queue);
+void blk_plug(blk_queue_t *queue);
+void blk_unplug(blk_queue_t *queue);
+void blk_end_request(blk_queue_t *queue, blk_request_t *req, uint8_t status);
+void blk_wait(blk_request_t *req);
+
+bool blk_request_is_simple(blk_request_t *req);
+void blk_request_copy_in(blk_request_t *req, uint8_t *data);
+void blk_request_copy_out(blk_request_t *req, uint8_t *data);
+bool blk_request_map(blk_request_t *req, blk_segment_t segment, void *ctx);
+
+int blk_read_sectors(blk_queue_t *queue, uint32_t lba, uint32_t count, uint8_t *buffer);
+int blk_write_sectors(blk_queue_t *queue, uint32_t lba, uint32_t count, uint8_t *buffer);
+int blk_flush(blk_queue_t *queue);
+
+vfs_node_t *blk_register_disk(blk_queue_t *queue);
+
+uint32_t blk_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
+uint32_t blk_write(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
+void blk_readahead(vfs_node_t *node, void *private, uint32_t offset, uint32_t size);
+int blk_fsync(vfs_node_t *node);
+int blk_submit_io(vfs_node_t *node, vfs_io_t *io);
+
+#endif
@@ -1,6 +1,43 @@
 #ifndef __PCI_H
 #define __PCI_H
 
+#include "stdint.h"
+
+// Command register bits
+#define PCI_COMMAND_IO            0x0001
+#define PCI_COMMAND_MEMORY        0x0002
+#define PCI_COMMAND_MASTER        0x0004
+#define PCI_COMMAND_INTX_DISABLE  0x0400
+
+// Type bits of a base address register
+#define PCI_BAR_IO                0x1
+#define PCI_BAR_MEM_MASK          0xFFFFFFF0
+#define PCI_BAR_IO_MASK           0xFFFFFFFC
+#define PCI_BAR_MEM_TYPE_64       0x4
+
+#define PCI_STATUS_CAP_LIST       0x0010
+
+#define PCI_CAP_ID_VENDOR         0x09
+
+typedef void (*pci_callback_t)(uint8_t bus, uint8_t slot, uint8_t function);
+
 void listPCIBus();
 
+uint16_t pciConfigReadWord(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+uint32_t pciConfigReadDword(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+void pciConfigWriteWord(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value);
+void pciConfigWriteDword(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value);
+
+uint16_t getVendorID(uint8_t bus, uint8_t slot, uint8_t func);
+uint16_t getDeviceID(uint8_t bus, uint8_t slot, uint8_t func);
+uint8_t getProgIF(uint8_t bus, uint8_t slot, uint8_t function);
+uint8_t getInterruptLine(uint8_t bus, uint8_t slot, uint8_t function);
+uint32_t getBAR(uint8_t bus, uint8_t slot, uint8_t function, uint8_t bar);
+
+void enableBusMastering(uint8_t bus, uint8_t slot, uint8_t function);
+
+void pciFindClass(uint8_t baseClass, uint8_t subClass, pci_callback_t callback);
+void pciFindDevice(uint16_t vendorID, uint16_t deviceID, pci_callback_t callback);
+uint8_t pciFindCapability(uint8_t bus, uint8_t slot, uint8_t function, uint8_t id, uint8_t start);
+
 #endif
@@ -0,0 +1,64 @@
+#ifndef __SERIAL_H
+#define __SERIAL_H
+
+#include "stdint.h"
+#include "stdbool.h"
+
+#define SERIAL_PORTS      4		// COM1 - COM4
+#define SERIAL_CLOCK      115200	// Input clock / 16, the highest rate there is
+#define SERIAL_BAUD       115200
+#define SERIAL_LOG_PORT   0		// Gets the kernel log if present
+
+#define SERIAL_TX_SIZE    0x4000	// Power of two
+#define SERIAL_RX_SIZE    0x1000	// Power of two
+
+// Register offsets from the port base
+#define SERIAL_REG_DATA   0	// RBR / THR, divisor low byte with DLAB
+#define SERIAL_REG_IER    1	// Divisor high byte with DLAB
+#define SERIAL_REG_IIR    2	// Reads IIR, writes FCR
+#define SERIAL_REG_LCR    3
+#define SERIAL_REG_MCR    4
+#define SERIAL_REG_LSR    5
+#define SERIAL_REG_MSR    6
+#define SERIAL_REG_SCR    7
+
+#define SERIAL_IER_RDI    0x01	// Received data available
+#define SERIAL_IER_THRI   0x02	// Transmit holding register empty
+#define SERIAL_IER_RLSI   0x04	// Receiver line status
+
+#define SERIAL_IIR_NO_INT 0x01
+#define SERIAL_IIR_ID     0x0E
+#define SERIAL_IIR_MSI    0x00
+#define SERIAL_IIR_THRI   0x02
+#define SERIAL_IIR_RDI    0x04
+#define SERIAL_IIR_RLSI   0x06
+#define SERIAL_IIR_TIMEOUT 0x0C	// Characters sitting in the FIFO below the trigger level
+#define SERIAL_IIR_FIFO   0xC0	// Both set on a 16550A with working FIFOs
+
+#define SERIAL_FCR_ENABLE 0x01
+#define SERIAL_FCR_CLR_RX 0x02
+#define SERIAL_FCR_CLR_TX 0x04
+#define SERIAL_FCR_TRIG14 0xC0	// Interrupt at 14 received bytes
+
+#define SERIAL_LCR_8N1    0x03
+#define SERIAL_LCR_DLAB   0x80
+
+#define SERIAL_MCR_DTR    0x01
+#define SERIAL_MCR_RTS    0x02
+#define SERIAL_MCR_OUT2   0x08	// Gates the interrupt line to the PIC
+#define SERIAL_MCR_LOOP   0x10
+
+#define SERIAL_LSR_DR     0x01	// Data ready
+#define SERIAL_LSR_THRE   0x20	// Transmit FIFO empty
+
+#define SERIAL_FIFO_SIZE  16	// Transmit FIFO of a 16550A
+
+#define SERIAL_PROBE_TIMEOUT 100000	// LSR reads, about 100ms at ~1us per port access
+
+bool serial_present(uint32_t port);
+uint32_t serial_write(uint32_t port, const void *buffer, uint32_t size);
+uint32_t serial_read(uint32_t port, void *buffer, uint32_t size);
+void serial_flush(void);
+void serial_init(void);
+
+#endif
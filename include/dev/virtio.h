@@ -0,0 +1,134 @@
+#ifndef __VIRTIO_H
+#define __VIRTIO_H
+
+#include "stdint.h"
+#include "stdbool.h"
+
+#define VIRTIO_VENDOR_ID 0x1AF4
+
+// Device status
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+#define VIRTIO_STATUS_FAILED      0x80
+
+// Feature bits shared by all device types
+#define VIRTIO_F_RING_EVENT_IDX   29
+#define VIRTIO_F_VERSION_1        32
+
+// Vendor specific PCI capabilities describing where the structures live
+#define VIRTIO_PCI_CAP_COMMON_CFG 1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG 2
+#define VIRTIO_PCI_CAP_ISR_CFG    3
+#define VIRTIO_PCI_CAP_DEVICE_CFG 4
+
+#define VIRTIO_ISR_QUEUE          0x1
+#define VIRTIO_ISR_CONFIG         0x2
+
+#define VIRTQ_MAX_SIZE            128	// Descriptors and avail ring share a page
+
+#define VIRTQ_DESC_F_NEXT         0x1
+#define VIRTQ_DESC_F_WRITE        0x2	// Device writes (otherwise reads) the buffer
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 0x1
+#define VIRTQ_USED_F_NO_NOTIFY    0x1
+
+typedef volatile struct virtio_pci_common_cfg {
+	uint32_t device_feature_select;
+	uint32_t device_feature;
+	uint32_t driver_feature_select;
+	uint32_t driver_feature;
+	uint16_t msix_config;
+	uint16_t num_queues;
+	uint8_t device_status;
+	uint8_t config_generation;
+	uint16_t queue_select;
+	uint16_t queue_size;
+	uint16_t queue_msix_vector;
+	uint16_t queue_enable;
+	uint16_t queue_notify_off;
+	uint32_t queue_desc_lo;
+	uint32_t queue_desc_hi;
+	uint32_t queue_driver_lo;	// Available ring
+	uint32_t queue_driver_hi;
+	uint32_t queue_device_lo;	// Used ring
+	uint32_t queue_device_hi;
+} __attribute__((packed)) virtio_pci_common_cfg_t;
+
+typedef struct virtq_desc {
+	uint32_t addr;
+	uint32_t addr_hi;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct virtq_avail {
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[];	// Followed by used_event
+} __attribute__((packed)) virtq_avail_t;
+
+typedef struct virtq_used_elem {
+	uint32_t id;		// Head of the descriptor chain
+	uint32_t len;		// Bytes written by the device
+} __attribute__((packed)) virtq_used_elem_t;
+
+typedef struct virtq_used {
+	uint16_t flags;
+	uint16_t idx;
+	virtq_used_elem_t ring[];	// Followed by avail_event
+} __attribute__((packed)) virtq_used_t;
+
+/**
+ * One element of a buffer handed to the device. Addresses are physical.
+ */
+typedef struct virtq_sg {
+	uint32_t addr;
+	uint32_t len;
+} virtq_sg_t;
+
+typedef struct virtqueue {
+	uint16_t index;
+	uint16_t size;
+	virtq_desc_t *desc;
+	volatile virtq_avail_t *avail;
+	volatile virtq_used_t *used;
+	volatile uint16_t *notify;
+	bool event_idx;
+	uint16_t free_head;		// Chain of unused descriptors
+	uint16_t num_free;
+	uint16_t avail_idx;		// Next avail index, made visible by virtq_kick()
+	uint16_t kicked_idx;	// Avail index at the last kick
+	uint16_t last_used;
+	void *data[VIRTQ_MAX_SIZE];	// Caller's token per chain head
+} virtqueue_t;
+
+typedef struct virtio_device {
+	uint8_t bus;
+	uint8_t slot;
+	uint8_t function;
+	uint8_t irq;
+	virtio_pci_common_cfg_t *common;
+	volatile uint8_t *isr;
+	volatile uint8_t *device_cfg;
+	volatile uint8_t *notify_base;
+	uint32_t notify_multiplier;
+	uint32_t features[2];
+} virtio_device_t;
+
+int virtio_pci_init(virtio_device_t *dev, uint8_t bus, uint8_t slot, uint8_t function);
+int virtio_negotiate(virtio_device_t *dev, uint32_t features_lo, uint32_t features_hi);
+bool virtio_has_feature(virtio_device_t *dev, uint32_t bit);
+void virtio_driver_ok(virtio_device_t *dev);
+void virtio_fail(virtio_device_t *dev);
+uint8_t virtio_isr_ack(virtio_device_t *dev);
+
+int virtq_init(virtio_device_t *dev, virtqueue_t *vq, uint16_t index);
+int virtq_add(virtqueue_t *vq, virtq_sg_t *sg, uint32_t out, uint32_t in, void *data);
+void virtq_kick(virtqueue_t *vq);
+void *virtq_get(virtqueue_t *vq, uint32_t *len);
+bool virtq_enable_cb(virtqueue_t *vq);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef __VIRTIO_BLK_H
+#define __VIRTIO_BLK_H
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "dev/virtio.h"
+#include "dev/blk.h"
+
+#define VIRTIO_BLK_DEVICE_ID_LEGACY 0x1001	// Transitional device
+#define VIRTIO_BLK_DEVICE_ID        0x1042
+
+// Feature bits
+#define VIRTIO_BLK_F_SEG_MAX   2
+#define VIRTIO_BLK_F_FLUSH     9
+
+// Request types
+#define VIRTIO_BLK_T_IN        0
+#define VIRTIO_BLK_T_OUT       1
+#define VIRTIO_BLK_T_FLUSH     4
+
+#define VIRTIO_BLK_S_OK        0
+
+#define VIRTIO_BLK_MAX_TAGS    32	// Requests in flight per device
+#define VIRTIO_BLK_MAX_SECTORS 128
+#define VIRTIO_BLK_MAX_SEGS    (VIRTIO_BLK_MAX_SECTORS * BLK_SECTOR_SIZE / 0x1000 + 1)
+
+typedef volatile struct virtio_blk_config {
+	uint32_t capacity_lo;	// In 512 byte sectors
+	uint32_t capacity_hi;
+	uint32_t size_max;
+	uint32_t seg_max;
+} __attribute__((packed)) virtio_blk_config_t;
+
+typedef struct virtio_blk_req_hdr {
+	uint32_t type;
+	uint32_t reserved;
+	uint32_t sector_lo;
+	uint32_t sector_hi;
+} __attribute__((packed)) virtio_blk_req_hdr_t;
+
+typedef struct virtio_blk_tag {
+	blk_request_t *req;
+	bool bounced;
+} virtio_blk_tag_t;
+
+typedef struct virtio_blk_dev {
+	virtio_device_t virtio;
+	virtqueue_t vq;
+	blk_queue_t queue;
+	uint32_t seg_max;
+	uint32_t busy;			// Tags in use
+	virtio_blk_tag_t tags[VIRTIO_BLK_MAX_TAGS];
+	virtio_blk_req_hdr_t *hdrs;	// One header and status byte per tag, in DMA memory
+	volatile uint8_t *status;
+	uintptr_t hdrs_phys;
+	uint8_t *bounce;		// For merged requests that can't be scattered directly
+	bool bounce_busy;
+	struct virtio_blk_dev *next;
+} virtio_blk_dev_t;
+
+void virtio_blk_init();
+
+#endif
@@ -5,25 +5,58 @@
 #include "stdbool.h"
 #include "stddef.h"
 
+#define HASHTABLE_MIN_SIZE     8
+#define HASHTABLE_MIGRATE_STEP 8	// Entries moved to the new array per operation while resizing
+
 typedef struct hashtable_entry {
-	char *key;
+	char *key;			// NULL for empty and deleted slots
 	bool writeable;
 	void *value;
+	uint32_t hash;		// 0 for empty slots, never 0 otherwise
 } hashtable_entry_t;
 
+/**
+ * Open addressing with Robin Hood probing. Growing allocates a new array and
+ * moves the entries over a few at a time, so no single insert pays for the
+ * whole rehash.
+ */
 typedef struct hashtable {
 	hashtable_entry_t *entries;
-	uint32_t length;
-	uint32_t size;
+	uint32_t size;			// Always a power of two
+	uint32_t length;		// Number of keys, in both arrays
+	hashtable_entry_t *old_entries;	// Array being migrated from, NULL if not resizing
+	uint32_t old_size;
+	uint32_t migrate_pos;
 } hashtable_t;
 
+typedef struct hashtable_iter {
+	hashtable_t *table;
+	uint32_t index;
+	bool old;
+} hashtable_iter_t;
+
 hashtable_t *hashtable_create(size_t size);
+void hashtable_destroy(hashtable_t *table);
 
 int hashtable_insert(hashtable_t *table, char *key, bool writeable, void *value);
 int hashtable_remove(hashtable_t *table, char *key);
 hashtable_entry_t *hashtable_lookup(hashtable_t *table, char *key);
 void *hashtable_lookup_value(hashtable_t *table, char *key);
 
+void hashtable_iter_init(hashtable_t *table, hashtable_iter_t *iter);
+hashtable_entry_t *hashtable_iter_next(hashtable_iter_t *iter);
+
+/**
+ * Iterate over every entry. The table must not be modified while iterating.
+ */
+#define hashtable_foreach(table, iter, entry) \
+	for (hashtable_iter_init((table), &(iter)); ((entry) = hashtable_iter_next(&(iter))) != NULL;)
+
+// Same, with var the entry's value cast to type. Entries with a NULL value are skipped.
+#define hashtable_foreach_value(table, iter, entry, type, var) \
+	hashtable_foreach(table, iter, entry) \
+		for (type var = (type)(entry)->value; var != NULL; var = NULL)
+
 typedef void (*hashtable_walker_t)(hashtable_t *table, hashtable_entry_t *entry);
 void hashtable_walk(hashtable_t *table, hashtable_walker_t walker);
 
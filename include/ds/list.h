@@ -5,8 +5,10 @@
 #include "stddef.h"
 #include "stdbool.h"
 
+/**
+ * Links embedded in the listed object, use list_entry() to get back to it.
+ */
 typedef struct list_item {
-	void *value;
 	struct list_item *prev;
 	struct list_item *next;
 	void *owner;
@@ -25,7 +27,11 @@ int list_insert_end(list_t *list, list_item_t *item);
 int list_insert_after(list_t *list, list_item_t *item, list_item_t *after);
 int list_insert_before(list_t *list, list_item_t *item, list_item_t *before);
 int list_remove(list_t *list, list_item_t *item);
-int list_append(list_t *list, void *value);
+
+#define list_entry(item, type, member) container_of(item, type, member)
+
+#define list_foreach(list, item) \
+	for (list_item_t *item = (list)->first; item != NULL; item = item->next)
 
 typedef bool (*list_item_comparator_t)(list_item_t*, void *);
 
@@ -0,0 +1,33 @@
+#ifndef __RADIX_H
+#define __RADIX_H
+
+#include "stdint.h"
+#include "stddef.h"
+
+#define RADIX_SHIFT 6
+#define RADIX_SLOTS (1 << RADIX_SHIFT)
+#define RADIX_MASK  (RADIX_SLOTS - 1)
+
+typedef struct radix_node {
+	void *slots[RADIX_SLOTS];
+	uint32_t count;			// Used slots
+} radix_node_t;
+
+/**
+ * Sparse map from 32 bit indices to pointers. The tree is only as tall as the
+ * largest index needs, RADIX_SHIFT bits per level.
+ */
+typedef struct radix_tree {
+	radix_node_t *root;
+	uint32_t height;		// 0 when empty
+} radix_tree_t;
+
+typedef void (*radix_free_t)(void *item);
+
+void radix_init(radix_tree_t *tree);
+void *radix_lookup(radix_tree_t *tree, uint32_t index);
+int radix_insert(radix_tree_t *tree, uint32_t index, void *item);
+void *radix_delete(radix_tree_t *tree, uint32_t index);
+void radix_truncate(radix_tree_t *tree, uint32_t first, radix_free_t free_item);
+
+#endif
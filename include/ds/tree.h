@@ -3,12 +3,17 @@
 
 #include "stdint.h"
 #include "stddef.h"
-#include "ds/list.h"
+#include "stdbool.h"
 
+/**
+ * Links embedded in the object stored in the tree, use tree_entry() to get
+ * back to it. Children are kept as a singly linked sibling chain, so a node
+ * costs no allocations of its own.
+ */
 typedef struct tree_node {
-	void *value;
 	struct tree_node *parent;
-	list_t *children;
+	struct tree_node *first_child;
+	struct tree_node *next_sibling;
 } tree_node_t;
 
 typedef struct tree {
@@ -16,12 +21,18 @@ typedef struct tree {
 	tree_node_t *root;
 } tree_t;
 
-typedef uint8_t (*tree_node_comparator_t) (void *, void *);
+typedef bool (*tree_node_comparator_t) (tree_node_t *, void *);
 
 tree_t *tree_create();
-void tree_set_root(tree_t *tree, void *value);
-void tree_node_insert_child_node(tree_t *tree, tree_node_t *parent, tree_node_t *node);
-tree_node_t *tree_node_insert_child(tree_t *tree, tree_node_t *parent, void *value);
+void tree_node_init(tree_node_t *node);
+void tree_set_root(tree_t *tree, tree_node_t *node);
+void tree_node_insert_child(tree_t *tree, tree_node_t *parent, tree_node_t *node);
+void tree_node_remove(tree_t *tree, tree_node_t *node);
 tree_node_t *tree_find(tree_t *tree, void *value, tree_node_comparator_t comparator);
 
+#define tree_entry(node, type, member) container_of(node, type, member)
+
+#define tree_foreach_child(parent, child) \
+	for (tree_node_t *child = (parent)->first_child; child != NULL; child = child->next_sibling)
+
 #endif
@@ -0,0 +1,23 @@
+#ifndef __FPU_H
+#define __FPU_H
+
+#include "stdint.h"
+
+#define FPU_STATE_SIZE 512
+
+/**
+ * Saved FPU/SSE registers of one context, in fxsave format (fnsave on CPUs
+ * without FXSR).
+ */
+typedef struct fpu_state {
+	uint8_t data[FPU_STATE_SIZE];
+} __attribute__((aligned(16))) fpu_state_t;
+
+void fpu_init(void);
+void fpu_state_init(fpu_state_t *state);
+void fpu_switch(fpu_state_t *next);
+
+uint32_t kernel_fpu_begin(void);
+void kernel_fpu_end(uint32_t flags);
+
+#endif
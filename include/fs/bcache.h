@@ -0,0 +1,54 @@
+#ifndef __BCACHE_H
+#define __BCACHE_H
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "ds/list.h"
+#include "dev/blk.h"
+
+#define BCACHE_BLOCK_SIZE 0x1000
+#define BCACHE_BLOCK_SECTORS (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE)
+#define BCACHE_MAX_BUFFERS 1024	// 4MB
+#define BCACHE_HASH_SIZE 256
+
+#define BCACHE_FLAG_UPTODATE 0x1
+#define BCACHE_FLAG_BUSY     0x2	// Read in flight
+#define BCACHE_FLAG_ERROR    0x4
+#define BCACHE_FLAG_DIRTY    0x8	// Newer than the disk
+#define BCACHE_FLAG_WRITEBACK 0x10	// Write in flight
+
+// Write-back tuning. Times are in timer ticks.
+#define BCACHE_DIRTY_EXPIRE     250	// Write back buffers that have been dirty for this long
+#define BCACHE_DIRTY_BACKGROUND (BCACHE_MAX_BUFFERS / 10)	// The flusher starts writing above this
+#define BCACHE_DIRTY_LIMIT      (BCACHE_MAX_BUFFERS / 2)	// Writers get throttled above this
+#define BCACHE_FLUSH_INTERVAL   25
+
+typedef struct bcache_buffer {
+	blk_queue_t *queue;
+	uint32_t block;
+	volatile uint32_t flags;	// See BCACHE_FLAG_*
+	uint8_t *data;
+	blk_request_t req;
+	uint32_t dirty_since;
+	struct bcache_buffer *hash_next;
+	list_item_t lru_item;
+	list_item_t dirty_item;
+} bcache_buffer_t;
+
+void bcache_init(void);
+
+bcache_buffer_t *bcache_get(blk_queue_t *queue, uint32_t block);
+
+void bcache_prefetch(blk_queue_t *queue, uint32_t block, uint32_t count);
+
+void bcache_invalidate(blk_queue_t *queue, uint32_t block, uint32_t count);
+
+bool bcache_cached(blk_queue_t *queue, uint32_t block, uint32_t count);
+
+uint32_t bcache_read(blk_queue_t *queue, uint32_t offset, uint32_t size, uint8_t *buffer);
+uint32_t bcache_write(blk_queue_t *queue, uint32_t offset, uint32_t size, uint8_t *buffer);
+
+void bcache_writeback(blk_queue_t *queue, uint32_t max, bool expired_only);
+int bcache_sync(blk_queue_t *queue);
+
+#endif
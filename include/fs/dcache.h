@@ -0,0 +1,33 @@
+#ifndef __DCACHE_H
+#define __DCACHE_H
+
+#include "stdint.h"
+#include "stdbool.h"
+
+#define DCACHE_ENTRIES  512
+#define DCACHE_BUCKETS  256
+#define DCACHE_NAME_MAX 60	// Longer components are not cached
+
+/**
+ * Cached result of looking up one path component in a directory. Negative
+ * entries (child == NULL) remember that a name doesn't exist.
+ */
+typedef struct dcache_entry {
+	void *parent;
+	void *child;
+	uint32_t hash;
+	uint32_t generation;	// Negative entries are only valid for the generation they were made in
+	uint8_t len;
+	char name[DCACHE_NAME_MAX];
+	struct dcache_entry *hash_next;
+} dcache_entry_t;
+
+uint32_t dcache_hash(const char *name, uint32_t len);
+
+bool dcache_lookup(void *parent, const char *name, uint32_t len, uint32_t hash, void **child);
+
+void dcache_insert(void *parent, const char *name, uint32_t len, uint32_t hash, void *child);
+
+void dcache_invalidate_negative(void);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __FILE_H
+#define __FILE_H
+
+#include "stdint.h"
+#include "fs/vfs.h"
+#include "fs/readahead.h"
+
+#define FILE_MAX_FDS 64
+
+#define O_RDONLY     0x0
+#define O_WRONLY     0x1
+#define O_RDWR       0x2
+#define O_ACCMODE    0x3
+#define O_CREAT      0x40	// Create the file if it doesn't exist
+#define O_TRUNC      0x200
+#define O_APPEND     0x400	// Every write goes to the end of the file
+
+#define SEEK_SET     0
+#define SEEK_CUR     1
+#define SEEK_END     2
+
+/**
+ * An open file. Descriptors returned by file_dup() share it, and with it the
+ * position.
+ */
+typedef struct file {
+	vfs_node_t *node;		// Resolved once by file_open()
+	void *private;			// The node's driver data at open time
+	uint32_t pos;
+	uint32_t flags;			// O_* flags passed to file_open()
+	uint32_t refcount;		// Descriptors pointing here
+	ra_state_t ra;			// Read-ahead state of this stream
+} file_t;
+
+int file_open(const char *path, uint32_t flags);
+int file_close(int fd);
+int32_t file_read(int fd, void *buffer, uint32_t size);
+int32_t file_write(int fd, const void *buffer, uint32_t size);
+int32_t file_seek(int fd, int32_t offset, int whence);
+int file_dup(int fd);
+file_t *file_get(int fd);
+
+#endif
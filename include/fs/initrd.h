@@ -0,0 +1,57 @@
+#ifndef __INITRD_H
+#define __INITRD_H
+
+#include "stdint.h"
+#include "multiboot.h"
+#include "fs/vfs.h"
+#include "ds/hashtable.h"
+
+#define INITRD_MAX_MODULES 8
+#define INITRD_PATH_MAX    (155 + 1 + 100 + 1)	// ustar prefix, slash, name and NUL
+#define INITRD_DIR_SIZE    8
+
+#define TAR_BLOCK_SIZE     512
+#define TAR_TYPE_FILE      '0'
+#define TAR_TYPE_DIR       '5'
+
+typedef struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];		// Octal
+	char mtime[12];
+	char checksum[8];
+	char type;
+	char linkname[100];
+	char magic[6];		// "ustar" if the fields below are valid
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+} __attribute__((packed)) tar_header_t;
+
+typedef struct initrd_module {
+	uintptr_t start;
+	uintptr_t end;
+	char path[64];		// Where to mount it, from the module's command line
+} initrd_module_t;
+
+/**
+ * A file or directory of a mounted archive. File nodes point their device
+ * field at the data inside the module.
+ */
+typedef struct initrd_node {
+	vfs_dirent_t dirent;		// Must come first, the VFS hands out &dirent.node
+	hashtable_t *children;		// Directories: name to initrd_node_t
+	vfs_dirent_t *first_child;
+} initrd_node_t;
+
+uintptr_t initrd_reserve(struct multiboot *mboot);
+
+void initrd_init();
+
+#endif
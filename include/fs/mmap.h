@@ -0,0 +1,35 @@
+#ifndef __MMAP_H
+#define __MMAP_H
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "fs/vfs.h"
+#include "ds/list.h"
+#include "ds/radix.h"
+
+#define MMAP_BASE    0x20000000	// Right above the kernel heap
+#define MMAP_END     0x40000000
+
+#define PROT_READ    0x1
+#define PROT_WRITE   0x2
+
+#define MAP_SHARED   0x1		// Writes go to the file (on vfs_msync() or vfs_munmap())
+#define MAP_PRIVATE  0x2		// Writes go to a private copy of the page
+
+typedef struct vm_area {
+	list_item_t item;		// In address order
+	uintptr_t start;
+	uintptr_t end;
+	vfs_node_t *node;
+	uint32_t offset;		// Page aligned offset into the node
+	uint32_t prot;
+	uint32_t flags;
+	radix_tree_t copies;	// MAP_PRIVATE: pages copied on write, by index into the area
+} vm_area_t;
+
+void *vfs_mmap(vfs_node_t *node, uint32_t offset, uint32_t length, uint32_t prot, uint32_t flags);
+int vfs_msync(void *addr, uint32_t length);
+int vfs_munmap(void *addr, uint32_t length);
+bool vfs_mmap_fault(uintptr_t address, uint32_t err_code);
+
+#endif
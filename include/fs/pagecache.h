@@ -0,0 +1,26 @@
+#ifndef __PAGECACHE_H
+#define __PAGECACHE_H
+
+#include "stdint.h"
+#include "fs/vfs.h"
+#include "ds/radix.h"
+
+#define PAGECACHE_PAGE_SIZE 0x1000
+
+/**
+ * Pages of a node's data, by page index. Only nodes that are memory mapped get
+ * one; their reads and writes then go through it so they stay coherent with
+ * the mappings.
+ */
+typedef struct page_cache {
+	radix_tree_t pages;
+} page_cache_t;
+
+page_cache_t *pagecache_create(vfs_node_t *node);
+void *pagecache_get(vfs_node_t *node, uint32_t index);
+uint32_t pagecache_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
+void pagecache_update(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
+void pagecache_truncate(vfs_node_t *node, uint32_t length);
+void pagecache_destroy(vfs_node_t *node);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef __POLL_H
+#define __POLL_H
+
+#include "stdint.h"
+#include "fs/vfs.h"
+
+#define POLLIN       0x01	// Data can be read without blocking
+#define POLLOUT      0x04	// Data can be written without blocking
+#define POLLERR      0x08	// Always reported, no need to ask for it
+#define POLLHUP      0x10	// Same
+
+typedef struct pollset pollset_t;
+
+typedef struct poll_event {
+	uint32_t events;		// POLL* bits that became ready
+	void *data;				// As passed to pollset_add()
+} poll_event_t;
+
+uint32_t vfs_poll(vfs_node_t *node);
+void vfs_poll_notify(vfs_node_t *node, uint32_t events);
+
+pollset_t *pollset_create();
+void pollset_destroy(pollset_t *set);
+int pollset_add(pollset_t *set, vfs_node_t *node, uint32_t events, void *data);
+int pollset_remove(pollset_t *set, vfs_node_t *node);
+int pollset_wait(pollset_t *set, poll_event_t *events, uint32_t max, int32_t timeout);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef __RAMFS_H
+#define __RAMFS_H
+
+#include "stdint.h"
+#include "fs/vfs.h"
+#include "ds/radix.h"
+#include "ds/hashtable.h"
+
+#define RAMFS_PAGE_SIZE 0x1000
+#define RAMFS_DIR_SIZE  8	// Initial number of entries a directory's table is sized for
+
+/**
+ * A file or directory. File data lives in pages allocated as they are first
+ * written, so holes and unwritten tails cost nothing.
+ */
+typedef struct ramfs_node {
+	vfs_dirent_t dirent;		// Must come first, the VFS hands out &dirent.node
+	struct ramfs_node *parent;
+	union {
+		radix_tree_t pages;		// Files: page index to page
+		hashtable_t *children;	// Directories: name to ramfs_node_t, listed through dirent.next
+	};
+	vfs_dirent_t *first_child;
+} ramfs_node_t;
+
+vfs_node_t *ramfs_init();
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __READAHEAD_H
+#define __READAHEAD_H
+
+#include "stdint.h"
+
+#define RA_MIN_WINDOW 0x4000	// 16KB
+#define RA_MAX_WINDOW 0x80000	// 512KB
+
+/**
+ * Read-ahead state of a single stream (one per open file).
+ */
+typedef struct ra_state {
+	uint32_t prev_end;		// Where the previous read ended
+	uint32_t start;			// Start of the last prefetched window
+	uint32_t size;			// Size of the last prefetched window, 0 when not streaming
+	uint32_t async_start;	// Reading past this offset triggers the next window
+} ra_state_t;
+
+void ra_init(ra_state_t *ra);
+
+uint32_t ra_update(ra_state_t *ra, uint32_t offset, uint32_t size, uint32_t *ra_offset);
+
+#endif
@@ -2,63 +2,168 @@
 #define __VFS_H
 
 #include "stdint.h"
+#include "stdbool.h"
 #include "ds/hashtable.h"
+#include "ds/tree.h"
+#include "fs/readahead.h"
 
 typedef struct vfs_node vfs_node_t;
 typedef struct vfs_dirent vfs_dirent_t;
 typedef struct vfs_dir vfs_dir_t;
+typedef struct vfs_io vfs_io_t;
 
 typedef uint32_t (*vfs_read_t)(vfs_node_t *, uint32_t, uint32_t, uint8_t *);
 typedef uint32_t (*vfs_write_t)(vfs_node_t *, uint32_t, uint32_t, uint8_t *);
 typedef vfs_dirent_t* (*vfs_read_dir_t)(vfs_dir_t *, uint32_t);
 typedef vfs_dirent_t* (*vfs_write_dir_t)(vfs_dir_t *, uint32_t);
 typedef vfs_dirent_t* (*vfs_find_dir_t)(vfs_dir_t *, char *);
+typedef void (*vfs_readahead_t)(vfs_node_t *, void *, uint32_t, uint32_t);
+typedef int (*vfs_fsync_t)(vfs_node_t *);
+typedef vfs_node_t* (*vfs_create_t)(vfs_node_t *, const char *, uint32_t);
+typedef int (*vfs_unlink_t)(vfs_node_t *, const char *);
+typedef int (*vfs_truncate_t)(vfs_node_t *, uint32_t);
+typedef void* (*vfs_get_page_t)(vfs_node_t *, uint32_t);
+typedef int (*vfs_submit_t)(vfs_node_t *, vfs_io_t *);
+typedef uint32_t (*vfs_poll_t)(vfs_node_t *);
+typedef void (*vfs_io_done_t)(vfs_io_t *);
 
 #define VFS_MASK_FILE 0x1
 #define VFS_MASK_DIR 0x2
 #define VFS_MASK_DEVICE 0x3
 #define VFS_MASK_SYMLINK 0x4
 
-typedef struct vfs_node {
-	uint32_t mask;
-	uint32_t flags;
-	uint32_t length;
-	uint32_t inode;
+#define VFS_NAME_MAX 255
+
+/**
+ * Operations shared by all nodes of a filesystem or driver. Any of them may be
+ * NULL.
+ */
+typedef struct vfs_ops {
 	vfs_read_t read;
 	vfs_write_t write;
 	vfs_read_dir_t read_dir;
 	vfs_write_dir_t write_dir;
 	vfs_find_dir_t find_dir;
-	struct vfs_node *ptr;	// Used in symlinks
-	void * device; // Used to mount pipes, etc.
+	vfs_readahead_t readahead;	// Start fetching a range asynchronously, gets the open file's private data
+	vfs_fsync_t fsync;		// Write cached data back to the device
+	vfs_create_t create;	// Add a file or directory (by mask) to a directory
+	vfs_unlink_t unlink;
+	vfs_truncate_t truncate;
+	vfs_get_page_t get_page;	// For filesystems whose data already lives in pages, see pagecache_get()
+	vfs_submit_t submit;	// Start an asynchronous vfs_io_t, see vfs_submit()
+	vfs_poll_t poll;		// Current POLL* readiness, see vfs_poll()
+} vfs_ops_t;
+
+typedef struct vfs_node {
+	uint32_t mask;
+	uint32_t flags;
+	uint32_t length;
+	uint32_t inode;
+	const vfs_ops_t *ops;
+	void * device; // Driver data (pipe, disk queue, symlink target, ...)
+	struct page_cache *cache;	// Created when the node is first mapped
+	uint32_t mappings;		// vfs_mmap() areas, their pages must not be freed
 } vfs_node_t;
 
 typedef struct vfs_dirent {
 	vfs_node_t node;
-	char fname[128];
+	const char *fname;		// Interned, see vfs_intern()
 	struct vfs_dirent *next;
 } vfs_dirent_t;
 
 typedef struct vfs_dir {
 	vfs_node_t node;
-	char fname[128];
+	const char *fname;
 	vfs_dirent_t *entries;
 	vfs_dirent_t *last_entry;
 } vfs_dir_t;
 
+typedef struct vfs_iovec {
+	uint8_t *base;
+	uint32_t len;
+} vfs_iovec_t;
+
+#define VFS_IO_READ  0
+#define VFS_IO_WRITE 1
+
+/**
+ * Ring of completed I/Os. It has to be large enough for every I/O that
+ * completes into it before the owner pops them.
+ */
+typedef struct vfs_cq {
+	vfs_io_t **entries;
+	uint32_t size;			// Power of two
+	volatile uint32_t head;	// Next entry to pop
+	volatile uint32_t tail;	// Next entry to fill
+} vfs_cq_t;
+
+struct vfs_io {
+	// Filled in by the submitter
+	vfs_node_t *node;
+	uint8_t dir;			// VFS_IO_READ or VFS_IO_WRITE
+	uint32_t offset;
+	vfs_iovec_t *iov;		// Must stay valid until completion
+	uint32_t iovcnt;
+	vfs_io_done_t done;		// Called on completion, possibly from interrupt context. May be NULL.
+	vfs_cq_t *cq;			// Completion queue to post to, may be NULL
+	void *private;
+
+	// Set on completion
+	volatile bool complete;
+	uint32_t result;		// Bytes transferred
+	int status;				// 0 or -1
+
+	// Internal to the implementation
+	void *driver;
+	volatile uint32_t pending;
+};
+
 typedef struct vfs_entry {
-	char * name;
+	tree_node_t tree;	// Position in the mount tree
+	const char * name;
 	vfs_node_t *node;
 } vfs_entry_t;
 
 uint32_t vfs_read (vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
 
+uint32_t vfs_read_ra (vfs_node_t *node, void *private, ra_state_t *ra, uint32_t offset, uint32_t size, uint8_t *buffer);
+
 uint32_t vfs_write (vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
 
+int vfs_fsync (vfs_node_t *node);
+
+int vfs_sync (void);
+
+vfs_node_t *vfs_create (vfs_node_t *dir, const char *name, uint32_t mask);
+
+int vfs_unlink (vfs_node_t *dir, const char *name);
+
+int vfs_truncate (vfs_node_t *node, uint32_t length);
+
+int vfs_submit (vfs_io_t *io);
+
+void vfs_io_complete (vfs_io_t *io, uint32_t result, int status);
+
+void vfs_io_wait (vfs_io_t *io);
+
+uint32_t vfs_readv (vfs_node_t *node, uint32_t offset, vfs_iovec_t *iov, uint32_t iovcnt);
+
+uint32_t vfs_writev (vfs_node_t *node, uint32_t offset, vfs_iovec_t *iov, uint32_t iovcnt);
+
+void vfs_cq_init (vfs_cq_t *cq, vfs_io_t **entries, uint32_t size);
+
+vfs_io_t *vfs_cq_pop (vfs_cq_t *cq);
+
+vfs_io_t *vfs_cq_wait (vfs_cq_t *cq);
+
 vfs_dirent_t *vfs_read_dir (vfs_dir_t *dir, uint32_t inode);
 
 vfs_dirent_t *vfs_find_dir (vfs_dir_t *dir, char *fname);
 
+const char *vfs_intern(const char *name);
+
+void vfs_intern_put(const char *name);
+
 void vfs_install();
 
 void *vfs_mount(char *path, vfs_node_t *node);
@@ -93,6 +93,7 @@ extern void irq15();
 extern void init_idt();
 
 extern void register_interrupt_handler(uint8_t n, isr_t handler);
+extern int register_shared_interrupt_handler(uint8_t n, isr_t handler);
 
 static const char *irq_messages[32] = {
 	"Division by zero",
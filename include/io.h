@@ -11,6 +11,9 @@ uint32_t inl(uint16_t port);
 
 uint16_t ins(uint16_t _port);
 
+void insw(uint16_t port, void *buffer, uint32_t count);
+void outsw(uint16_t port, const void *buffer, uint32_t count);
+
 #define insl(port, buffer, count) asm volatile("cld; rep; insl" :: "D" (buffer), "d" (port), "c" (count))
 
 #endif
@@ -0,0 +1,92 @@
+#ifndef __LOG_H
+#define __LOG_H
+
+#include "stdint.h"
+#include <stdarg.h>
+
+// Severities, as in syslog
+#define LOG_EMERG   0
+#define LOG_ALERT   1
+#define LOG_CRIT    2
+#define LOG_ERR     3
+#define LOG_WARNING 4
+#define LOG_NOTICE  5
+#define LOG_INFO    6
+#define LOG_DEBUG   7
+
+// Messages less severe than this aren't compiled in, build with -DLOG_LEVEL=...
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_DEBUG
+#endif
+
+// Subsystems, filtered at runtime through log_masks
+#define LOG_SYS_KERNEL  0
+#define LOG_SYS_PAGING  1
+#define LOG_SYS_PMM     2
+#define LOG_SYS_HEAP    3
+#define LOG_SYS_VFS     4
+#define LOG_SYS_BLK     5
+#define LOG_SYS_ATA     6
+#define LOG_SYS_AHCI    7
+#define LOG_SYS_VIRTIO  8
+#define LOG_SYS_PS2     9
+#define LOG_SYS_KBD     10
+#define LOG_SYS_PIPE    11
+#define LOG_SYS_CONSOLE 12
+#define LOG_SYS_SERIAL  13
+#define LOG_SYS_COUNT   14
+
+// A source file picks its subsystem by defining LOG_SUBSYS before any include
+#ifndef LOG_SUBSYS
+#define LOG_SUBSYS LOG_SYS_KERNEL
+#endif
+
+#define LOG_RECORDS  256	// Power of two
+#define LOG_TAG_MAX  10
+#define LOG_TEXT_MAX 104	// Longer messages are cut off
+#define LOG_MAX_SINKS 4
+
+/**
+ * One message. The slot is reused LOG_RECORDS messages later, so readers copy
+ * it and check seq again afterwards.
+ */
+typedef struct log_record {
+	volatile uint32_t seq;	// Sequence number + 1 once written, 0 while being written
+	uint32_t ticks;
+	uint32_t stream_pos;	// Offset of the record in /dev/kmsg, set when it's drained
+	uint8_t level;
+	uint8_t len;
+	char tag[LOG_TAG_MAX];
+	char text[LOG_TEXT_MAX];
+} log_record_t;
+
+typedef void (*log_sink_t)(const char *, uint32_t);
+
+extern uint32_t log_masks[LOG_DEBUG + 1];	// Per level, the subsystems that get through
+extern const char *log_subsys_names[LOG_SYS_COUNT];
+
+/**
+ * Log through the filters: below LOG_LEVEL the call compiles to nothing, above
+ * it a disabled subsystem costs one test before any argument is evaluated.
+ */
+#define log_at(level, subsys, format, ...) do { \
+	if ((level) <= LOG_LEVEL && (log_masks[level] & (1 << (subsys)))) { \
+		klog(level, log_subsys_names[subsys], format, ##__VA_ARGS__); \
+	} \
+} while (0)
+
+#define log_err(format, ...)   log_at(LOG_ERR, LOG_SUBSYS, format, ##__VA_ARGS__)
+#define log_warn(format, ...)  log_at(LOG_WARNING, LOG_SUBSYS, format, ##__VA_ARGS__)
+#define log_info(format, ...)  log_at(LOG_INFO, LOG_SUBSYS, format, ##__VA_ARGS__)
+#define log_debug(format, ...) log_at(LOG_DEBUG, LOG_SUBSYS, format, ##__VA_ARGS__)
+
+void klog(uint8_t level, const char *tag, const char *format, ...);
+void vklog(uint8_t level, const char *tag, const char *format, va_list args);
+
+int log_add_sink(log_sink_t sink, uint8_t max_level);
+void log_set_level(uint32_t subsys, uint8_t level);
+int log_find_subsys(const char *name);
+void log_flush(void);
+void log_init(void);
+
+#endif
@@ -10,7 +10,9 @@ typedef struct page {
 	uint32_t user			: 1;	// User/Supervisor
 	uint32_t writethrough	: 1;	// Write Through
 	uint32_t cachedisable	: 1;	// Cache disabled
-	uint32_t unused			: 7;	// Ignored by CPU, available for use by OS
+	uint32_t accessed		: 1;	// Set by the CPU on any access
+	uint32_t dirty			: 1;	// Set by the CPU on a write
+	uint32_t unused			: 5;	// PAT, global and three bits available for use by OS
 	uintptr_t frame			: 20;	// Physical address of the 4KB frame
 } page_t;
 
@@ -32,6 +34,14 @@ page_t *get_page(uintptr_t address, int make, page_directory_t * dir);
 
 uintptr_t virt_to_phys(uintptr_t virt);
 
+void *map_mmio(uintptr_t phys, uint32_t size);
+
+void *dma_alloc_page(uintptr_t *phys);
+
+void *page_alloc(void);
+
+void page_free(void *page);
+
 void switch_page_directory(page_directory_t * dir);
 
 void page_fault(registers_t regs);
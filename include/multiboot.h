@@ -72,6 +72,13 @@ struct multiboot
 
 typedef struct multiboot_header multiboot_header_t; 
 
+typedef struct multiboot_module {
+	uint32_t mod_start;
+	uint32_t mod_end;
+	uint32_t cmdline;
+	uint32_t reserved;
+} __attribute__((packed)) multiboot_module_t;
+
 typedef struct {
 	uint32_t size;
 	uint64_t base_addr;
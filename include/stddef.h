@@ -3,10 +3,15 @@
 #include "stdint.h"
 
 #define _HAVE_SIZE_T
-typedef uint16_t size_t;
+typedef uint32_t size_t;
 
 #ifndef NULL
 #define NULL ((void *)0)
 #endif
 
+#define offsetof(type, member) __builtin_offsetof(type, member)
+
+// The structure a member pointer is embedded in
+#define container_of(ptr, type, member) ((type *)((uint8_t *)(ptr) - offsetof(type, member)))
+
 #endif
@@ -8,8 +8,8 @@ typedef signed short	int16_t;
 typedef unsigned short 	uint16_t;
 typedef signed int 	int32_t;
 typedef unsigned int 	uint32_t;
-typedef signed long int 	int64_t;
-typedef unsigned long int 	uint64_t;
+typedef signed long long 	int64_t;
+typedef unsigned long long 	uint64_t;
 
 // Integer types capable of holding pointers
 typedef int				intptr_t;
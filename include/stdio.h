@@ -2,7 +2,16 @@
 #define __STDIO_H
 
 #include <stdarg.h>
+#include "stddef.h"
+
+typedef void (*printf_sink_t)(const char *, size_t, void *);
 
 extern void kprintf(char * format, ...);
 
+int vsnprintf(char *buffer, size_t size, const char *format, va_list args);
+
+int snprintf(char *buffer, size_t size, const char *format, ...);
+
+int vprintf_sink(printf_sink_t sink, void *ctx, const char *format, va_list args);
+
 #endif
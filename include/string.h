@@ -2,10 +2,16 @@
 #define __STRING_H
 #include "stddef.h"
 
+void string_init(void);
+
 void *memset(void *str, char c, size_t n);
 
 void *memcpy(void *dst, const void *src, size_t len);
 
+void *memmove(void *dst, const void *src, size_t len);
+
+int memcmp(const void *ptr1, const void *ptr2, size_t len);
+
 int strcmp(const char * str1, const char *str2);
 
 char *strcpy (char *destination, const char *source);
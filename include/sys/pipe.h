@@ -17,7 +17,7 @@ int pipe_pop(pipe_t *pipe, uint32_t size, uint8_t *data);
 
 vfs_node_t *pipe_device_create(uint32_t length);
 
-int pipe_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *data);
-int pipe_write(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *data);
+uint32_t pipe_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *data);
+uint32_t pipe_write(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *data);
 
 #endif
@@ -2,10 +2,16 @@
 #define __TIMER_H
 #include <stdint.h>
 
+typedef void (*timer_handler_t)(uint32_t ticks);
+
 void init_timer(uint32_t frequency);
 
+int timer_register_handler(timer_handler_t handler, uint32_t interval);
+
 uint32_t get_timer_ticks();
 
+uint32_t timer_ms_to_ticks(uint32_t milliseconds);
+
 void sleep(int milliseconds);
 
 #endif
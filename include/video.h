@@ -4,8 +4,14 @@
 
 extern unsigned short *VIDEO_MEM;
 
+void video_init();
+
+void video_flush();
+
 void puts(const char c);
 
+void video_write(const char *str, uint32_t len);
+
 void cls();
 
 void write_at(char *string, uint8_t x, uint8_t y);
@@ -29,3 +29,13 @@ uint16_t ins(uint16_t _port) {
 	asm volatile ("inw %1, %0" : "=a" (rv) : "dN" (_port));
 	return rv;
 }
+
+void insw(uint16_t port, void *buffer, uint32_t count)
+{
+	asm volatile ("cld; rep insw" : "+D" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+void outsw(uint16_t port, const void *buffer, uint32_t count)
+{
+	asm volatile ("cld; rep outsw" : "+S" (buffer), "+c" (count) : "d" (port) : "memory");
+}
@@ -5,21 +5,30 @@
 #include "mem/pmm.h"
 #include "interrupts.h"
 #include "timer.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "string.h"
 #include "stddef.h"
 #include "elf.h"
 #include "debug.h"
+#include "log.h"
 #include "stdio.h"
 #include "stdlib.h"
 #include "mem/kmalloc.h"
 #include "mem/paging.h"
 #include "mem/liballoc/liballoc.h"
 #include "console/console.h"
-#include "fs/ramdisk.h"
+#include "fs/ramfs.h"
+#include "fs/initrd.h"
+#include "fs/bcache.h"
 #include "dev/ps2.h"
 #include "dev/kbd.h"
 #include "sys/pipe.h"
 #include "dev/pci.h"
 #include "dev/ata.h"
+#include "dev/ahci.h"
+#include "dev/virtio_blk.h"
+#include "dev/serial.h"
 
 #if 1
 extern pipe_t *kbd_pipe;
@@ -29,13 +38,23 @@ extern uintptr_t end; // Defined in linker script
 uintptr_t kernel_end = 0;
 uint32_t initial_esp;
 multiboot_elf_section_header_table_t copied_elf_header;
-vfs_dir_t *fs_root;
+vfs_node_t *fs_root;
 
 void kmain(struct multiboot *mboot_ptr, unsigned int initial_stack)
 {
+	// Everything below may depend on CPU features, string functions included
+	cpu_init();
+	string_init();
+
 	// Mark where we end
 	kernel_end = (uintptr_t) &end;
 
+	// Boot modules are used in place, so keep the placement allocator behind them
+	uintptr_t modules_end = initrd_reserve(mboot_ptr);
+	if (modules_end > kernel_end) {
+		kernel_end = modules_end;
+	}
+
 	pmm_set_kernel_end(kernel_end); // Now kmalloc() works!
 
 	// Get initial stack location
@@ -56,7 +75,7 @@ void kmain(struct multiboot *mboot_ptr, unsigned int initial_stack)
 		mboot_memmap_t* mmap = mboot_ptr->mmap_addr;
 		while(mmap < mboot_ptr->mmap_addr + mboot_ptr->mmap_length) {
 			mmap = (mboot_memmap_t*) ( (unsigned int)mmap + mmap->size + sizeof(mmap->size) );
-			debug("\tFound memory region: 0x%x length: 0x%x type: %x.\n", mmap->base_addr, mmap->length, mmap->type);
+			debug("\tFound memory region: 0x%llx length: 0x%llx type: %x.\n", mmap->base_addr, mmap->length, mmap->type);
 		}
 	}
 
@@ -74,6 +93,7 @@ void kmain(struct multiboot *mboot_ptr, unsigned int initial_stack)
 
 	kprintf("OS loading...\n");
 	debug("Stack is at 0x%x.\n", initial_esp);
+	debug("CPU: %s family 0x%x model 0x%x, features 0x%x\n", cpu_info.vendor, cpu_info.family, cpu_info.model, cpu_info.features);
 
 	kprintf("Loading GDT...");
 	debug("Loading GDT\n");
@@ -88,6 +108,8 @@ void kmain(struct multiboot *mboot_ptr, unsigned int initial_stack)
 
 	kprintf("[ OK ]\n");
 
+	fpu_init();
+
 	debug("Enabling interrupts\n");
 	__asm__ __volatile__ ("sti");
 	debug("Interrupts enabled\n");
@@ -119,29 +141,51 @@ void kmain(struct multiboot *mboot_ptr, unsigned int initial_stack)
 	kprintf(" [ OK ]\n");
 
 	kprintf("Initializing RAMFS");
-	fs_root = ramdisk_init();
+	fs_root = ramfs_init();
+	kprintf(" [ OK ]\n");
+
+	kprintf("Mounting initrd");
+	initrd_init();
+	kprintf(" [ OK ]\n");
+
+	kprintf("Initializing block cache");
+	bcache_init();
 	kprintf(" [ OK ]\n");
 
 	kprintf("Initializing (P/S)ATA devices");
 	ata_init();
 	kprintf(" [ OK ]\n");
 
+	kprintf("Initializing AHCI controllers");
+	ahci_init();
+	kprintf(" [ OK ]\n");
+
+	kprintf("Initializing virtio block devices");
+	virtio_blk_init();
+	kprintf(" [ OK ]\n");
+
 #if 0
-	vfs_dirent_t *dev = vfs_read_dir(fs_root, 2);
-	if (dev) {
-		debug("Inode 2: %s%s\n", fs_root->fname, dev->fname);
-		uint8_t *buff = (uint8_t *)kmalloc(sizeof (uint8_t));
+	vfs_node_t *test = vfs_create(fs_root, "test", VFS_MASK_FILE);
+	if (test) {
+		uint8_t *buff = (uint8_t *)kmalloc(32);
 		char *b2 = "TESTING123";
-		vfs_write(&dev->node, 0, sizeof(char) * 11, b2);
-		vfs_read(&dev->node, 0, 32, buff);
+		vfs_write(test, 0, sizeof(char) * 11, (uint8_t *)b2);
+		vfs_read(test, 0, 32, buff);
 		debug("\tContents: %s\n", buff);
+		vfs_unlink(fs_root, "test");
 	} else {
-		debug("Could not find /dev!\n");
+		log_err("Could not create /test!\n");
 	}
 #endif
 
 	kprintf("Init timer");
 	init_timer(50);
+	video_init();
+	log_init();
+	kprintf(" [ OK ]\n");
+
+	kprintf("Init serial ports");
+	serial_init();
 	kprintf(" [ OK ]\n");
 
 	kprintf("Init PS/2");
@@ -1,3 +1,5 @@
+#define LOG_SUBSYS LOG_SYS_HEAP
+
 #include "mem/kheap.h"
 #include "stdint.h"
 #include "mem/paging.h"
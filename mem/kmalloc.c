@@ -1,3 +1,5 @@
+#define LOG_SUBSYS LOG_SYS_HEAP
+
 #include "mem/kmalloc.h"
 #include "mem/pmm.h"
 #include "mem/liballoc/liballoc.h"
@@ -1,3 +1,5 @@
+#define LOG_SUBSYS LOG_SYS_HEAP
+
 #include <mem/liballoc/liballoc.h>
 
 /**  Durand's Amazing Super Duper Memory functions.  */
@@ -208,7 +210,7 @@ static struct liballoc_major *allocate_new_page( unsigned int size )
 		{
 			l_warningCount += 1;
 			#if defined DEBUG || defined INFO
-			debug("liballoc: WARNING: liballoc_alloc( %i ) return NULL\n", st );
+			log_warn("liballoc: WARNING: liballoc_alloc( %i ) return NULL\n", st );
 			FLUSH();
 			#endif
 			return NULL;	// uh oh, we ran out of memory.
@@ -263,7 +265,7 @@ void *PREFIX(malloc)(size_t req_size)
 	{
 		l_warningCount += 1;
 		#if defined DEBUG || defined INFO
-		debug("liballoc: WARNING: alloc( 0 ) called from %x\n",
+		log_warn("liballoc: WARNING: alloc( 0 ) called from %x\n",
 							__builtin_return_address(0) );
 		FLUSH();
 		#endif
@@ -288,7 +290,7 @@ void *PREFIX(malloc)(size_t req_size)
 		{
 		  liballoc_unlock();
 		  #ifdef DEBUG
-		  debug("liballoc: initial l_memRoot initialization failed\n", p);
+		  log_err("liballoc: initial l_memRoot initialization failed\n", p);
 		  FLUSH();
 		  #endif
 		  return NULL;
@@ -572,11 +574,11 @@ void *PREFIX(malloc)(size_t req_size)
 	liballoc_unlock();		// release the lock
 
 	#ifdef DEBUG
-	debug("All cases exhausted. No memory available.\n");
+	log_err("All cases exhausted. No memory available.\n");
 	FLUSH();
 	#endif
 	#if defined DEBUG || defined INFO
-	debug("liballoc: WARNING: PREFIX(malloc)( %i ) returning NULL.\n", size);
+	log_warn("liballoc: WARNING: PREFIX(malloc)( %i ) returning NULL.\n", size);
 	liballoc_dump();
 	FLUSH();
 	#endif
@@ -600,7 +602,7 @@ void PREFIX(free)(void *ptr)
 	{
 		l_warningCount += 1;
 		#if defined DEBUG || defined INFO
-		debug("liballoc: WARNING: PREFIX(free)( NULL ) called from %x\n",
+		log_warn("liballoc: WARNING: PREFIX(free)( NULL ) called from %x\n",
 							__builtin_return_address(0) );
 		FLUSH();
 		#endif
@@ -628,7 +630,7 @@ void PREFIX(free)(void *ptr)
 		{
 			l_possibleOverruns += 1;
 			#if defined DEBUG || defined INFO
-			debug("liballoc: ERROR: Possible 1-3 byte overrun for magic %x != %x\n",
+			log_err("liballoc: ERROR: Possible 1-3 byte overrun for magic %x != %x\n",
 								min->magic,
 								LIBALLOC_MAGIC );
 			FLUSH();
@@ -639,7 +641,7 @@ void PREFIX(free)(void *ptr)
 		if ( min->magic == LIBALLOC_DEAD )
 		{
 			#if defined DEBUG || defined INFO
-			debug("liballoc: ERROR: multiple PREFIX(free)() attempt on %x from %x.\n",
+			log_err("liballoc: ERROR: multiple PREFIX(free)() attempt on %x from %x.\n",
 									ptr,
 									__builtin_return_address(0) );
 			FLUSH();
@@ -648,7 +650,7 @@ void PREFIX(free)(void *ptr)
 		else
 		{
 			#if defined DEBUG || defined INFO
-			debug("liballoc: ERROR: Bad PREFIX(free)( %x ) called from %x\n",
+			log_err("liballoc: ERROR: Bad PREFIX(free)( %x ) called from %x\n",
 								ptr,
 								__builtin_return_address(0) );
 			FLUSH();
@@ -774,7 +776,7 @@ void*   PREFIX(realloc)(void *p, size_t size)
 			{
 				l_possibleOverruns += 1;
 				#if defined DEBUG || defined INFO
-				debug("liballoc: ERROR: Possible 1-3 byte overrun for magic %x != %x\n",
+				log_err("liballoc: ERROR: Possible 1-3 byte overrun for magic %x != %x\n",
 									min->magic,
 									LIBALLOC_MAGIC );
 				FLUSH();
@@ -785,7 +787,7 @@ void*   PREFIX(realloc)(void *p, size_t size)
 			if ( min->magic == LIBALLOC_DEAD )
 			{
 				#if defined DEBUG || defined INFO
-				debug("liballoc: ERROR: multiple PREFIX(free)() attempt on %x from %x.\n",
+				log_err("liballoc: ERROR: multiple PREFIX(free)() attempt on %x from %x.\n",
 										ptr,
 										__builtin_return_address(0) );
 				FLUSH();
@@ -794,7 +796,7 @@ void*   PREFIX(realloc)(void *p, size_t size)
 			else
 			{
 				#if defined DEBUG || defined INFO
-				debug("liballoc: ERROR: Bad PREFIX(free)( %x ) called from %x\n",
+				log_err("liballoc: ERROR: Bad PREFIX(free)( %x ) called from %x\n",
 									ptr,
 									__builtin_return_address(0) );
 				FLUSH();
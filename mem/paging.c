@@ -1,7 +1,10 @@
+#define LOG_SUBSYS LOG_SYS_PAGING
+
 #include "mem/paging.h"
 #include "mem/pmm.h"
 #include "mem/kmalloc.h"
 #include "mem/kheap.h"
+#include "fs/mmap.h"
 #include "sys/bitmap.h"
 #include "string.h"
 #include "stdint.h"
@@ -19,9 +22,12 @@ extern bitmap_t *pmm_map;
 extern uintptr_t *heap_start;
 extern uint32_t heap_size;
 extern uintptr_t heap_ptr;
+extern uintptr_t heap_end;
 
 spinlock_t alloc_slock;
 
+static void *page_free_list = NULL;	// Each free page holds a pointer to the next
+
 /**
  * Map a page to an address in the physical memory
  */
@@ -65,6 +71,90 @@ debug("MAP_DMA_PAGE: Mapped DMA page for 0x%x\n", address);
 	bitmap_set(pmm_map, ((uint32_t)address / 0x1000));
 }
 
+/**
+ * Identity-map a device's register window, uncached. Unlike map_dma_page() this
+ * leaves the frame bitmap alone since the range isn't RAM.
+ *
+ * returns: the virtual address of phys.
+ */
+void *map_mmio(uintptr_t phys, uint32_t size)
+{
+	for (uintptr_t i = phys & ~0xFFF; i < phys + size; i += 0x1000) {
+		uint32_t table_idx = i / 0x1000 / 1024;
+
+		if (!current_directory->tables[table_idx]) {
+			// get_page() would take the table from the heap, which isn't page aligned
+			uint8_t *mem = (uint8_t *)kmalloc(sizeof(page_table_t) + 0x1000);
+			page_table_t *table = (page_table_t *)(((uintptr_t)mem + 0xFFF) & ~0xFFF);
+			memset(table, 0, sizeof(page_table_t));
+
+			current_directory->tables[table_idx] = table;
+			current_directory->tables_phys[table_idx] = virt_to_phys((uintptr_t)table) | 0x3;
+			// Share the table with directories cloned from now on
+			kernel_directory->tables[table_idx] = table;
+			kernel_directory->tables_phys[table_idx] = current_directory->tables_phys[table_idx];
+		}
+
+		page_t *page = &current_directory->tables[table_idx]->pages[(i / 0x1000) % 1024];
+		page->present = 1;
+		page->rw = 1;
+		page->user = 0;
+		page->writethrough = 1;
+		page->cachedisable = 1;
+		page->frame = i / 0x1000;
+
+		asm volatile ("invlpg (%0)" :: "r"(i) : "memory");
+	}
+
+	return (void *)phys;
+}
+
+/**
+ * Allocate a zeroed, page aligned page for a device to DMA to and from. Heap
+ * memory is only physically contiguous within a page, so larger buffers have to
+ * be described page by page. These are never freed.
+ */
+void *dma_alloc_page(uintptr_t *phys)
+{
+	void *page = sbrk(1);
+
+	if (phys) {
+		*phys = virt_to_phys((uintptr_t)page);
+	}
+
+	return page;
+}
+
+/**
+ * Allocate a zeroed, page aligned page of kernel memory. Pages given back with
+ * page_free() are reused before the heap grows.
+ */
+void *page_alloc(void)
+{
+	uint32_t flags = irq_save();
+	void *page = page_free_list;
+	if (page) {
+		page_free_list = *(void **)page;
+	}
+	irq_restore(flags);
+
+	if (!page) {
+		return sbrk(1);
+	}
+
+	memset(page, 0, 0x1000);
+
+	return page;
+}
+
+void page_free(void *page)
+{
+	uint32_t flags = irq_save();
+	*(void **)page = page_free_list;
+	page_free_list = page;
+	irq_restore(flags);
+}
+
 void paging_init()
 {
 	// Allocate some memory for the kernel page directory
@@ -82,7 +172,7 @@ void paging_init()
 
 	debug("PAGING: Mapping 0x1000 to 0x%x\n", (placement_pointer + 0x3000));
 	for (uintptr_t i = 0x1000; i < (placement_pointer + 0x3000); i+= 0x1000) {
-		map_dma_page(get_page(i, 1, kernel_directory), 0, 1, i);
+		map_dma_page(get_page(i, 1, kernel_directory), 1, 1, i);
 	}
 	debug("PAGING: [DONE] Mapping 0x1000 to 0x%x\n", (placement_pointer + 0x3000));
 
@@ -100,7 +190,7 @@ void paging_init()
 
 	/* Kernel Heap Space */
 	for (uintptr_t i = placement_pointer + 0x3000; i < heap_ptr; i += 0x1000) {
-		map_page(get_page(i, 1, kernel_directory), 0, 1);
+		map_page(get_page(i, 1, kernel_directory), 1, 1);
 	}
 
 	debug("PAGING: Preallocating heap starting at 0x%x.\n", heap_start);
@@ -143,7 +233,13 @@ page_t *get_page(uintptr_t address, int make, page_directory_t * dir)
 		return &dir->tables[table_idx]->pages[address % 1024]; // Return the page's address. (address % 1024 is the offset into the table)
 	} else if (make) { // Could not find the requested page but we were asked to create it, so.......
 		uint32_t tmp; // This will temporarily hold the physical address of the new table
-		dir->tables[table_idx] = (page_table_t *) kmalloc_p(sizeof(page_table_t), (uintptr_t *)(&tmp)); // Allocate some memory for the new table
+		if (heap_end) {
+			// liballoc doesn't align its allocations, tables have to be page aligned
+			dir->tables[table_idx] = (page_table_t *) page_alloc();
+			tmp = virt_to_phys((uintptr_t)dir->tables[table_idx]);
+		} else {
+			dir->tables[table_idx] = (page_table_t *) kmalloc_p(sizeof(page_table_t), (uintptr_t *)(&tmp)); // Allocate some memory for the new table
+		}
 		memset(dir->tables[table_idx], 0, sizeof(page_table_t)); // Clear the entire table
 		dir->tables_phys[table_idx] = tmp | 0x7; // Load the physical address, set flags (Present, RW, User-mode)
 
@@ -151,7 +247,7 @@ page_t *get_page(uintptr_t address, int make, page_directory_t * dir)
 
 		return &dir->tables[table_idx]->pages[address % 1024]; // Same as above, return the page's address.
 	} else { // Could not find the requested page and we were not asked to create one
-		debug("PAGING: Could not find a page for address 0x%x!\n", (address * 0x1000));
+		log_err("PAGING: Could not find a page for address 0x%x!\n", (address * 0x1000));
 		return NULL; // NULL pointer
 	}
 }
@@ -180,7 +276,7 @@ void switch_page_directory(page_directory_t * dir)
 	asm volatile (
 			"mov %0, %%cr3\n"
 			"mov %%cr0, %%eax\n"
-			"orl $0x80000000, %%eax\n"
+			"orl $0x80010000, %%eax\n"	// PG, and WP so read-only pages fault in ring 0 too
 			"mov %%eax, %%cr0\n"
 			:: "r"(dir->phys_address)
 			: "%eax");
@@ -197,6 +293,11 @@ void page_fault(registers_t regs)
 	int reserved = regs.err_code & 0x8;     // Overwritten CPU-reserved bits of page entry?
 	int id = regs.err_code & 0x10;          // Caused by an instruction fetch?
 
+	// Mapped files are paged in on first access
+	if (vfs_mmap_fault(faulting_address, regs.err_code)) {
+		return;
+	}
+
 	PANIC("Page fault! at 0x%x (EIP: 0x%x p: %d, rw: %d, us: %d, reserved: %d, i: %d)\n",
 				faulting_address, regs.eip, present, rw, us, reserved, id);
 }
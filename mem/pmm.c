@@ -1,3 +1,5 @@
+#define LOG_SUBSYS LOG_SYS_PMM
+
 #include "mem/pmm.h"
 #include "mem/kmalloc.h"
 #include "sys/bitmap.h"
@@ -0,0 +1,336 @@
+#include "stdio.h"
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include <stdarg.h>
+
+#define PRINTF_BUFFER_SIZE 128	// Chunk size handed to sinks
+#define PRINTF_NUM_SIZE 65		// Longest number: 64 binary digits and a sign
+
+#define PRINTF_LEFT  0x1	// '-'
+#define PRINTF_ZERO  0x2	// '0'
+#define PRINTF_UPPER 0x4	// %X
+
+typedef struct printf_out {
+	char *buffer;
+	size_t size;		// Including room for the terminator when there's no sink
+	size_t pos;
+	size_t total;		// Length of the whole output
+	printf_sink_t sink;	// Takes full buffers, NULL to truncate instead
+	void *ctx;
+} printf_out_t;
+
+static const char printf_pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+static const char printf_digits[] = "0123456789abcdef0123456789ABCDEF";
+
+static void printf_putc(printf_out_t *out, char c)
+{
+	out->total++;
+
+	if (out->sink) {
+		if (out->pos == out->size) {
+			out->sink(out->buffer, out->pos, out->ctx);
+			out->pos = 0;
+		}
+	} else if (out->pos + 1 >= out->size) {
+		return;
+	}
+
+	out->buffer[out->pos++] = c;
+}
+
+static void printf_pad(printf_out_t *out, char c, int32_t count)
+{
+	while (count-- > 0) {
+		printf_putc(out, c);
+	}
+}
+
+/**
+ * Divide *n by base with two 32 bit divisions, there is no libgcc for a
+ * 64 bit one.
+ *
+ * returns: the remainder.
+ */
+static uint32_t printf_div64(uint64_t *n, uint32_t base)
+{
+	uint32_t high = *n >> 32;
+	uint32_t low = (uint32_t)*n;
+	uint32_t qhigh = high / base;
+	uint32_t qlow;
+	uint32_t rem;
+
+	high %= base;
+	__asm__ ("divl %4" : "=a" (qlow), "=d" (rem) : "a" (low), "d" (high), "rm" (base));
+
+	*n = ((uint64_t)qhigh << 32) | qlow;
+
+	return rem;
+}
+
+/**
+ * Write value in decimal, two digits per division, ending right before end.
+ *
+ * returns: the first digit.
+ */
+static char *printf_utoa10(char *end, uint32_t value)
+{
+	while (value >= 100) {
+		const char *pair = &printf_pairs[(value % 100) * 2];
+		value /= 100;
+		*--end = pair[1];
+		*--end = pair[0];
+	}
+
+	if (value >= 10) {
+		*--end = printf_pairs[value * 2 + 1];
+		*--end = printf_pairs[value * 2];
+	} else {
+		*--end = '0' + value;
+	}
+
+	return end;
+}
+
+static char *printf_u64toa10(char *end, uint64_t value)
+{
+	// Nine digits at a time until the rest fits 32 bits
+	while (value > 0xFFFFFFFF) {
+		char *chunk_end = end;
+		end = printf_utoa10(end, printf_div64(&value, 1000000000));
+		while (end > chunk_end - 9) {
+			*--end = '0';
+		}
+	}
+
+	return printf_utoa10(end, (uint32_t)value);
+}
+
+static char *printf_utoa_pow2(char *end, uint64_t value, uint32_t shift, uint32_t flags)
+{
+	const char *digits = printf_digits + (flags & PRINTF_UPPER ? 16 : 0);
+	uint32_t mask = (1 << shift) - 1;
+
+	do {
+		*--end = digits[(uint32_t)value & mask];
+		value >>= shift;
+	} while (value);
+
+	return end;
+}
+
+static void printf_number(printf_out_t *out, uint64_t value, bool negative, uint32_t base, uint32_t flags, int32_t width)
+{
+	char num[PRINTF_NUM_SIZE];
+	char *end = num + sizeof(num);
+	char *start;
+
+	if (base == 10) {
+		start = printf_u64toa10(end, value);
+	} else {
+		start = printf_utoa_pow2(end, value, base == 16 ? 4 : base == 8 ? 3 : 1, flags);
+	}
+
+	int32_t len = (end - start) + (negative ? 1 : 0);
+
+	if (!(flags & (PRINTF_LEFT | PRINTF_ZERO))) {
+		printf_pad(out, ' ', width - len);
+	}
+	if (negative) {
+		printf_putc(out, '-');
+	}
+	if ((flags & (PRINTF_LEFT | PRINTF_ZERO)) == PRINTF_ZERO) {
+		printf_pad(out, '0', width - len);
+	}
+	while (start < end) {
+		printf_putc(out, *start++);
+	}
+	if (flags & PRINTF_LEFT) {
+		printf_pad(out, ' ', width - len);
+	}
+}
+
+static void printf_string(printf_out_t *out, const char *str, uint32_t flags, int32_t width, int32_t precision)
+{
+	if (!str) {
+		str = "(null)";
+	}
+
+	int32_t len = 0;
+	while (str[len] && (precision < 0 || len < precision)) {
+		len++;
+	}
+
+	if (!(flags & PRINTF_LEFT)) {
+		printf_pad(out, ' ', width - len);
+	}
+	for (int32_t i = 0; i < len; i++) {
+		printf_putc(out, str[i]);
+	}
+	if (flags & PRINTF_LEFT) {
+		printf_pad(out, ' ', width - len);
+	}
+}
+
+/**
+ * The formatting engine behind every printf-like function. Supports the flags
+ * '-' and '0', a width and precision (either may be '*'), the length modifiers
+ * l, ll, z and h, and the conversions d i u x X o b p c s %.
+ */
+static void printf_format(printf_out_t *out, const char *format, va_list args)
+{
+	for (; *format; format++) {
+		if (*format != '%') {
+			printf_putc(out, *format);
+			continue;
+		}
+
+		const char *spec = format++;
+		uint32_t flags = 0;
+		int32_t width = 0;
+		int32_t precision = -1;
+		bool wide = false;
+
+		for (;; format++) {
+			if (*format == '-') {
+				flags |= PRINTF_LEFT;
+			} else if (*format == '0') {
+				flags |= PRINTF_ZERO;
+			} else {
+				break;
+			}
+		}
+
+		if (*format == '*') {
+			width = va_arg(args, int32_t);
+			if (width < 0) {
+				flags |= PRINTF_LEFT;
+				width = -width;
+			}
+			format++;
+		} else {
+			while (*format >= '0' && *format <= '9') {
+				width = width * 10 + (*format++ - '0');
+			}
+		}
+
+		if (*format == '.') {
+			format++;
+			precision = 0;
+			if (*format == '*') {
+				precision = va_arg(args, int32_t);
+				format++;
+			} else {
+				while (*format >= '0' && *format <= '9') {
+					precision = precision * 10 + (*format++ - '0');
+				}
+			}
+		}
+
+		// long and size_t are 32 bits wide, short is promoted to int anyway
+		while (*format == 'l' || *format == 'z' || *format == 'h') {
+			if (format[0] == 'l' && format[1] == 'l') {
+				wide = true;
+				format++;
+			}
+			format++;
+		}
+
+		uint64_t value;
+		int64_t svalue;
+
+		switch (*format) {
+			case '%':
+				printf_putc(out, '%');
+				break;
+			case 'c':
+				printf_putc(out, (char)va_arg(args, int));
+				break;
+			case 's':
+				printf_string(out, va_arg(args, const char *), flags, width, precision);
+				break;
+			case 'd':
+			case 'i':
+				svalue = wide ? va_arg(args, int64_t) : va_arg(args, int32_t);
+				value = svalue < 0 ? 0 - (uint64_t)svalue : (uint64_t)svalue;
+				printf_number(out, value, svalue < 0, 10, flags, width);
+				break;
+			case 'u':
+			case 'x':
+			case 'X':
+			case 'o':
+			case 'b':
+				value = wide ? va_arg(args, uint64_t) : va_arg(args, uint32_t);
+				if (*format == 'X') {
+					flags |= PRINTF_UPPER;
+				}
+				printf_number(out, value, false, *format == 'u' ? 10 : *format == 'o' ? 8 : *format == 'b' ? 2 : 16, flags, width);
+				break;
+			case 'p':
+				printf_putc(out, '0');
+				printf_putc(out, 'x');
+				printf_number(out, (uintptr_t)va_arg(args, void *), false, 16, PRINTF_ZERO, sizeof(void *) * 2);
+				break;
+			default:
+				// Not a conversion we know, print it as it is
+				for (; spec <= format && *spec; spec++) {
+					printf_putc(out, *spec);
+				}
+				if (!*format) {
+					return;
+				}
+				break;
+		}
+	}
+}
+
+/**
+ * Format into buffer, truncating to size - 1 characters. The result is always
+ * terminated unless size is 0.
+ *
+ * returns: the length of the full output, which may be more than what fit.
+ */
+int vsnprintf(char *buffer, size_t size, const char *format, va_list args)
+{
+	printf_out_t out = {.buffer = buffer, .size = size, .pos = 0, .total = 0, .sink = NULL, .ctx = NULL};
+
+	printf_format(&out, format, args);
+
+	if (size) {
+		buffer[out.pos] = '\0';
+	}
+
+	return out.total;
+}
+
+int snprintf(char *buffer, size_t size, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	int ret = vsnprintf(buffer, size, format, args);
+	va_end(args);
+
+	return ret;
+}
+
+/**
+ * Format through a small buffer on the stack, handing it to sink whenever it
+ * fills up and once at the end. Output of any length gets through in a few
+ * calls instead of one per character.
+ *
+ * returns: the length of the output.
+ */
+int vprintf_sink(printf_sink_t sink, void *ctx, const char *format, va_list args)
+{
+	char buffer[PRINTF_BUFFER_SIZE];
+	printf_out_t out = {.buffer = buffer, .size = sizeof(buffer), .pos = 0, .total = 0, .sink = sink, .ctx = ctx};
+
+	printf_format(&out, format, args);
+
+	if (out.pos) {
+		sink(buffer, out.pos, ctx);
+	}
+
+	return out.total;
+}
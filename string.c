@@ -1,47 +1,195 @@
 #include "string.h"
+#include "cpu.h"
+#include "stdint.h"
+#include "stdbool.h"
 #include "mem/kmalloc.h"
 
+#define STRING_ERMS_MIN 128	// Below this rep movsb/stosb start up slower than the dword versions
+
+// Picked by string_init() once the CPU's features are known
+static bool string_erms = false;
+
+static inline void copy_dwords(void *dst, const void *src, size_t len)
+{
+	size_t dwords = len >> 2;
+	size_t bytes = len & 3;
+
+	__asm__ __volatile__ ("rep movsl" : "+D" (dst), "+S" (src), "+c" (dwords) :: "memory");
+	__asm__ __volatile__ ("rep movsb" : "+D" (dst), "+S" (src), "+c" (bytes) :: "memory");
+}
+
+static inline void copy_bytes(void *dst, const void *src, size_t len)
+{
+	__asm__ __volatile__ ("rep movsb" : "+D" (dst), "+S" (src), "+c" (len) :: "memory");
+}
+
+void string_init(void)
+{
+	string_erms = cpu_has_feature(CPU_FEATURE_ERMS);
+}
+
 void *memset(void *str, char c, size_t n)
 {
-	uint8_t *s = (uint8_t *)str;
-	for( ; n != 0; n--, s[n] = c);
+	void *dst = str;
+
+	if (string_erms && n >= STRING_ERMS_MIN) {
+		__asm__ __volatile__ ("rep stosb" : "+D" (dst), "+c" (n) : "a" (c) : "memory");
+		return str;
+	}
+
+	uint32_t pattern = (uint8_t)c * 0x01010101;
+	size_t dwords = n >> 2;
+	size_t bytes = n & 3;
+
+	__asm__ __volatile__ ("rep stosl" : "+D" (dst), "+c" (dwords) : "a" (pattern) : "memory");
+	__asm__ __volatile__ ("rep stosb" : "+D" (dst), "+c" (bytes) : "a" (pattern) : "memory");
+
 	return str;
 }
 
 void *memcpy(void *dst, const void *src, size_t len)
 {
-	size_t i;
-	char *d = dst;
-	const char *s = src;
-	for (i=0; i<len; i++) {
-		d[i] = s[i];
+	if (string_erms && len >= STRING_ERMS_MIN) {
+		copy_bytes(dst, src, len);
+	} else {
+		copy_dwords(dst, src, len);
 	}
+
 	return dst;
 }
 
+/**
+ * Copy between buffers that may overlap.
+ */
+void *memmove(void *dst, const void *src, size_t len)
+{
+	uint8_t *d = (uint8_t *)dst;
+	const uint8_t *s = (const uint8_t *)src;
+
+	if (d <= s || d >= s + len) {
+		// A forward copy never overwrites what it has yet to read
+		return memcpy(dst, src, len);
+	}
+
+	// Copy from the end: the trailing bytes, then the dwords below them
+	d += len;
+	s += len;
+	for (size_t bytes = len & 3; bytes > 0; bytes--) {
+		*--d = *--s;
+	}
+
+	size_t dwords = len >> 2;
+	if (dwords) {
+		d -= 4;
+		s -= 4;
+		__asm__ __volatile__ ("std; rep movsl; cld" : "+D" (d), "+S" (s), "+c" (dwords) :: "memory");
+	}
+
+	return dst;
+}
+
+int memcmp(const void *ptr1, const void *ptr2, size_t len)
+{
+	const uint8_t *a = ptr1;
+	const uint8_t *b = ptr2;
+
+	for (size_t i = 0; i < len; i++) {
+		if (a[i] != b[i]) {
+			return a[i] - b[i];
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * The string functions below read aligned words, which never cross into the
+ * next page, so reading a few bytes past the terminator is harmless.
+ */
+typedef uint32_t __attribute__((may_alias)) string_word_t;
+
+#define STRING_ONES  0x01010101
+#define STRING_HIGHS 0x80808080
+
+// Non-zero if any byte of w is zero
+#define STRING_HAS_ZERO(w) (((w) - STRING_ONES) & ~(w) & STRING_HIGHS)
+
+#define STRING_ALIGNED(p) (((uintptr_t)(p) & (sizeof(string_word_t) - 1)) == 0)
+
 int strcmp(const char * str1, const char *str2)
 {
-	while(*str1 && (*str1==*str2))
-		str1++,str2++;
-	return *(const unsigned char*)str1-*(const unsigned char*)str2;
+	// Words can only be compared if both strings reach a word boundary together
+	if (((uintptr_t)str1 & 3) == ((uintptr_t)str2 & 3)) {
+		for (; !STRING_ALIGNED(str1); str1++, str2++) {
+			if (!*str1 || *str1 != *str2) {
+				return *(const unsigned char *)str1 - *(const unsigned char *)str2;
+			}
+		}
+
+		const string_word_t *w1 = (const string_word_t *)str1;
+		const string_word_t *w2 = (const string_word_t *)str2;
+		while (*w1 == *w2 && !STRING_HAS_ZERO(*w1)) {
+			w1++, w2++;
+		}
+
+		str1 = (const char *)w1;
+		str2 = (const char *)w2;
+	}
+
+	while (*str1 && (*str1 == *str2)) {
+		str1++, str2++;
+	}
+
+	return *(const unsigned char *)str1 - *(const unsigned char *)str2;
 }
 
+/**
+ * returns: destination, like the C library's.
+ */
 char *strcpy (char *destination, const char *source)
 {
-	while (*source) {
-		*destination = *source;
-		destination++,source++;
+	char *d = destination;
+
+	if (((uintptr_t)d & 3) == ((uintptr_t)source & 3)) {
+		for (; !STRING_ALIGNED(source); d++, source++) {
+			if (!(*d = *source)) {
+				return destination;
+			}
+		}
+
+		string_word_t *wd = (string_word_t *)d;
+		const string_word_t *ws = (const string_word_t *)source;
+		while (!STRING_HAS_ZERO(*ws)) {
+			*wd++ = *ws++;
+		}
+
+		d = (char *)wd;
+		source = (const char *)ws;
 	}
 
+	while ((*d++ = *source++));
+
 	return destination;
 }
 
 int strlen(const char *str)
 {
-	register const char *s;
+	const char *s = str;
 
-	for (s = str; *s; s++);
-	return (s - str);
+	for (; !STRING_ALIGNED(s); s++) {
+		if (!*s) {
+			return s - str;
+		}
+	}
+
+	const string_word_t *w = (const string_word_t *)s;
+	while (!STRING_HAS_ZERO(*w)) {
+		w++;
+	}
+
+	for (s = (const char *)w; *s; s++);
+
+	return s - str;
 }
 
 char *strdup(const char *str)
@@ -50,34 +198,54 @@ char *strdup(const char *str)
 	return memcpy(kmalloc(l+1), str, l+1);
 }
 
+/**
+ * Length of the prefix of str consisting of characters in accept. accept is
+ * turned into a bitmap once instead of being scanned for every character.
+ */
 size_t strspn(const char *str, const char *accept) {
-	const char *ptr = str;
-	const char *acc;
+	uint32_t set[256 / 32] = {0};
+	const unsigned char *s = (const unsigned char *)str;
 
-	while (*str) {
-		for (acc = accept; *acc; ++acc) {
-			if (*str == *acc) {
-				break;
-			}
-		}
-		if (*acc == '\0') {
-			break;
-		}
+	for (const unsigned char *a = (const unsigned char *)accept; *a; a++) {
+		set[*a / 32] |= 1 << (*a % 32);
+	}
 
-		str++;
+	// The terminator is never in the set, so it ends the loop
+	while (set[*s / 32] & (1 << (*s % 32))) {
+		s++;
 	}
 
-	return str - ptr;
+	return s - (const unsigned char *)str;
 }
 
+/**
+ * returns: the first occurrence of character in str (the terminator itself if
+ * character is 0), NULL if there is none.
+ */
 char *strchr (char *str, int character) {
+	char c = (char)character;
 
-	do {
-		if (*str == character) {
-			return (char *)str;
+	for (; !STRING_ALIGNED(str); str++) {
+		if (*str == c) {
+			return str;
+		}
+		if (!*str) {
+			return 0;
 		}
 	}
-	while (*str++);
 
-	return 0;
+	string_word_t mask = (uint8_t)c * STRING_ONES;
+	const string_word_t *w = (const string_word_t *)str;
+	while (!STRING_HAS_ZERO(*w) && !STRING_HAS_ZERO(*w ^ mask)) {
+		w++;
+	}
+
+	for (str = (char *)w; ; str++) {
+		if (*str == c) {
+			return str;
+		}
+		if (!*str) {
+			return 0;
+		}
+	}
 }
@@ -1,9 +1,12 @@
+#define LOG_SUBSYS LOG_SYS_PIPE
+
 #include "sys/pipe.h"
 #include "stdint.h"
 #include "mem/kmalloc.h"
 #include "string.h"
 #include "debug.h"
 #include "fs/vfs.h"
+#include "fs/poll.h"
 #include "spinlock.h"
 
 spinlock_t pipe_slock;
@@ -69,6 +72,22 @@ int pipe_pop(pipe_t *pipe, uint32_t size, uint8_t *data)
 	return 0;
 }
 
+/**
+ * Writes never block, they overwrite unread data when the pipe is full.
+ */
+static uint32_t pipe_poll(vfs_node_t *node)
+{
+	pipe_t *pipe = (pipe_t *)node->device;
+
+	return POLLOUT | (pipe->head != pipe->tail ? POLLIN : 0);
+}
+
+static const vfs_ops_t pipe_ops = {
+	.read = pipe_read,
+	.write = pipe_write,
+	.poll = pipe_poll,
+};
+
 vfs_node_t *pipe_device_create(uint32_t length)
 {
 	vfs_node_t *node = (vfs_node_t *)kmalloc(sizeof(vfs_node_t));
@@ -76,13 +95,12 @@ vfs_node_t *pipe_device_create(uint32_t length)
 
 	node->device = NULL;
 	node->mask = VFS_MASK_DEVICE;
-	node->read = pipe_read;
-	node->write = pipe_write;
+	node->ops = &pipe_ops;
 
 	pipe_t *pipe = pipe_create(length);
 
 	if (!pipe) {
-		debug("PIPE: Couldn't create a new pipe!\n");
+		log_err("PIPE: Couldn't create a new pipe!\n");
 	}
 
 	node->device = pipe;
@@ -90,7 +108,7 @@ vfs_node_t *pipe_device_create(uint32_t length)
 	return node;
 }
 
-int pipe_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *data)
+uint32_t pipe_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *data)
 {
 	if (!(node->mask & VFS_MASK_DEVICE)) {
 		PANIC("Tried to read from a non-device node.\n");
@@ -99,11 +117,16 @@ int pipe_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *data)
 	return pipe_pop((pipe_t *)node->device, size, data);
 }
 
-int pipe_write(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *data)
+uint32_t pipe_write(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *data)
 {
 	if (!(node->mask & VFS_MASK_DEVICE)) {
 		PANIC("Tried to read from a non-device node.\n");
 	}
 
-	return pipe_push((pipe_t *)node->device, size, data);
+	int ret = pipe_push((pipe_t *)node->device, size, data);
+	if (ret == 0) {
+		vfs_poll_notify(node, POLLIN);
+	}
+
+	return ret;
 }
@@ -2,18 +2,52 @@
 #include "io.h"
 #include "idt.h"
 
+#define TIMER_MAX_HANDLERS 8
+
 uint32_t ticks = 0;
+static uint32_t timer_frequency = 0;
+
+// Periodic work that runs from the timer interrupt
+static struct {
+	timer_handler_t handler;
+	uint32_t interval;
+} timer_handlers[TIMER_MAX_HANDLERS];
 
 static void timer_callback(registers_t regs)
 {
 	regs = regs; // Suppress compiler warning about unused parameter
 	ticks++;
+
+	for (uint32_t i = 0; i < TIMER_MAX_HANDLERS; i++) {
+		if (timer_handlers[i].handler && ticks % timer_handlers[i].interval == 0) {
+			timer_handlers[i].handler(ticks);
+		}
+	}
+}
+
+/**
+ * Call handler from the timer interrupt every interval ticks.
+ *
+ * returns: 0 on success, -1 when all slots are taken.
+ */
+int timer_register_handler(timer_handler_t handler, uint32_t interval)
+{
+	for (uint32_t i = 0; i < TIMER_MAX_HANDLERS; i++) {
+		if (!timer_handlers[i].handler) {
+			timer_handlers[i].interval = interval ? interval : 1;
+			timer_handlers[i].handler = handler;
+			return 0;
+		}
+	}
+
+	return -1;
 }
 
 void init_timer(uint32_t frequency)
 {
 	register_interrupt_handler(IRQ0, &timer_callback);
 
+	timer_frequency = frequency;
 	uint32_t divisor = 1193180 / frequency;
 
 	outb(0x43, 0x36);
@@ -30,6 +64,14 @@ uint32_t get_timer_ticks()
 	return ticks;
 }
 
+/**
+ * returns: the number of ticks covering milliseconds, rounded up.
+ */
+uint32_t timer_ms_to_ticks(uint32_t milliseconds)
+{
+	return milliseconds / 1000 * timer_frequency + ((milliseconds % 1000) * timer_frequency + 999) / 1000;
+}
+
 void sleep(int milliseconds)
 {
 	uint32_t cur = get_timer_ticks();
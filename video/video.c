@@ -2,81 +2,223 @@
 #include "stdlib.h"
 #include "string.h"
 #include "stdio.h"
+#include "stdbool.h"
 #include "io.h"
+#include "cpu.h"
+#include "timer.h"
+
+#define VIDEO_COLS 80
+#define VIDEO_ROWS 25
+#define VIDEO_ATTRIBUTE ((0 << 4) | (15 & 0x0F))	// White on black
+#define VIDEO_BLANK (' ' | (VIDEO_ATTRIBUTE << 8))
+
+#define VIDEO_WINDOW_ROWS (0x8000 / (VIDEO_COLS * sizeof(uint16_t)))	// Rows in the 32KB text window
+
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA  0x3D5
+#define VGA_CRTC_START_HIGH  0x0C
+#define VGA_CRTC_START_LOW   0x0D
+#define VGA_CRTC_CURSOR_HIGH 0x0E
+#define VGA_CRTC_CURSOR_LOW  0x0F
+
+#define VIDEO_FLUSH_CHARS (VIDEO_COLS * VIDEO_ROWS)	// Flush at the latest after this many characters
+#define VIDEO_FLUSH_INTERVAL 1		// Timer ticks
 
 unsigned short *VIDEO_MEM = (unsigned short *)0xB8000;
 
 uint8_t cursor_x, cursor_y = 0;
 
-void puts(const char c )
+/*
+ * Everything is drawn into a shadow copy of the screen in RAM and copied to
+ * video memory in batches, since writes to it are slow (especially in a VM).
+ * The rows form a ring, screen row y is video_rows[(video_top + y) % VIDEO_ROWS],
+ * so scrolling just moves video_top.
+ *
+ * On the hardware side the screen is a window into the 32KB of text memory,
+ * starting at row video_origin. Scrolling moves the window down through the CRTC
+ * start address, so only the new bottom row has to be written. Once it reaches
+ * the end of text memory the screen is redrawn at the top.
+ */
+static uint16_t video_rows[VIDEO_ROWS][VIDEO_COLS];
+static uint32_t video_top = 0;
+static uint32_t video_dirty = 0;	// Screen rows that differ from video memory, one bit each
+static uint32_t video_pending = 0;	// Characters written since the last flush
+static uint32_t video_last_flush = 0;
+static bool video_timer = false;	// Whether the timer flushes what newlines leave behind
+
+static uint32_t video_origin = 0;	// Row of text memory shown at the top of the screen
+static uint32_t video_hw_origin = 0xFFFFFFFF;	// ... as last written to the CRTC
+static uint32_t video_hw_cursor = 0xFFFFFFFF;
+
+static void vga_crtc_write16(uint8_t high_reg, uint8_t low_reg, uint16_t value)
+{
+	outb(VGA_CRTC_INDEX, high_reg);
+	outb(VGA_CRTC_DATA, (value >> 8) & 0xFF);
+	outb(VGA_CRTC_INDEX, low_reg);
+	outb(VGA_CRTC_DATA, value & 0xFF);
+}
+
+static inline uint16_t *video_row(uint32_t y)
+{
+	return video_rows[(video_top + y) % VIDEO_ROWS];
+}
+
+static void video_scroll(void)
+{
+	video_top = (video_top + 1) % VIDEO_ROWS;
+
+	uint16_t *last = video_row(VIDEO_ROWS - 1);
+	for (uint32_t x = 0; x < VIDEO_COLS; x++) {
+		last[x] = VIDEO_BLANK;
+	}
+
+	if (video_origin + VIDEO_ROWS < VIDEO_WINDOW_ROWS) {
+		// Rows already in text memory move up with the window
+		video_origin++;
+		video_dirty = (video_dirty >> 1) | (1 << (VIDEO_ROWS - 1));
+	} else {
+		video_origin = 0;
+		video_dirty = (1 << VIDEO_ROWS) - 1;
+	}
+}
+
+/**
+ * Copy the rows that changed to video memory, then move the window and the
+ * cursor if they changed.
+ */
+void video_flush()
+{
+	uint32_t flags = irq_save();
+
+	for (uint32_t y = 0; video_dirty; y++) {
+		if (video_dirty & (1 << y)) {
+			memcpy(VIDEO_MEM + (video_origin + y) * VIDEO_COLS, video_row(y), sizeof(uint16_t) * VIDEO_COLS);
+			video_dirty &= ~(1 << y);
+		}
+	}
+
+	if (video_origin != video_hw_origin) {
+		vga_crtc_write16(VGA_CRTC_START_HIGH, VGA_CRTC_START_LOW, video_origin * VIDEO_COLS);
+		video_hw_origin = video_origin;
+	}
+
+	update_cursor(cursor_y, cursor_x);
+
+	video_pending = 0;
+	video_last_flush = get_timer_ticks();
+
+	irq_restore(flags);
+}
+
+static void video_flush_timer(uint32_t ticks)
 {
-	// Create attribute byte
-	uint8_t attribute = (0 << 4) | (15 & 0x0F);
+	if (video_pending) {
+		video_flush();
+	}
+}
+
+/**
+ * Flush from the timer from now on. Newlines then only flush once per tick,
+ * the timer picks up the rest.
+ */
+void video_init()
+{
+	timer_register_handler(&video_flush_timer, VIDEO_FLUSH_INTERVAL);
+	video_timer = true;
+}
+
+static void video_putc(const char c)
+{
+	video_pending++;
 
 	if (c == '\n') {
 		cursor_x = 0;
 		cursor_y++;
-		update_cursor(cursor_y, cursor_x);
+		if (cursor_y >= VIDEO_ROWS) {
+			video_scroll();
+			cursor_y = VIDEO_ROWS - 1;
+		}
+		if (!video_timer || video_last_flush != get_timer_ticks() || video_pending >= VIDEO_FLUSH_CHARS) {
+			video_flush();
+		}
 		return;
 	}
 
 	if (c == '\t') {
 		cursor_x += 4;
-		update_cursor(cursor_y, cursor_x);
 		return;
 	}
 
 	if (c == '\b') {
-		cursor_x--;
-		uint16_t *location = VIDEO_MEM + (cursor_y * 80 + cursor_x);
-		memset(location, (' ' | (attribute << 8)), sizeof(uint8_t));
-		update_cursor(cursor_y, cursor_x);
+		if (cursor_x > 0) {
+			cursor_x--;
+			video_row(cursor_y)[cursor_x] = VIDEO_BLANK;
+			video_dirty |= 1 << cursor_y;
+		}
 		return;
 	}
 
-	// Calculate the offset
-	if (cursor_x > 80) {
+	if (cursor_x >= VIDEO_COLS) {
 		cursor_y++;
 		cursor_x = 0;
 	}
 
-	if (cursor_y > 24) {
-		// Scrolling
-		for (size_t i = 1; i < 25; i++) { // Start at line 1 and copy one line up
-			uint32_t *loc = VIDEO_MEM + (i * 80);
-			uint32_t *dst = VIDEO_MEM + ((i - 1) * 80);
-			memcpy(dst, loc, (sizeof(uint16_t) * 80));
-		}
-		memset((VIDEO_MEM + (24 * 80)), 0x0, (sizeof(uint16_t) * 80));
-		cursor_y = 24;
+	if (cursor_y >= VIDEO_ROWS) {
+		video_scroll();
+		cursor_y = VIDEO_ROWS - 1;
 	}
 
-	// Calculate the position
-	uint16_t *location = VIDEO_MEM + (cursor_y * 80 + cursor_x);
+	video_row(cursor_y)[cursor_x] = c | (VIDEO_ATTRIBUTE << 8);
+	video_dirty |= 1 << cursor_y;
 
-	// Write the actual character
-	//memset(location, (c | (attribute << 8)), sizeof(uint8_t));
-	*location = c | (attribute << 8);
-
-	// Update cursor location
 	cursor_x++;
 
-	update_cursor(cursor_y, cursor_x);
+	if (video_pending >= VIDEO_FLUSH_CHARS) {
+		video_flush();
+	}
+}
+
+void puts(const char c )
+{
+	uint32_t flags = irq_save();
+	video_putc(c);
+	irq_restore(flags);
+}
+
+/**
+ * Write a string of len characters (it needn't be terminated) in one go.
+ */
+void video_write(const char *str, uint32_t len)
+{
+	uint32_t flags = irq_save();
+
+	for (uint32_t i = 0; i < len; i++) {
+		video_putc(str[i]);
+	}
+
+	irq_restore(flags);
 }
 
 void cls()
 {
-	// Create attribute byty
-	uint8_t attribute = (0 << 4) | (15 & 0x0F);
-	uint16_t blank = 0x20 | (attribute << 8);
+	uint32_t flags = irq_save();
 
-	uint32_t i;
-	for (i = 0; i < 80 * 25; i++) {
-		VIDEO_MEM[i] = blank;
+	for (uint32_t y = 0; y < VIDEO_ROWS; y++) {
+		for (uint32_t x = 0; x < VIDEO_COLS; x++) {
+			video_rows[y][x] = VIDEO_BLANK;
+		}
 	}
 
+	video_top = 0;
+	video_origin = 0;
+	video_dirty = (1 << VIDEO_ROWS) - 1;
+
 	cursor_x = 0;
 	cursor_y = 0;
+
+	video_flush();
+
+	irq_restore(flags);
 }
 
 void write_at(char *string, uint8_t x, uint8_t y)
@@ -98,17 +240,15 @@ void write_at(char *string, uint8_t x, uint8_t y)
 	cursor_y = orig_y;
 }
 
-/* void update_cursor(int row, int col)
- * by Dark Fiber
+/**
+ * Move the hardware cursor to a screen position, unless it is there already.
  */
 void update_cursor(int row, int col)
 {
-	unsigned short position = (row * 80) + col;
-
-    // cursor LOW port to vga INDEX register
-    outb(0x3D4, 0x0F);
-    outb(0x3D5, (unsigned char)(position & 0xFF));
-    // cursor HIGH port to vga INDEX register
-    outb(0x3D4, 0x0E);
-    outb(0x3D5, (unsigned char )((position >> 8) & 0xFF));
+	uint32_t position = (video_origin + row) * VIDEO_COLS + col;
+
+	if (position != video_hw_cursor) {
+		vga_crtc_write16(VGA_CRTC_CURSOR_HIGH, VGA_CRTC_CURSOR_LOW, position);
+		video_hw_cursor = position;
+	}
 }